@@ -0,0 +1,269 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, bench/corpus.h, generates the expressions the
+ * benchmarks run on. The same seed always gives the same
+ * expressions, on every machine, so that timings taken on
+ * different builds, or before and after a change, can be compared.
+ *
+ * [Kind]	[Expressions]
+ * deep		64 to 512 levels of parentheses
+ * flat		256 to 1024 terms, and no parentheses
+ * numbers	16 to 64 long decimal, hex, octal and binary numbers
+ * rpn		RPN lines, as read by "calc -r"
+ * shaped	RPN lines with the same operators, on different numbers
+ *
+ * Every number is at least 1, and divisors are always numbers,
+ * so no expression divides by zero.
+ *
+ * Usage:
+ * uint64_t seed = 1;
+ * size_t len = corpus_line(buf, CORPUS_LINE_MAX, CORPUS_DEEP, &seed);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Longest line corpus_line() writes, including its NUL */
+#define CORPUS_LINE_MAX 16384
+
+enum corpus_kind {
+	CORPUS_DEEP,
+	CORPUS_FLAT,
+	CORPUS_NUMBERS,
+	CORPUS_RPN,
+	CORPUS_SHAPED,
+	CORPUS_KINDS,
+};
+
+static const char *const corpus_names[CORPUS_KINDS] = {
+	"deep", "flat", "numbers", "rpn", "shaped",
+};
+
+/* Function prototypes */
+static inline uint64_t corpus_rand(uint64_t *);
+static inline uint64_t corpus_range(uint64_t *, uint64_t, uint64_t);
+static inline size_t corpus_number(char *, uint64_t *, int);
+static inline size_t corpus_deep(char *, uint64_t *);
+static inline size_t corpus_flat(char *, uint64_t *);
+static inline size_t corpus_numbers(char *, uint64_t *);
+static inline size_t corpus_rpn(char *, uint64_t *, uint64_t *);
+static inline size_t corpus_line(char *, size_t, enum corpus_kind, uint64_t *);
+static inline int corpus_kind(const char *);
+
+/* Next number of a xorshift64* generator; *seed must not be 0 */
+static inline uint64_t
+corpus_rand(uint64_t *seed)
+{
+	*seed ^= *seed >> 12;
+	*seed ^= *seed << 25;
+	*seed ^= *seed >> 27;
+	return *seed * 0x2545f4914f6cdd1dULL;
+}
+
+/* Random number between lo and hi, both included */
+static inline uint64_t
+corpus_range(uint64_t *seed, uint64_t lo, uint64_t hi)
+{
+	return lo + corpus_rand(seed) % (hi - lo + 1);
+}
+
+/* Write a number of up to digits decimal digits, or, if digits
+ * is 0, a long number in a random base. Returns its length. */
+static inline size_t
+corpus_number(char *s, uint64_t *seed, int digits)
+{
+	uint64_t n = corpus_rand(seed);
+
+	if (digits > 0) {
+		uint64_t max = 1;
+
+		while (digits-- > 0)
+			max *= 10;
+
+		n = n % (max - 1) + 1;
+		return sprintf(s, "%llu", (unsigned long long)n);
+	}
+
+	switch (n & 3) {
+	case 0:
+		return sprintf(s, "%llu", (unsigned long long)
+			       (n >> 2) % 999999999999999999ULL + 1);
+
+	case 1:
+		return sprintf(s, "0x%llx", (unsigned long long)(n >> 2 | 1));
+
+	case 2:
+		return sprintf(s, "0o%llo", (unsigned long long)(n >> 2 | 1));
+
+	default:
+		s[0] = '0';
+		s[1] = 'b';
+		for (int i = 0; i < 48; i++)
+			s[i + 2] = '0' + (i == 0 || (n >> (i + 2) & 1));
+
+		s[50] = '\0';
+		return 50;
+	}
+}
+
+/* Left- or right-nested parentheses, such as
+ * "((1 + 2) * 3) - 4" or "1 + (2 * (3 - 4))" */
+static inline size_t
+corpus_deep(char *s, uint64_t *seed)
+{
+	static const char ops[] = "+-*/%";
+	int depth = corpus_range(seed, 64, 512);
+	size_t len = 0;
+
+	/* Right-nested: the divisors would be expressions,
+	 * which may be 0, so only + - * are used */
+	if (corpus_rand(seed) & 1) {
+		for (int i = 0; i < depth; i++) {
+			len += corpus_number(s + len, seed, 4);
+			len += sprintf(s + len, " %c (",
+				       ops[corpus_rand(seed) % 3]);
+		}
+
+		len += corpus_number(s + len, seed, 4);
+		memset(s + len, ')', depth);
+		len += depth;
+	} else {
+		memset(s, '(', depth);
+		len = depth;
+		len += corpus_number(s + len, seed, 4);
+
+		for (int i = 0; i < depth; i++) {
+			len += sprintf(s + len, " %c ",
+				       ops[corpus_rand(seed) % 5]);
+			len += corpus_number(s + len, seed, 4);
+			s[len++] = ')';
+		}
+	}
+
+	s[len] = '\0';
+	return len;
+}
+
+/* A long chain of every operator but powers,
+ * such as "12 + 345 * 6 << 2 - 78 % 9" */
+static inline size_t
+corpus_flat(char *s, uint64_t *seed)
+{
+	static const char *const ops[] = {
+		" + ", " - ", " * ", " / ", " % ", " << ", " >> ",
+	};
+	int terms = corpus_range(seed, 256, 1024);
+	size_t len = corpus_number(s, seed, 6);
+
+	for (int i = 1; i < terms; i++) {
+		int op = corpus_rand(seed) % 7;
+
+		len += sprintf(s + len, "%s", ops[op]);
+		len += corpus_number(s + len, seed, op >= 5 ? 1 : 6);
+	}
+
+	return len;
+}
+
+/* Few operators, long numbers: mostly the lexer's work */
+static inline size_t
+corpus_numbers(char *s, uint64_t *seed)
+{
+	int terms = corpus_range(seed, 16, 64);
+	size_t len = corpus_number(s, seed, 0);
+
+	for (int i = 1; i < terms; i++) {
+		len += sprintf(s + len, " %c ", "+-"[corpus_rand(seed) & 1]);
+		len += corpus_number(s + len, seed, 0);
+	}
+
+	return len;
+}
+
+/* A line of RPN, such as "1.5 2 + 3 4 * -", kept at most 4
+ * deep. Only numbers are divided by, as results may be 0.
+ * Operators, and where numbers go, are picked with shape, and
+ * numbers with seed, which may be the same. */
+static inline size_t
+corpus_rpn(char *s, uint64_t *shape, uint64_t *seed)
+{
+	static const char ops[] = "+-*/";
+	int terms = corpus_range(shape, 16, 256), depth = 0, number = 0;
+	size_t len = 0;
+
+	for (int i = 0; i < terms || depth > 1; i++) {
+		if (depth < 2 || (depth < 4 && i < terms
+				  && corpus_rand(shape) % 3 == 0)) {
+			len += corpus_number(s + len, seed, 5);
+
+			if (corpus_rand(seed) % 4 == 0)
+				len += sprintf(s + len, ".%d", (int)
+					       corpus_range(seed, 1, 99));
+			depth++;
+			number = 1;
+		} else {
+			s[len++] = ops[corpus_rand(shape) % (number ? 4 : 3)];
+			depth--;
+			number = 0;
+		}
+
+		s[len++] = ' ';
+	}
+
+	s[--len] = '\0';
+	return len;
+}
+
+/* Write the next expression of the given kind to s, which holds
+ * size bytes, at least CORPUS_LINE_MAX; seed is updated.
+ * Returns its length, or 0 if size is too small. */
+static inline size_t
+corpus_line(char *s, size_t size, enum corpus_kind kind, uint64_t *seed)
+{
+	/* Every shaped line starts from the same shape */
+	uint64_t shape = 0x9e3779b97f4a7c15ULL;
+
+	if (size < CORPUS_LINE_MAX)
+		return 0;
+
+	switch (kind) {
+	case CORPUS_DEEP:
+		return corpus_deep(s, seed);
+
+	case CORPUS_FLAT:
+		return corpus_flat(s, seed);
+
+	case CORPUS_NUMBERS:
+		return corpus_numbers(s, seed);
+
+	case CORPUS_RPN:
+		return corpus_rpn(s, seed, seed);
+
+	case CORPUS_SHAPED:
+		return corpus_rpn(s, &shape, seed);
+
+	default:
+		return 0;
+	}
+}
+
+/* Kind with the given name, or -1 */
+static inline int
+corpus_kind(const char *name)
+{
+	for (int i = 0; i < CORPUS_KINDS; i++)
+		if (strcmp(name, corpus_names[i]) == 0)
+			return i;
+
+	return -1;
+}
+
+#endif
@@ -0,0 +1,270 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/format.c, measures the formatters of
+ * format.h against the snprintf() calls they replaced, on random
+ * values: 64-bit integers of every length, in decimal and in
+ * hexadecimal, doubles with random bits, and doubles with few
+ * digits, such as 12.5. It also checks that every integer is
+ * written like snprintf() writes it, and every double reads back
+ * as itself, and counts the doubles written with more digits
+ * than they need.
+ *
+ * Usage:
+ * make bench_format && ./bench_format [VALUES]
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/format.h"
+
+#define ROUNDS 10		/* Times each array is formatted */
+
+/* Kinds of values */
+enum kind {
+	INT,			/* Integers, in decimal */
+	HEX,			/* Integers, in hexadecimal */
+	DOUBLE,			/* Doubles with random bits */
+	SHORT,			/* Doubles with few digits */
+};
+
+static const char *const kind_names[] = {
+	[INT] = "int", [HEX] = "hex", [DOUBLE] = "double", [SHORT] = "short",
+};
+
+/* Function prototypes */
+static double now(void);
+static uint64_t random64(void);
+static uint64_t random_in(enum kind);
+static size_t format_libc(char *, uint64_t, enum kind);
+static size_t format_calc(char *, uint64_t, enum kind);
+static size_t digits(const char *, size_t);
+static size_t shortest(double);
+static int bench(enum kind, size_t);
+
+/* Monotonic time, in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 64 random bits */
+static uint64_t
+random64(void)
+{
+	uint64_t r = 0;
+
+	for (int i = 0; i < 4; i++)
+		r = r << 16 | (rand() & 0xFFFF);
+
+	return r;
+}
+
+/* Random value of a kind: integers of a random length,
+ * doubles as their bits */
+static uint64_t
+random_in(enum kind k)
+{
+	uint64_t r = random64();
+	char buf[32];
+	double d;
+
+	switch (k) {
+	case DOUBLE:
+		/* Not infinities, nor NaNs */
+		while ((r >> 52 & 0x7FF) == 0x7FF)
+			r = random64();
+		return r;
+
+	case SHORT:
+		/* Not divided by 100, which -Ofast makes inexact */
+		snprintf(buf, sizeof(buf), "%" PRId64 ".%02d",
+			 (int64_t)(r % 20001) - 10000, rand() % 100);
+		d = strtod(buf, NULL);
+		memcpy(&r, &d, sizeof(r));
+		return r;
+
+	default:
+		return r >> (rand() % 64);
+	}
+}
+
+/* Write a value the way calc did, with snprintf() */
+static size_t
+format_libc(char *buf, uint64_t v, enum kind k)
+{
+	double d;
+
+	switch (k) {
+	case INT:
+		return snprintf(buf, FMT_MAX, "%" PRId64, (int64_t)v);
+
+	case HEX:
+		return snprintf(buf, FMT_MAX, "0x%" PRIx64, v);
+
+	default:
+		memcpy(&d, &v, sizeof(d));
+		return snprintf(buf, FMT_MAX, "%.17g", d);
+	}
+}
+
+/* Write a value with format.h */
+static size_t
+format_calc(char *buf, uint64_t v, enum kind k)
+{
+	double d;
+
+	switch (k) {
+	case INT:
+		return fmt_i64(buf, v);
+
+	case HEX:
+		return fmt_radix(buf, v, 4);
+
+	default:
+		memcpy(&d, &v, sizeof(d));
+		return fmt_double(buf, d);
+	}
+}
+
+/* Significant digits of a written double */
+static size_t
+digits(const char *s, size_t len)
+{
+	const char *end = memchr(s, 'e', len);
+	size_t n = 0, zeros = 0;
+	bool seen = false;
+
+	if (end == NULL)
+		end = s + len;
+
+	for (; s < end; s++) {
+		if (*s < '0' || *s > '9' || (*s == '0' && !seen))
+			continue;
+
+		/* Trailing zeros aren't significant */
+		seen = true;
+		if (*s == '0') {
+			zeros++;
+		} else {
+			n += zeros + 1;
+			zeros = 0;
+		}
+	}
+
+	return n > 0 ? n : 1;
+}
+
+/* Fewest significant digits that read back as d */
+static size_t
+shortest(double d)
+{
+	char buf[32];
+
+	for (int p = 1; p < 17; p++) {
+		snprintf(buf, sizeof(buf), "%.*e", p - 1, d);
+		if (strtod(buf, NULL) == d)
+			return p;
+	}
+
+	return 17;
+}
+
+/* Measure both ways of writing n random values of a kind.
+ * Returns 0, or 1 if a value was written wrong, or the array
+ * couldn't be allocated. */
+static int
+bench(enum kind k, size_t n)
+{
+	uint64_t *in = malloc(n * sizeof(*in));
+	size_t bad = 0, longer = 0, sum = 0, len;
+	char buf[FMT_MAX + 1], ref[FMT_MAX + 1];
+	double t0, t1, t2, d;
+
+	if (in == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		in[i] = random_in(k);
+
+	/* Accuracy */
+	for (size_t i = 0; i < n; i++) {
+		len = format_calc(buf, in[i], k);
+		buf[len] = '\0';
+		format_libc(ref, in[i], k);
+		memcpy(&d, &in[i], sizeof(d));
+
+		if (k < DOUBLE ? strcmp(buf, ref) != 0
+		    : strtod(buf, NULL) != d
+		    || signbit(strtod(buf, NULL)) != signbit(d)) {
+			if (bad++ == 0)
+				fprintf(stderr, "%s was written as %s\n",
+					ref, buf);
+		} else if (k >= DOUBLE && d != 0
+			   && digits(buf, len) > shortest(d)) {
+			longer++;
+		}
+	}
+
+	/* Speed */
+	t0 = now();
+	for (int r = 0; r < ROUNDS; r++)
+		for (size_t i = 0; i < n; i++)
+			sum += format_libc(buf, in[i], k);
+
+	t1 = now();
+	for (int r = 0; r < ROUNDS; r++)
+		for (size_t i = 0; i < n; i++)
+			sum += format_calc(buf, in[i], k) + buf[0];
+	t2 = now();
+
+	printf("%-8s %10.2f %10.2f %9.1fx %10zu %10zu\n", kind_names[k],
+	       (t1 - t0) * 1e9 / (ROUNDS * n), (t2 - t1) * 1e9 / (ROUNDS * n),
+	       (t1 - t0) / (t2 - t1), bad, longer);
+
+	/* Keep the loops from being optimised out */
+	if (sum == 42)
+		putchar('\n');
+
+	free(in);
+	return bad > 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	int status = 0;
+
+	if (n == 0) {
+		fprintf(stderr, "Usage: %s [VALUES]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+
+	printf("%-8s %10s %10s %10s %10s %10s\n", "[Kind]", "[libc ns]",
+	       "[calc ns]", "[Speedup]", "[Wrong]", "[Longer]");
+
+	for (int k = INT; k <= SHORT; k++)
+		status |= bench(k, n);
+
+	return status;
+}
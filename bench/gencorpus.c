@@ -0,0 +1,51 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/gencorpus.c, prints COUNT expressions of
+ * the given kind, one per line, as generated by bench/corpus.h;
+ * the same SEED always gives the same expressions. They can be
+ * fed to calc, to time it as a whole:
+ *
+ * ./gencorpus flat 10000 > flat.txt && time ./calc < flat.txt
+ * ./gencorpus rpn 10000 > rpn.txt && time ./calc -r < rpn.txt
+ *
+ * Usage:
+ * make gencorpus && ./gencorpus KIND [COUNT] [SEED]
+ *
+ * KIND is one of deep, flat, numbers, rpn and shaped.
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "corpus.h"
+
+int
+main(int argc, char **argv)
+{
+	static char line[CORPUS_LINE_MAX];
+	unsigned long count = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+	uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+	int kind = argc > 1 ? corpus_kind(argv[1]) : -1;
+	size_t len;
+
+	if (kind < 0 || count == 0 || seed == 0) {
+		fprintf(stderr, "Usage: %s deep|flat|numbers|rpn|"
+			"shaped [COUNT] [SEED]\n", argv[0]);
+		return 1;
+	}
+
+	for (unsigned long i = 0; i < count; i++) {
+		len = corpus_line(line, sizeof(line), kind, &seed);
+		line[len] = '\n';
+		fwrite(line, 1, len + 1, stdout);
+	}
+
+	return ferror(stdout) != 0;
+}
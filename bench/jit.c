@@ -0,0 +1,153 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/jit.c, compares the bytecode interpreter
+ * of vm.h with the machine code generated by jit.h, on a short
+ * and a long expression, each evaluated over and over with
+ * changing variables, as CSV mode does.
+ *
+ * Usage:
+ * make bench_jit && ./bench_jit [ITERATIONS]
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/jit.h"
+#include "../src/parse.h"
+#include "../src/vm.h"
+
+#define LONG_TERMS 100		/* Terms of the long expression */
+
+static const char *const names[] = { "a", "b", "c", "d" };
+
+/* Function prototypes */
+static double now(void);
+static char *long_expr(void);
+static int bench(const char *, const char *, unsigned long);
+
+/* Monotonic time, in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build a long expression, using every operator but powers */
+static char *
+long_expr(void)
+{
+	static const char *const terms[] = {
+		"a * 3", "b / 7", "(c << 2)", "d % 11", "(a + b) * c",
+		"(d >> 1)", "-a", "b * d - c", "12345678901 / (c + 1)",
+	};
+	char *s = malloc(LONG_TERMS * 32), *p = s;
+
+	if (s == NULL)
+		return NULL;
+
+	for (int i = 0; i < LONG_TERMS; i++)
+		p += sprintf(p, "%s%s", i > 0 ? (i % 3 ? " + " : " - ") : "",
+			     terms[i % (sizeof(terms) / sizeof(*terms))]);
+
+	return s;
+}
+
+/* Time both evaluators on an expression.
+ * Returns 0 if they agreed on every result, 1 otherwise. */
+static int
+bench(const char *name, const char *expr, unsigned long iters)
+{
+	struct arena a = { .vars = names, .nvars = 4 };
+	struct program prog = { 0 };
+	struct jit jit = { 0 };
+	uint64_t vars[4], r1, r2, sum1 = 0, sum2 = 0;
+	double t0, t1, t2;
+	uint32_t root;
+	int status = 0;
+
+	if (!parse(&a, expr, strlen(expr)) || (root = build_ast(&a)) == NO_NODE
+	    || !compile(&prog, &a, root)) {
+		fprintf(stderr, "%s: %s\n", name, a.err[0] ? a.err : prog.err);
+		status = 1;
+		goto out;
+	}
+
+	if (!jit_compile(&jit, &prog)) {
+		fprintf(stderr, "%s: %s\n", name, jit.err);
+		status = 1;
+		goto out;
+	}
+
+	prog.vars = vars;
+
+	t0 = now();
+	for (unsigned long i = 0; i < iters; i++) {
+		vars[0] = i;
+		vars[1] = i ^ 0x5555;
+		vars[2] = i & 31;
+		vars[3] = i * 7 + 1;
+		run(&prog, &r1);
+		sum1 += r1;
+	}
+
+	t1 = now();
+	for (unsigned long i = 0; i < iters; i++) {
+		vars[0] = i;
+		vars[1] = i ^ 0x5555;
+		vars[2] = i & 31;
+		vars[3] = i * 7 + 1;
+		jit_run(&jit, vars, &r2);
+		sum2 += r2;
+	}
+	t2 = now();
+
+	printf("%-8s %6" PRIu32 " %14.2f %14.2f %9.1fx\n", name, prog.len,
+	       (t1 - t0) * 1e9 / iters, (t2 - t1) * 1e9 / iters,
+	       (t1 - t0) / (t2 - t1));
+
+	if (sum1 != sum2) {
+		fprintf(stderr, "%s: results differ!\n", name);
+		status = 1;
+	}
+
+ out:
+	jit_free(&jit);
+	program_free(&prog);
+	arena_free(&a);
+	return status;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long iters = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+	char *expr = long_expr();
+	int status = 0;
+
+	if (expr == NULL || iters == 0) {
+		fprintf(stderr, "Usage: %s [ITERATIONS]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-8s %6s %14s %14s %10s\n", "[Expr]", "[Ops]",
+	       "[Interp ns]", "[JIT ns]", "[Speedup]");
+
+	status |= bench("short", "(a * 3 + b) % 7", iters);
+	status |= bench("long", expr, iters / LONG_TERMS);
+
+	free(expr);
+	return status;
+}
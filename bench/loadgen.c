@@ -0,0 +1,303 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/loadgen.c, measures how long "calc -S"
+ * takes to answer: CLIENTS threads each connect to the socket,
+ * and send REQUESTS short expressions, keeping DEPTH of them in
+ * flight at once (1 waits for every answer before sending the next
+ * request). The time from sending a request to reading its answer
+ * is its latency; the percentiles of every latency are printed as
+ * CSV, in microseconds:
+ *
+ * ./calc -j 4 -S /tmp/calc.sock &
+ * ./loadgen /tmp/calc.sock 16 20000 1
+ *
+ * Usage:
+ * make loadgen && ./loadgen PATH [CLIENTS] [REQUESTS] [DEPTH]
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "corpus.h"
+
+#define EXPRS 1024		/* Expressions generated per client */
+#define MAX_DEPTH 4096		/* Most requests in flight per client */
+
+/* Connection to calc, and what it measured */
+struct client {
+	struct sockaddr_un sa;
+	pthread_barrier_t *start;
+	char *exprs;		/* EXPRS expressions, one per line */
+	size_t offs[EXPRS + 1];	/* Where each of them starts */
+	uint64_t *lat;		/* Latency of each request, in ns */
+	uint64_t sent[MAX_DEPTH];	/* When requests in flight were sent */
+	char out[MAX_DEPTH * 32];	/* Requests being sent */
+	unsigned long requests;
+	unsigned long errors;	/* Answers starting with "Error:" */
+	unsigned int depth;
+	uint64_t seed;
+	int fd;
+	pthread_t thread;
+};
+
+/* Function prototypes */
+static uint64_t now(void);
+static int cmp(const void *, const void *);
+static void gen(struct client *);
+static int sendreqs(struct client *, unsigned long, unsigned long);
+static void *run(void *);
+
+/* Monotonic time, in nanoseconds */
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Expressions such as "123 * 45 + 6789": short enough that the
+ * time to answer them, rather than to evaluate them, is measured.
+ * Each client has its own, so that they don't all hit the cache. */
+static void
+gen(struct client *c)
+{
+	static const char ops[] = "+-*%";
+	size_t len = 0;
+
+	for (int i = 0; i < EXPRS; i++) {
+		c->offs[i] = len;
+		len += corpus_number(c->exprs + len, &c->seed, 4);
+
+		for (int k = 0; k < 2; k++) {
+			len += sprintf(c->exprs + len, " %c ",
+				       ops[corpus_rand(&c->seed) % 4]);
+			len += corpus_number(c->exprs + len, &c->seed, 4);
+		}
+
+		c->exprs[len++] = '\n';
+	}
+
+	c->offs[EXPRS] = len;
+}
+
+/* Send requests first to last - 1 with a single write,
+ * noting when they were sent */
+static int
+sendreqs(struct client *c, unsigned long first, unsigned long last)
+{
+	char *buf = c->out;
+	size_t len = 0, n;
+	uint64_t t;
+	ssize_t w;
+
+	for (unsigned long i = first; i < last; i++) {
+		n = c->offs[i % EXPRS + 1] - c->offs[i % EXPRS];
+		memcpy(buf + len, c->exprs + c->offs[i % EXPRS], n);
+		len += n;
+	}
+
+	t = now();
+	for (unsigned long i = first; i < last; i++)
+		c->sent[i % MAX_DEPTH] = t;
+
+	for (size_t off = 0; off < len; off += w) {
+		if ((w = write(c->fd, buf + off, len - off)) < 0) {
+			if (errno == EINTR) {
+				w = 0;
+				continue;
+			}
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Client thread: keep depth requests in flight until every
+ * answer has been read */
+static void *
+run(void *arg)
+{
+	struct client *c = arg;
+	char buf[65536], *p, *nl;
+	unsigned long nsent, nread = 0;
+	size_t len = 0;
+	ssize_t n;
+	uint64_t t;
+
+	pthread_barrier_wait(c->start);
+
+	nsent = c->depth < c->requests ? c->depth : c->requests;
+	if (sendreqs(c, 0, nsent) < 0)
+		goto fail;
+
+	while (nread < c->requests) {
+		if ((n = read(c->fd, buf + len, sizeof(buf) - len)) <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			goto fail;
+		}
+
+		t = now();
+		len += n;
+		p = buf;
+
+		while ((nl = memchr(p, '\n', buf + len - p)) != NULL) {
+			if (nl - p >= 6 && memcmp(p, "Error:", 6) == 0)
+				c->errors++;
+
+			c->lat[nread] = t - c->sent[nread % MAX_DEPTH];
+			nread++;
+			p = nl + 1;
+		}
+
+		len = buf + len - p;
+		memmove(buf, p, len);
+
+		/* Refill the pipeline with as many as were answered */
+		if (nsent < c->requests) {
+			unsigned long last = nread + c->depth;
+
+			if (last > c->requests)
+				last = c->requests;
+
+			if (sendreqs(c, nsent, last) < 0)
+				goto fail;
+
+			nsent = last;
+		}
+	}
+
+	return NULL;
+
+ fail:
+	fprintf(stderr, "Connection lost after %lu answers\n", nread);
+	c->requests = nread;
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long clients = argc > 2 ? strtoul(argv[2], NULL, 10) : 16;
+	unsigned long requests = argc > 3 ? strtoul(argv[3], NULL, 10) : 20000;
+	unsigned long depth = argc > 4 ? strtoul(argv[4], NULL, 10) : 1;
+	unsigned long total = 0, errors = 0;
+	pthread_barrier_t start;
+	struct client *cs;
+	uint64_t *lat, begin, end;
+	double pct[] = { 50, 90, 99, 99.9 };
+
+	if (argc < 2 || clients == 0 || requests == 0 || depth == 0
+	    || depth > MAX_DEPTH) {
+		fprintf(stderr, "Usage: %s PATH [CLIENTS] [REQUESTS] "
+			"[DEPTH (1 to %d)]\n", argv[0], MAX_DEPTH);
+		return 1;
+	}
+
+	if ((cs = calloc(clients, sizeof(*cs))) == NULL
+	    || (lat = malloc(clients * requests * sizeof(*lat))) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	pthread_barrier_init(&start, NULL, clients + 1);
+
+	for (unsigned long i = 0; i < clients; i++) {
+		struct client *c = &cs[i];
+
+		c->sa.sun_family = AF_UNIX;
+		snprintf(c->sa.sun_path, sizeof(c->sa.sun_path), "%s",
+			 argv[1]);
+		c->start = &start;
+		c->lat = lat + i * requests;
+		c->requests = requests;
+		c->depth = depth;
+		c->seed = i + 1;
+
+		if ((c->exprs = malloc(EXPRS * 32)) == NULL) {
+			perror("malloc");
+			return 1;
+		}
+
+		gen(c);
+
+		if ((c->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+		    || connect(c->fd, (struct sockaddr *)&c->sa,
+			       sizeof(c->sa)) < 0) {
+			perror(argv[1]);
+			return 1;
+		}
+
+		if (pthread_create(&c->thread, NULL, run, c)) {
+			fprintf(stderr, "Unable to start client %lu\n", i);
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&start);
+	begin = now();
+
+	for (unsigned long i = 0; i < clients; i++) {
+		pthread_join(cs[i].thread, NULL);
+		close(cs[i].fd);
+		free(cs[i].exprs);
+
+		/* Gather the latencies of every client */
+		memmove(lat + total, cs[i].lat,
+			cs[i].requests * sizeof(*lat));
+		total += cs[i].requests;
+		errors += cs[i].errors;
+	}
+
+	end = now();
+
+	if (total == 0) {
+		fprintf(stderr, "No request was answered\n");
+		return 1;
+	}
+
+	qsort(lat, total, sizeof(*lat), cmp);
+
+	printf("clients,depth,requests,errors,seconds,requests_per_sec,"
+	       "p50_us,p90_us,p99_us,p999_us,max_us\n");
+	printf("%lu,%lu,%lu,%lu,%.3f,%.0f", clients, depth, total, errors,
+	       (end - begin) / 1e9, total / ((end - begin) / 1e9));
+
+	for (size_t i = 0; i < sizeof(pct) / sizeof(*pct); i++)
+		printf(",%.1f", lat[(size_t)(total * pct[i] / 100)] / 1e3);
+
+	printf(",%.1f\n", lat[total - 1] / 1e3);
+
+	pthread_barrier_destroy(&start);
+	free(lat);
+	free(cs);
+
+	return errors > 0 || total < clients * requests;
+}
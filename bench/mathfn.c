@@ -0,0 +1,172 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/mathfn.c, measures the functions of
+ * mathfn.h: their largest error, in ULPs, against long double
+ * results from libm, and their speed, over arrays, against libm.
+ * The errors it reports are the ones documented in mathfn.h.
+ *
+ * Usage:
+ * make bench_mathfn && ./bench_mathfn [VALUES]
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/mathfn.h"
+
+#define ROUNDS 20		/* Times each array is timed */
+
+/* Function under test */
+struct fn {
+	const char *name;
+	double lo, hi;		/* Range of the inputs */
+	double (*libm)(double);
+	long double (*ref)(long double);
+	void (*batch)(double *, size_t);
+};
+
+static const struct fn fns[] = {
+	{ "sqrt", 0, 1e300, sqrt, sqrtl, vec_sqrt },
+	{ "log", 1e-300, 1e300, log, logl, vec_log },
+	{ "exp", -708, 709, exp, expl, vec_exp },
+	{ "sin", -SINCOS_MAX, SINCOS_MAX, sin, sinl, vec_sin },
+	{ "cos", -SINCOS_MAX, SINCOS_MAX, cos, cosl, vec_cos },
+};
+
+/* Function prototypes */
+static double now(void);
+static double random_in(const struct fn *);
+static double ulps(double, long double);
+static int bench(const struct fn *, size_t);
+
+/* Monotonic time, in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Random input: ranges spanning many powers of 10
+ * are sampled by exponent, the others uniformly */
+static double
+random_in(const struct fn *f)
+{
+	double u = (double)rand() / RAND_MAX;
+
+	if (f->lo >= 0 && f->hi / (f->lo > 0 ? f->lo : 1e-300) > 1e6)
+		return exp(log(f->lo > 0 ? f->lo : 1e-300)
+			   + u * (log(f->hi) - log(f->lo > 0 ? f->lo
+						    : 1e-300)));
+
+	return f->lo + u * (f->hi - f->lo);
+}
+
+/* Distance between got and the exact result, in units
+ * in the last place of the result */
+static double
+ulps(double got, long double exact)
+{
+	int e;
+
+	if (isnan(got) && isnan(exact))
+		return 0;
+	if (got == exact)
+		return 0;
+
+	frexpl(exact, &e);
+
+	/* Subnormals have a fixed ULP */
+	if (e < -1021)
+		e = -1021;
+
+	return fabsl(got - exact) / ldexpl(1, e - 53);
+}
+
+/* Measure a function over n random inputs.
+ * Returns 0, or 1 if it couldn't allocate its arrays. */
+static int
+bench(const struct fn *f, size_t n)
+{
+	double *in = malloc(n * sizeof(*in)), *out = malloc(n * sizeof(*out));
+	double worst = 0, worst_x = 0, err, t0, t1, t2, sum = 0;
+
+	if (in == NULL || out == NULL) {
+		free(in);
+		free(out);
+		return 1;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		in[i] = random_in(f);
+
+	/* Accuracy */
+	memcpy(out, in, n * sizeof(*in));
+	f->batch(out, n);
+	for (size_t i = 0; i < n; i++) {
+		if ((err = ulps(out[i], f->ref(in[i]))) > worst) {
+			worst = err;
+			worst_x = in[i];
+		}
+	}
+
+	/* Speed */
+	t0 = now();
+	for (int r = 0; r < ROUNDS; r++)
+		for (size_t i = 0; i < n; i++)
+			sum += f->libm(in[i]);
+
+	t1 = now();
+	for (int r = 0; r < ROUNDS; r++) {
+		memcpy(out, in, n * sizeof(*in));
+		f->batch(out, n);
+		sum -= out[r % n];
+	}
+	t2 = now();
+
+	printf("%-8s %10.3f %22.17g %10.2f %10.2f %9.1fx\n", f->name, worst,
+	       worst_x, (t1 - t0) * 1e9 / (ROUNDS * n),
+	       (t2 - t1) * 1e9 / (ROUNDS * n), (t1 - t0) / (t2 - t1));
+
+	/* Keep the libm loop from being optimised out */
+	if (sum == 42)
+		putchar('\n');
+
+	free(in);
+	free(out);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	int status = 0;
+
+	if (n == 0) {
+		fprintf(stderr, "Usage: %s [VALUES]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+
+	printf("%-8s %10s %22s %10s %10s %10s\n", "[Func]", "[Max ULP]",
+	       "[Worst input]", "[libm ns]", "[calc ns]", "[Speedup]");
+
+	for (size_t i = 0; i < sizeof(fns) / sizeof(*fns); i++)
+		status |= bench(&fns[i], n);
+
+	return status;
+}
@@ -0,0 +1,184 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/shmlat.c, measures how long "calc -Q NAME"
+ * takes to answer through shared memory (see src/calcshm.h).
+ * It sends REQUESTS requests of each kind, keeping DEPTH of them
+ * in flight (1 waits for every answer before sending the next
+ * request), and prints the latency percentiles as CSV, in
+ * nanoseconds:
+ *
+ * eval		Short expressions, such as "123 * 45 + 6789"
+ * run		"(a * 3 + b) % 7", compiled once, on varying a and b
+ *
+ * ./calc -Q /calc &
+ * ./shmlat /calc 100000 1
+ *
+ * Usage:
+ * make shmlat && ./shmlat NAME [REQUESTS] [DEPTH]
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/calcshm.h"
+#include "corpus.h"
+
+#define EXPRS 1024		/* Expressions sent, over and over */
+
+/* Function prototypes */
+static uint64_t now(void);
+static int cmp(const void *, const void *);
+static bool request(struct calcshm_client *, int, unsigned long, uint32_t);
+static int measure(struct calcshm_client *, int, unsigned long,
+		   unsigned long, uint32_t);
+
+static char exprs[EXPRS][32];
+static uint64_t *lat, *sent;
+
+/* Monotonic time, in nanoseconds */
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Send request i of the given kind; id is the compiled expression */
+static bool
+request(struct calcshm_client *c, int kind, unsigned long i, uint32_t id)
+{
+	uint64_t args[2] = { i, i % 1000 + 1 };
+	const char *e = exprs[i % EXPRS];
+
+	if (kind == CALCSHM_RUN)
+		return calcshm_run(c, id, args, 2);
+
+	return calcshm_eval(c, e, strlen(e));
+}
+
+/* Time requests of the given kind, and print their percentiles.
+ * Returns 0, or 1 if calc stopped answering, or failed. */
+static int
+measure(struct calcshm_client *c, int kind, unsigned long requests,
+	unsigned long depth, uint32_t id)
+{
+	static const double pct[] = { 50, 90, 99, 99.9 };
+	struct calcshm_resp r;
+	unsigned long nsent = 0, nread = 0, errors = 0;
+	uint64_t begin = now(), t;
+
+	while (nread < requests) {
+		/* Keep depth requests in flight */
+		while (nsent < requests && nsent - nread < depth) {
+			sent[nsent % CALCSHM_SLOTS] = now();
+
+			if (!request(c, kind, nsent, id))
+				break;
+
+			nsent++;
+		}
+
+		if (!calcshm_wait(c, &r)) {
+			fprintf(stderr, "calc stopped answering\n");
+			return 1;
+		}
+
+		t = now();
+		lat[nread] = t - sent[nread % CALCSHM_SLOTS];
+		errors += r.status == CALCSHM_ERROR;
+		nread++;
+	}
+
+	t = now() - begin;
+	qsort(lat, requests, sizeof(*lat), cmp);
+
+	printf("%s,%lu,%lu,%lu,%.3f,%.0f", kind == CALCSHM_RUN ? "run"
+	       : "eval", depth, requests, errors, t / 1e9,
+	       requests / (t / 1e9));
+
+	for (size_t i = 0; i < sizeof(pct) / sizeof(*pct); i++)
+		printf(",%" PRIu64, lat[(size_t)(requests * pct[i] / 100)]);
+
+	printf(",%" PRIu64 "\n", lat[requests - 1]);
+	return errors > 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char prog[] = "(a * 3 + b) % 7";
+	unsigned long requests = argc > 2 ? strtoul(argv[2], NULL, 10)
+		: 100000;
+	unsigned long depth = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+	struct calcshm_client c;
+	struct calcshm_resp r = { .status = CALCSHM_BLANK };
+	uint64_t seed = 1;
+	int status;
+
+	if (argc < 2 || requests == 0 || depth == 0
+	    || depth > CALCSHM_SLOTS) {
+		fprintf(stderr, "Usage: %s NAME [REQUESTS] "
+			"[DEPTH (1 to %d)]\n", argv[0], CALCSHM_SLOTS);
+		return 1;
+	}
+
+	if ((lat = malloc(requests * sizeof(*lat))) == NULL
+	    || (sent = malloc(CALCSHM_SLOTS * sizeof(*sent))) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (int i = 0; i < EXPRS; i++) {
+		size_t len = corpus_number(exprs[i], &seed, 4);
+
+		len += sprintf(exprs[i] + len, " * ");
+		len += corpus_number(exprs[i] + len, &seed, 4);
+		len += sprintf(exprs[i] + len, " + ");
+		corpus_number(exprs[i] + len, &seed, 4);
+	}
+
+	if (calcshm_attach(&c, argv[1]) < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if (!calcshm_compile(&c, prog, strlen(prog)) || !calcshm_wait(&c, &r)
+	    || r.status != CALCSHM_ID) {
+		fprintf(stderr, "%s: %s\n", prog, r.status == CALCSHM_ERROR
+			? r.err : "not compiled");
+		return 1;
+	}
+
+	printf("kind,depth,requests,errors,seconds,requests_per_sec,"
+	       "p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+	status = measure(&c, CALCSHM_EVAL, requests, depth, 0);
+	status |= measure(&c, CALCSHM_RUN, requests, depth, r.val);
+
+	calcshm_detach(&c);
+	free(lat);
+	free(sent);
+
+	return status;
+}
@@ -0,0 +1,461 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/stages.c, times each stage calc takes an
+ * expression through: parse() (the lexer), build_ast() (the
+ * parser), solve() (the reference evaluator), and, for RPN,
+ * rpnInit(), on the expressions generated by bench/corpus.h.
+ * On RPN lines that share a shape, it also compares running
+ * them one at a time, with rpn_exec(), to running them in
+ * lanes, with rpn_exec_lanes(), once their numbers are parsed.
+ *
+ * Each stage is timed on its own: the stages before it are run
+ * first, outside of the timer. Every corpus is run through once
+ * to warm up, then ROUNDS more times; allocs and alloc_bytes
+ * are counted over the first run, from an empty arena, and show
+ * what a stage allocates while the arena grows.
+ *
+ * The results are printed as CSV, one line per stage and corpus:
+ * stage,corpus,exprs,tokens,ns_per_token,ns_per_expr,
+ * exprs_per_sec,allocs,alloc_bytes
+ *
+ * Usage:
+ * make bench_stages && ./bench_stages [EXPRESSIONS] [SEED] [KIND]
+ *
+ * KIND is one of deep, flat, numbers, rpn and shaped; by default,
+ * every kind of expression is timed.
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Count the allocations of the code below, while counting is set;
+ * <stdlib.h> has already been included, so it isn't affected */
+static size_t allocs, alloc_bytes;
+static int counting;
+
+static void *
+count_alloc(void *p, size_t size)
+{
+	if (counting && p != NULL) {
+		allocs++;
+		alloc_bytes += size;
+	}
+
+	return p;
+}
+
+#define malloc(n) count_alloc(malloc(n), (n))
+#define calloc(n, m) count_alloc(calloc(n, m), (n) * (m))
+#define realloc(p, n) count_alloc(realloc(p, n), (n))
+
+#include "../src/parse.h"
+#include "../src/vm.h"
+#include "../src/rpn.c"
+#include "corpus.h"
+
+#define ROUNDS 5		/* Timed runs through each corpus */
+
+enum stage {
+	STAGE_PARSE,
+	STAGE_BUILD_AST,
+	STAGE_SOLVE,
+	STAGES,
+};
+
+static const char *const stage_names[STAGES] = {
+	"parse", "build_ast", "solve",
+};
+
+/* Expressions of one kind, one after the other in text */
+struct corpus {
+	char *text;
+	size_t *start;		/* Offset of each expression */
+	size_t *len;		/* Length of each expression */
+	size_t n;
+	enum corpus_kind kind;
+};
+
+/* Function prototypes */
+static double now(void);
+static int corpus_make(struct corpus *, enum corpus_kind, size_t,
+		       uint64_t);
+static void corpus_free(struct corpus *);
+static double run_stage(struct arena *, const struct corpus *,
+			enum stage, int, uint64_t *, uint64_t *);
+static void report(const char *, const struct corpus *, uint64_t,
+		   double, size_t, size_t);
+static int bench_stage(const struct corpus *, enum stage);
+static int bench_rpn(const struct corpus *);
+static int bench_lanes(const struct corpus *);
+
+/* Monotonic time, in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Generate n expressions of the given kind.
+ * Returns 0, or 1 if it couldn't allocate them. */
+static int
+corpus_make(struct corpus *c, enum corpus_kind kind, size_t n,
+	    uint64_t seed)
+{
+	size_t size = CORPUS_LINE_MAX, used = 0;
+	char *p;
+
+	c->kind = kind;
+	c->n = n;
+	c->text = malloc(size);
+	c->start = malloc(n * sizeof(*c->start));
+	c->len = malloc(n * sizeof(*c->len));
+
+	if (c->text == NULL || c->start == NULL || c->len == NULL)
+		return 1;
+
+	for (size_t i = 0; i < n; i++) {
+		/* Keep room for a whole line, and its newline */
+		if (size - used < CORPUS_LINE_MAX + 1) {
+			size *= 2;
+			if ((p = realloc(c->text, size)) == NULL)
+				return 1;
+
+			c->text = p;
+		}
+
+		c->start[i] = used;
+		c->len[i] = corpus_line(c->text + used, size - used, kind,
+					&seed);
+		used += c->len[i];
+		c->text[used++] = '\n';
+	}
+
+	c->text[used] = '\0';
+	return 0;
+}
+
+/* Release the memory held by a corpus */
+static void
+corpus_free(struct corpus *c)
+{
+	free(c->text);
+	free(c->start);
+	free(c->len);
+}
+
+/* Run every expression of the corpus up to the given stage,
+ * timing only that stage, and, if count is set, counting its
+ * allocations. Adds the number of tokens to *tokens, and the
+ * results to *sum. Returns the time taken, in seconds, or -1
+ * if an expression failed. */
+static double
+run_stage(struct arena *a, const struct corpus *c, enum stage stage,
+	  int count, uint64_t *tokens, uint64_t *sum)
+{
+	double t = 0, t0;
+	uint32_t root = NO_NODE;
+	const char *s;
+	bool ok;
+
+	for (size_t i = 0; i < c->n; i++) {
+		s = c->text + c->start[i];
+
+		counting = count && stage == STAGE_PARSE;
+		t0 = now();
+		ok = parse(a, s, c->len[i]);
+		if (stage == STAGE_PARSE) {
+			t += now() - t0;
+			counting = 0;
+			*tokens += a->len;
+			if (!ok)
+				return -1;
+			continue;
+		}
+
+		if (!ok)
+			return -1;
+
+		counting = count && stage == STAGE_BUILD_AST;
+		t0 = now();
+		root = build_ast(a);
+		if (stage == STAGE_BUILD_AST) {
+			t += now() - t0;
+			counting = 0;
+			*tokens += a->len;
+			if (root == NO_NODE)
+				return -1;
+			continue;
+		}
+
+		if (root == NO_NODE)
+			return -1;
+
+		/* parse() may leave an error behind, and carry on */
+		a->err[0] = '\0';
+
+		counting = count;
+		t0 = now();
+		*sum += solve(a, root);
+		t += now() - t0;
+		counting = 0;
+		*tokens += a->len;
+		if (a->err[0])
+			return -1;
+	}
+
+	return t;
+}
+
+/* Print a line of results */
+static void
+report(const char *stage, const struct corpus *c, uint64_t tokens,
+       double t, size_t nallocs, size_t nbytes)
+{
+	printf("%s,%s,%zu,%llu,%.3f,%.1f,%.0f,%zu,%zu\n", stage,
+	       corpus_names[c->kind], c->n, (unsigned long long)tokens,
+	       t * 1e9 / (tokens * ROUNDS), t * 1e9 / (c->n * ROUNDS),
+	       c->n * ROUNDS / t, nallocs, nbytes);
+}
+
+/* Time a stage on a corpus.
+ * Returns 0, or 1 if an expression failed. */
+static int
+bench_stage(const struct corpus *c, enum stage stage)
+{
+	struct arena a = { 0 };
+	uint64_t tokens = 0, sum = 0;
+	double t = 0, r;
+	size_t nallocs, nbytes;
+
+	/* Warm up, from an empty arena */
+	allocs = alloc_bytes = 0;
+	r = run_stage(&a, c, stage, 1, &tokens, &sum);
+	nallocs = allocs;
+	nbytes = alloc_bytes;
+
+	for (int i = 0; i < ROUNDS && r >= 0; i++) {
+		tokens = 0;
+		t += r = run_stage(&a, c, stage, 0, &tokens, &sum);
+	}
+
+	if (r < 0) {
+		fprintf(stderr, "%s: %s\n", corpus_names[c->kind], a.err);
+		arena_free(&a);
+		return 1;
+	}
+
+	report(stage_names[stage], c, tokens, t, nallocs, nbytes);
+
+	/* Keep solve() from being optimised out */
+	if (sum == 42)
+		fputs("", stderr);
+
+	arena_free(&a);
+	return 0;
+}
+
+/* Time rpnInit() on a corpus, by making it stdin, and
+ * sending what rpnInit() prints to /dev/null.
+ * Returns 0, or 1 if the files couldn't be set up. */
+static int
+bench_rpn(const struct corpus *c)
+{
+	uint64_t tokens = 0;
+	size_t size = strlen(c->text);
+	double t = 0, t0;
+	size_t nallocs, nbytes;
+	FILE *in = tmpfile();
+	int null = open("/dev/null", O_WRONLY), out = dup(STDOUT_FILENO);
+
+	for (size_t i = 0; i < size; i++)
+		tokens += c->text[i] != ' ' && c->text[i] != '\n'
+			  && (i == 0 || c->text[i - 1] == ' '
+			      || c->text[i - 1] == '\n');
+
+	if (in == NULL || null < 0 || out < 0
+	    || fwrite(c->text, 1, size, in) != size || fflush(in) != 0
+	    || dup2(fileno(in), STDIN_FILENO) < 0) {
+		perror("rpn");
+		return 1;
+	}
+
+	fflush(stdout);
+	dup2(null, STDOUT_FILENO);
+
+	/* The first run warms up, and counts the allocations */
+	allocs = alloc_bytes = 0;
+	for (int i = 0; i <= ROUNDS; i++) {
+		rewind(stdin);
+		clearerr(stdin);
+
+		counting = i == 0;
+		t0 = now();
+		rpnInit();
+		fflush(stdout);
+		counting = 0;
+		if (i > 0)
+			t += now() - t0;
+	}
+
+	nallocs = allocs;
+	nbytes = alloc_bytes;
+
+	dup2(out, STDOUT_FILENO);
+	close(out);
+	close(null);
+	fclose(in);
+
+	report("rpnInit", c, tokens, t, nallocs, nbytes);
+	return 0;
+}
+
+/* Time running the shape of a shaped corpus over its numbers,
+ * parsed beforehand: one line at a time with rpn_exec(), then
+ * RPN_LANES lines at a time with rpn_exec_lanes().
+ * Returns 0, or 1 if the lines couldn't be loaded. */
+static int
+bench_lanes(const struct corpus *c)
+{
+	struct rpn r = { 0 };
+	struct rpn_prog *p = &r.lanes;
+	struct corpus used = *c;
+	double *vals = NULL, *lanes = NULL, *own, result, sum = 0;
+	double t[2] = { 0 }, t0;
+	uint8_t bad[RPN_LANES];
+	size_t slots, group;
+	int status = 1;
+
+	/* Two lines of the same shape make rpnInit() use lanes */
+	for (int i = 0; i < 2; i++) {
+		if (!rpn_line(&r, c->text + c->start[i], c->len[i], &result))
+			goto out;
+
+		r.inlanes = rpn_repeat(&r, c->text + c->start[i], c->len[i]);
+	}
+
+	used.n = c->n / RPN_LANES * RPN_LANES;
+	own = p->in;
+	slots = p->slots;
+	vals = malloc(used.n * slots * sizeof(*vals));
+	lanes = malloc(used.n * slots * sizeof(*lanes));
+
+	if (!r.inlanes || used.n == 0 || vals == NULL || lanes == NULL)
+		goto out;
+
+	/* Load every line into its lane, and copy it line by line */
+	for (size_t i = 0; i < used.n; i++) {
+		group = i / RPN_LANES * RPN_LANES * slots;
+		p->in = lanes + group;
+		r.nlanes = i % RPN_LANES;
+
+		if (!rpn_lane(&r, c->text + c->start[i], c->len[i])) {
+			p->in = own;
+			goto out;
+		}
+
+		for (size_t j = 0; j < slots; j++)
+			vals[i * slots + j] = lanes[group + j * RPN_LANES
+						    + r.nlanes];
+	}
+
+	p->in = own;
+
+	for (int round = 0; round <= ROUNDS; round++) {
+		t0 = now();
+		for (size_t i = 0; i < used.n; i++) {
+			p->in = vals + i * slots;
+			if (rpn_exec(p, &result))
+				sum += result;
+		}
+		if (round > 0)
+			t[0] += now() - t0;
+
+		t0 = now();
+		for (size_t i = 0; i < used.n; i += RPN_LANES) {
+			memset(bad, 0, sizeof(bad));
+			rpn_exec_lanes(p->code, lanes + i * slots, p->stack,
+				       r.res, bad);
+			for (int j = 0; j < RPN_LANES; j++)
+				sum += r.res[j];
+		}
+		if (round > 0)
+			t[1] += now() - t0;
+	}
+
+	p->in = own;
+	report("rpn_exec", &used, used.n * r.shapelen, t[0], 0, 0);
+	report("rpn_exec_lanes", &used, used.n * r.shapelen, t[1], 0, 0);
+
+	/* Keep the results from being optimised out */
+	if (sum == 42)
+		fputs("", stderr);
+
+	status = 0;
+
+ out:
+	if (status)
+		fprintf(stderr, "%s: the lines don't share a shape\n",
+			corpus_names[c->kind]);
+
+	free(vals);
+	free(lanes);
+	rpn_free(&r);
+	return status;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+	uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+	int only = argc > 3 ? corpus_kind(argv[3]) : CORPUS_KINDS;
+	struct corpus c;
+	int status = 0;
+
+	if (n == 0 || seed == 0 || only < 0) {
+		fprintf(stderr, "Usage: %s [EXPRESSIONS] [SEED] "
+			"[deep|flat|numbers|rpn|shaped]\n", argv[0]);
+		return 1;
+	}
+
+	printf("stage,corpus,exprs,tokens,ns_per_token,ns_per_expr,"
+	       "exprs_per_sec,allocs,alloc_bytes\n");
+
+	for (int kind = 0; kind < CORPUS_KINDS; kind++) {
+		if (only != CORPUS_KINDS && kind != only)
+			continue;
+
+		if (corpus_make(&c, kind, n, seed)) {
+			fprintf(stderr, "Out of memory!\n");
+			corpus_free(&c);
+			return 1;
+		}
+
+		if (kind == CORPUS_RPN || kind == CORPUS_SHAPED)
+			status |= bench_rpn(&c);
+		else
+			for (int stage = 0; stage < STAGES; stage++)
+				status |= bench_stage(&c, stage);
+
+		if (kind == CORPUS_SHAPED)
+			status |= bench_lanes(&c);
+
+		corpus_free(&c);
+	}
+
+	return status;
+}
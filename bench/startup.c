@@ -0,0 +1,116 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, bench/startup.c, measures how long a command takes
+ * to start, answer and exit, such as "calc -e EXPR": it is run RUNS
+ * times in a row, with stdin and stdout on /dev/null, and the time
+ * from spawning it to reaping it is the time of a run. The mean and
+ * percentiles of every run are printed as CSV, in microseconds.
+ *
+ * Without a command, "./calc -e '1 << 40'" is run.
+ * To tell calc's own time apart from the system's, compare it with
+ * a program that does nothing, such as /bin/true:
+ *
+ * ./startup 2000
+ * ./startup 2000 /bin/true
+ *
+ * Usage:
+ * make startup && ./startup [RUNS] [COMMAND [ARGS...]]
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/* Function prototypes */
+static uint64_t now(void);
+static int cmp(const void *, const void *);
+
+/* Monotonic time, in nanoseconds */
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int
+main(int argc, char **argv)
+{
+	static char *def[] = { "./calc", "-e", "1 << 40", NULL };
+	unsigned long runs = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+	char **cmd = argc > 2 ? argv + 2 : def;
+	double pct[] = { 50, 90, 99 };
+	posix_spawn_file_actions_t fa;
+	uint64_t *lat, t0, sum = 0;
+	int st;
+	pid_t pid;
+
+	if (runs == 0) {
+		fprintf(stderr, "Usage: %s [RUNS] [COMMAND [ARGS...]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	if ((lat = malloc(runs * sizeof(*lat))) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+
+	for (unsigned long i = 0; i < runs; i++) {
+		t0 = now();
+
+		if (posix_spawn(&pid, cmd[0], &fa, NULL, cmd, environ) != 0) {
+			fprintf(stderr, "Unable to run %s\n", cmd[0]);
+			return 1;
+		}
+
+		if (waitpid(pid, &st, 0) < 0 || !WIFEXITED(st)
+		    || WEXITSTATUS(st) != 0) {
+			fprintf(stderr, "%s failed\n", cmd[0]);
+			return 1;
+		}
+
+		lat[i] = now() - t0;
+		sum += lat[i];
+	}
+
+	posix_spawn_file_actions_destroy(&fa);
+	qsort(lat, runs, sizeof(*lat), cmp);
+
+	printf("command,runs,mean_us,p50_us,p90_us,p99_us,max_us\n");
+	printf("%s,%lu,%.1f", cmd[0], runs, sum / 1e3 / runs);
+
+	for (size_t i = 0; i < sizeof(pct) / sizeof(*pct); i++)
+		printf(",%.1f", lat[(size_t)(runs * pct[i] / 100)] / 1e3);
+
+	printf(",%.1f\n", lat[runs - 1] / 1e3);
+
+	free(lat);
+	return 0;
+}
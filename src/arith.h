@@ -0,0 +1,151 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, arith.h, implements the integer operations that
+ * can fail other than by dividing by zero: exact powers, by
+ * squaring, which report overflow instead of going through
+ * doubles, factorials, and modular exponentiation on 64-bit
+ * operands.
+ * Every evaluator (solve(), run(), the CSV kernels and the JIT)
+ * uses these, so they all agree on results and errors.
+ *
+ * Usage:
+ * if ((status = ipow(base, exp, &result)) != ARITH_OK)
+ * 	fprintf(stderr, "%s\n", arith_error(status));
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Outcome of an operation */
+enum {
+	ARITH_OK,
+	ARITH_DIV_ZERO,		/* Division by zero */
+	ARITH_OVERFLOW,		/* Result doesn't fit in 64 bits */
+	ARITH_NEGATIVE,		/* Factorial of a negative number */
+	ARITH_NO_INVERSE,	/* Negative power of a non-invertible number */
+	ARITH_TOO_LARGE,	/* Result too large even for bignum.h */
+	ARITH_LAST = ARITH_TOO_LARGE
+};
+
+/* Function prototypes */
+static inline const char *arith_error(int);
+static inline int ipow(uint64_t, uint64_t, uint64_t *);
+static inline int ifact(uint64_t, uint64_t *);
+static inline uint64_t mulmod(uint64_t, uint64_t, uint64_t);
+static inline int powmod(uint64_t, uint64_t, uint64_t, uint64_t *);
+
+/* Get the error message of an outcome */
+static inline const char *
+arith_error(int status)
+{
+	switch (status) {
+	case ARITH_DIV_ZERO:
+		return "Error: division by zero!";
+
+	case ARITH_OVERFLOW:
+		return "Error: result doesn't fit in 64 bits!";
+
+	case ARITH_NEGATIVE:
+		return "Error: factorial of a negative number!";
+
+	case ARITH_NO_INVERSE:
+		return "Error: no modular inverse!";
+
+	case ARITH_TOO_LARGE:
+		return "Error: result too large!";
+
+	default:
+		return "Error: unknown error!";
+	}
+}
+
+/* Raise base to the power of exp, by squaring.
+ * Both are unsigned, as calc prints them, so the result
+ * must fit in 64 bits. */
+static inline int
+ipow(uint64_t base, uint64_t exp, uint64_t *result)
+{
+	uint64_t r = 1;
+
+	while (exp != 0) {
+		if ((exp & 1) && __builtin_mul_overflow(r, base, &r))
+			return ARITH_OVERFLOW;
+
+		/* Only square if a higher bit is going to need it */
+		if ((exp >>= 1) != 0
+		    && __builtin_mul_overflow(base, base, &base))
+			return ARITH_OVERFLOW;
+	}
+
+	*result = r;
+	return ARITH_OK;
+}
+
+/* n!, which only fits in 64 bits up to 20! */
+static inline int
+ifact(uint64_t n, uint64_t *result)
+{
+	uint64_t r = 1;
+
+	if (n > 20)
+		return ARITH_OVERFLOW;
+
+	while (n > 1)
+		r *= n--;
+
+	*result = r;
+	return ARITH_OK;
+}
+
+/* (a * b) % m, without overflowing */
+static inline uint64_t
+mulmod(uint64_t a, uint64_t b, uint64_t m)
+{
+#ifdef __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 uint128_t;
+
+	return (uint128_t)a * b % m;
+#else
+	uint64_t r = 0;
+
+	/* Double and add, reducing at every step */
+	for (a %= m; b != 0; b >>= 1) {
+		if (b & 1)
+			r = r >= m - a ? r - (m - a) : r + a;
+		a = a >= m - a ? a - (m - a) : a + a;
+	}
+
+	return r;
+#endif
+}
+
+/* (base ^ exp) % mod, with every operand taken as unsigned,
+ * so full 64-bit exponents and moduli can be used */
+static inline int
+powmod(uint64_t base, uint64_t exp, uint64_t mod, uint64_t *result)
+{
+	uint64_t r;
+
+	if (mod == 0)
+		return ARITH_DIV_ZERO;
+
+	r = 1 % mod;
+	base %= mod;
+
+	for (; exp != 0; exp >>= 1) {
+		if (exp & 1)
+			r = mulmod(r, base, mod);
+		base = mulmod(base, base, mod);
+	}
+
+	*result = r;
+	return ARITH_OK;
+}
+
+#endif
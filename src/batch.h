@@ -0,0 +1,765 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, batch.h, evaluates a stream of expressions,
+ * one per line, without going through readline: input is read
+ * in large blocks, and results are written out a block at a time.
+ *
+ * Each block is split at line boundaries into one chunk per job,
+ * and every chunk is evaluated by its own thread, with its own
+ * evaluator. Results are written out in the original line order.
+ * While a block is being evaluated, the next one is read, and the
+ * results of the previous one are written.
+ *
+ * Regular files are mapped in memory instead of being read, and
+ * their lines are evaluated straight from the mapping.
+ *
+ * Blank lines are skipped. Lines that can't be evaluated are
+ * reported on stderr, along with their line number. Results are
+ * written the way out_fmt says (see format.h).
+ *
+ * Expressions can also be given as strings, as "calc -e" does,
+ * and are then evaluated one after the other, by the calling thread.
+ *
+ * Usage:
+ * int status = batch(&ev, STDIN_FILENO, STDOUT_FILENO, jobs);
+ * int status = batch_file(&ev, "exprs.txt", STDOUT_FILENO, jobs);
+ * int status = batch_args(&ev, exprs, nexprs, STDOUT_FILENO);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "eval.h"
+#include "format.h"
+
+#define BATCH_BUFSIZE (1 << 20)	/* Bytes of input per job and block */
+#define MAX_JOBS 256		/* Maximum number of threads */
+
+/* Growable buffer */
+struct outbuf {
+	char *buf;
+	size_t len;		/* Bytes in use */
+	size_t cap;		/* Bytes allocated */
+};
+
+/* Line that couldn't be evaluated */
+struct batch_error {
+	uint64_t line;		/* Line number, within its chunk */
+	char msg[ERR_SIZE];
+};
+
+/* Range of lines evaluated by one thread, and what came out of them */
+struct chunk {
+	const char *buf;	/* Lines to evaluate */
+	size_t len;
+	struct outbuf out;	/* Results */
+	struct batch_error *errs;	/* Lines that failed */
+	size_t nerrs;
+	size_t errcap;
+	uint64_t lines;		/* Lines evaluated */
+	bool nomem;		/* Ran out of memory? */
+};
+
+/* Worker thread */
+struct worker {
+	struct pool *pool;
+	struct evaluator *ev;	/* Evaluator used by this thread only */
+	unsigned int id;	/* Index of the chunk to evaluate */
+	pthread_t thread;
+};
+
+/* Thread pool */
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start;	/* Signalled when a block is dispatched */
+	pthread_cond_t done;	/* Signalled when a block is evaluated */
+	unsigned long gen;	/* Bumped for every block */
+	unsigned int pending;	/* Workers still evaluating */
+	unsigned int jobs;	/* Number of workers */
+	bool quit;		/* Tell workers to exit */
+	struct chunk *chunks;	/* Chunks of the current block */
+	struct worker *workers;
+};
+
+/* Batch state */
+struct batch_state {
+	struct pool pool;
+	struct chunk *chunks[2];	/* Chunks of the last two blocks */
+	struct evaluator *ev;	/* Caller's evaluator, used by worker 0 */
+	struct evaluator *evs;	/* Evaluators of workers 1 to jobs - 1 */
+	const char *name;	/* Name of the input in errors, or NULL */
+	uint64_t lineno;	/* Lines written out so far */
+	unsigned int cur;	/* Chunks to use for the next block */
+	unsigned int started;	/* Threads started */
+	int out;		/* Where to write results */
+	bool busy;		/* Is a block being evaluated? */
+	bool unflushed;		/* Is a block waiting to be written? */
+	bool failed;		/* Couldn't some line be evaluated? */
+};
+
+/* How results are written out; only set before any of them is */
+static enum out_format out_fmt = FMT_DEC;
+
+/* Function prototypes */
+static inline bool write_all(int, const char *, size_t);
+static inline bool out_reserve(struct outbuf *, size_t);
+static inline bool out_result(struct outbuf *, uint64_t);
+static inline bool out_double(struct outbuf *, uint64_t);
+static inline bool out_big(struct outbuf *, const struct bignum *);
+static inline void chunk_error(struct chunk *, uint64_t, const char *);
+static inline void chunk_eval(struct evaluator *, struct chunk *);
+static inline void *worker_main(void *);
+static inline void pool_dispatch(struct pool *, struct chunk *, const char *,
+				 size_t);
+static inline void pool_wait(struct pool *);
+static inline bool chunks_flush(struct batch_state *, struct chunk *);
+static inline bool batch_start(struct batch_state *, struct evaluator *,
+			       unsigned int, int);
+static inline bool batch_block(struct batch_state *, const char *, size_t);
+static inline int batch_finish(struct batch_state *);
+static inline bool fill(int, struct outbuf *, bool *);
+int batch(struct evaluator *, int, int, unsigned int);
+int batch_file(struct evaluator *, const char *, int, unsigned int);
+int batch_args(struct evaluator *, char *const *, unsigned int, int);
+
+/* Write the whole buffer, retrying after short writes */
+static inline bool
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+/* Make sure n more bytes fit in the buffer */
+static inline bool
+out_reserve(struct outbuf *out, size_t n)
+{
+	size_t cap = out->cap ? out->cap : BATCH_BUFSIZE;
+	char *p;
+
+	if (out->cap - out->len >= n)
+		return true;
+
+	while (cap - out->len < n)
+		cap *= 2;
+
+	if ((p = realloc(out->buf, cap)) == NULL)
+		return false;
+
+	out->buf = p;
+	out->cap = cap;
+	return true;
+}
+
+/* Append a result, and a newline, to the output buffer */
+static inline bool
+out_result(struct outbuf *out, uint64_t result)
+{
+	if (!out_reserve(out, FMT_MAX + 1))
+		return false;
+
+	out->len += fmt_int(out->buf + out->len, result, out_fmt);
+
+	/* Raw results are 8 bytes each, and nothing else */
+	if (out_fmt != FMT_RAW)
+		out->buf[out->len++] = '\n';
+	return true;
+}
+
+/* Append a result given as the bits of a double, and a newline */
+static inline bool
+out_double(struct outbuf *out, uint64_t bits)
+{
+	double d;
+
+	if (!out_reserve(out, FMT_MAX + 1))
+		return false;
+
+	if (out_fmt == FMT_RAW) {
+		out->len += fmt_le64(out->buf + out->len, bits);
+		return true;
+	}
+
+	memcpy(&d, &bits, sizeof(d));
+	out->len += fmt_double(out->buf + out->len, d);
+	out->buf[out->len++] = '\n';
+	return true;
+}
+
+/* Append an exact result, and a newline */
+static inline bool
+out_big(struct outbuf *out, const struct bignum *bn)
+{
+	/* The NUL written by big_str() leaves room for the newline */
+	if (!out_reserve(out, big_size(bn)))
+		return false;
+
+	out->len += big_str(bn, out->buf + out->len);
+	out->buf[out->len++] = '\n';
+	return true;
+}
+
+/* Remember that a line of a chunk couldn't be evaluated */
+static inline void
+chunk_error(struct chunk *c, uint64_t line, const char *msg)
+{
+	if (c->nerrs == c->errcap) {
+		size_t cap = c->errcap ? c->errcap * 2 : 16;
+		struct batch_error *p = realloc(c->errs, cap * sizeof(*p));
+
+		if (p == NULL) {
+			c->nomem = true;
+			return;
+		}
+
+		c->errs = p;
+		c->errcap = cap;
+	}
+
+	c->errs[c->nerrs].line = line;
+	snprintf(c->errs[c->nerrs].msg, ERR_SIZE, "%s", msg);
+	c->nerrs++;
+}
+
+/* Evaluate every line of a chunk; the last one doesn't need a newline */
+static inline void
+chunk_eval(struct evaluator *ev, struct chunk *c)
+{
+	const char *line = c->buf, *end = c->buf + c->len, *nl;
+	size_t n;
+	uint64_t result;
+
+	c->out.len = 0;
+	c->nerrs = 0;
+	c->lines = 0;
+	c->nomem = false;
+
+	while (line < end) {
+		if ((nl = memchr(line, '\n', end - line)) == NULL)
+			nl = end;
+
+		n = nl - line;
+		c->lines++;
+
+		/* Accept DOS line endings */
+		if (n > 0 && line[n - 1] == '\r')
+			n--;
+
+		if (ev->exact) {
+			if (evaluate_big(ev, line, n)) {
+				if (!out_big(&c->out, &ev->big)) {
+					c->nomem = true;
+					return;
+				}
+			} else if (ev->err != NULL)
+				chunk_error(c, c->lines, ev->err);
+
+			line = nl + 1;
+			continue;
+		}
+
+		if (evaluate(ev, line, n, &result)) {
+			if (!(ev->floating ? out_double(&c->out, result)
+			      : out_result(&c->out, result))) {
+				c->nomem = true;
+				return;
+			}
+		} else if (ev->err != NULL)
+			chunk_error(c, c->lines, ev->err);
+
+		line = nl + 1;
+	}
+}
+
+/* Worker thread: evaluate our chunk of every block */
+static inline void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct pool *pool = w->pool;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (pool->gen == seen && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->quit)
+			break;
+
+		seen = pool->gen;
+		pthread_mutex_unlock(&pool->lock);
+
+		chunk_eval(w->ev, &pool->chunks[w->id]);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0)
+			pthread_cond_signal(&pool->done);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* Split buf[0..len) into one chunk per job, at line boundaries,
+ * and start evaluating them */
+static inline void
+pool_dispatch(struct pool *pool, struct chunk *chunks, const char *buf,
+	      size_t len)
+{
+	size_t start = 0, end;
+	const char *nl;
+
+	for (unsigned int i = 0; i < pool->jobs; i++) {
+		if (i == pool->jobs - 1)
+			end = len;
+		else if ((end = len / pool->jobs * (i + 1)) <= start)
+			end = start;
+		else if ((nl = memchr(buf + end, '\n', len - end)) != NULL)
+			end = nl - buf + 1;
+		else
+			end = len;
+
+		chunks[i].buf = buf + start;
+		chunks[i].len = end - start;
+		start = end;
+	}
+
+	/* With a single job, there's nothing to wait for */
+	if (pool->jobs == 1) {
+		chunk_eval(pool->workers[0].ev, &chunks[0]);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->chunks = chunks;
+	pool->pending = pool->jobs;
+	pool->gen++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Wait until the last dispatched block has been evaluated */
+static inline void
+pool_wait(struct pool *pool)
+{
+	if (pool->jobs == 1)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Write out the results and errors of a block, in order.
+ * Returns false if the results couldn't be written out. */
+static inline bool
+chunks_flush(struct batch_state *b, struct chunk *chunks)
+{
+	for (unsigned int i = 0; i < b->pool.jobs; i++) {
+		struct chunk *c = &chunks[i];
+
+		if (!write_all(b->out, c->out.buf, c->out.len)) {
+			perror("write");
+			return false;
+		}
+
+		for (size_t e = 0; e < c->nerrs; e++) {
+			if (b->name != NULL)
+				fprintf(stderr, "%s:%" PRIu64 ": %s\n", b->name,
+					b->lineno + c->errs[e].line,
+					c->errs[e].msg);
+			else
+				fprintf(stderr, "line %" PRIu64 ": %s\n",
+					b->lineno + c->errs[e].line,
+					c->errs[e].msg);
+		}
+
+		if (c->nomem) {
+			fprintf(stderr, "Error: unable to allocate "
+				"enough memory!\n");
+			return false;
+		}
+
+		if (c->nerrs > 0)
+			b->failed = true;
+
+		b->lineno += c->lines;
+	}
+
+	return true;
+}
+
+/* Set up the buffers and threads needed to evaluate a stream */
+static inline bool
+batch_start(struct batch_state *b, struct evaluator *ev, unsigned int jobs,
+	    int out)
+{
+	memset(b, 0, sizeof(*b));
+	b->pool.jobs = jobs;
+	b->ev = ev;
+	b->out = out;
+
+	pthread_mutex_init(&b->pool.lock, NULL);
+	pthread_cond_init(&b->pool.start, NULL);
+	pthread_cond_init(&b->pool.done, NULL);
+
+	b->chunks[0] = calloc(jobs, sizeof(struct chunk));
+	b->chunks[1] = calloc(jobs, sizeof(struct chunk));
+	b->pool.workers = calloc(jobs, sizeof(struct worker));
+
+	/* The first worker uses the caller's evaluator */
+	if (jobs > 1)
+		b->evs = calloc(jobs - 1, sizeof(struct evaluator));
+
+	if (b->chunks[0] == NULL || b->chunks[1] == NULL
+	    || b->pool.workers == NULL || (jobs > 1 && b->evs == NULL)) {
+		fprintf(stderr, "Error: unable to allocate enough memory!\n");
+		return false;
+	}
+
+	for (unsigned int i = 0; i < jobs; i++) {
+		struct worker *w = &b->pool.workers[i];
+
+		w->pool = &b->pool;
+		w->id = i;
+		w->ev = i == 0 ? ev : &b->evs[i - 1];
+		w->ev->usecache = ev->usecache;
+		w->ev->exact = ev->exact;
+		w->ev->usestats = ev->usestats;
+
+		if (jobs > 1) {
+			if (pthread_create(&w->thread, NULL, worker_main, w)) {
+				perror("pthread_create");
+				return false;
+			}
+			b->started++;
+		}
+	}
+
+	return true;
+}
+
+/* Start evaluating buf[0..len), which must only contain complete
+ * lines (except at the end of the input), and write out the results
+ * of the previous block meanwhile. buf must stay valid until the
+ * next call to batch_block() or batch_finish().
+ * Returns false if the results couldn't be written out. */
+static inline bool
+batch_block(struct batch_state *b, const char *buf, size_t len)
+{
+	if (b->busy)
+		pool_wait(&b->pool);
+
+	pool_dispatch(&b->pool, b->chunks[b->cur], buf, len);
+	b->busy = true;
+	b->cur = !b->cur;
+
+	if (b->unflushed && !chunks_flush(b, b->chunks[b->cur])) {
+		b->unflushed = false;
+		b->failed = true;
+		return false;
+	}
+
+	b->unflushed = true;
+	return true;
+}
+
+/* Write out the last block, then stop the threads and free everything.
+ * Returns 0 if every line was evaluated, 1 otherwise. */
+static inline int
+batch_finish(struct batch_state *b)
+{
+	if (b->busy)
+		pool_wait(&b->pool);
+
+	if (b->unflushed && !chunks_flush(b, b->chunks[!b->cur]))
+		b->failed = true;
+
+	if (b->started > 0) {
+		pthread_mutex_lock(&b->pool.lock);
+		b->pool.quit = true;
+		pthread_cond_broadcast(&b->pool.start);
+		pthread_mutex_unlock(&b->pool.lock);
+
+		for (unsigned int i = 0; i < b->started; i++)
+			pthread_join(b->pool.workers[i].thread, NULL);
+	}
+
+	pthread_mutex_destroy(&b->pool.lock);
+	pthread_cond_destroy(&b->pool.start);
+	pthread_cond_destroy(&b->pool.done);
+
+	/* The caller's evaluator counts what every thread did */
+	for (unsigned int i = 0; b->evs != NULL && i < b->pool.jobs - 1; i++) {
+		stats_add(&b->ev->total, &b->evs[i].total);
+		evaluator_free(&b->evs[i]);
+	}
+
+	for (unsigned int i = 0; i < b->pool.jobs; i++) {
+		for (unsigned int k = 0; k < 2; k++) {
+			if (b->chunks[k] != NULL) {
+				free(b->chunks[k][i].out.buf);
+				free(b->chunks[k][i].errs);
+			}
+		}
+	}
+
+	free(b->evs);
+	free(b->chunks[0]);
+	free(b->chunks[1]);
+	free(b->pool.workers);
+
+	return b->failed ? 1 : 0;
+}
+
+/* Read from fd until the buffer is full, or until EOF */
+static inline bool
+fill(int fd, struct outbuf *in, bool *eof)
+{
+	ssize_t n;
+
+	while (in->len < in->cap) {
+		if ((n = read(fd, in->buf + in->len, in->cap - in->len)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("read");
+			return false;
+		}
+
+		if (n == 0) {
+			*eof = true;
+			break;
+		}
+
+		in->len += n;
+	}
+
+	return true;
+}
+
+/* Evaluate every line read from in, writing results to out,
+ * using the given number of threads.
+ * Returns 0 if every line was evaluated, 1 otherwise. */
+int
+batch(struct evaluator *ev, int in, int out, unsigned int jobs)
+{
+	struct batch_state b;
+	struct outbuf ib[2] = { { 0 }, { 0 } };
+	size_t done, rest;
+	const char *last;
+	unsigned int cur = 0;
+	bool eof = false;
+
+	if (!batch_start(&b, ev, jobs, out)
+	    || !out_reserve(&ib[0], (size_t)BATCH_BUFSIZE * jobs)
+	    || !out_reserve(&ib[1], (size_t)BATCH_BUFSIZE * jobs)) {
+		b.failed = true;
+		goto out;
+	}
+
+	if (!fill(in, &ib[cur], &eof)) {
+		b.failed = true;
+		goto out;
+	}
+
+	for (;;) {
+		/* Only evaluate complete lines, unless we're done */
+		if (eof)
+			done = ib[cur].len;
+		else if ((last = memrchr(ib[cur].buf, '\n', ib[cur].len)))
+			done = last - ib[cur].buf + 1;
+		else {
+			/* A single line doesn't fit: make room for it */
+			if (!out_reserve(&ib[cur], ib[cur].cap)
+			    || !fill(in, &ib[cur], &eof)) {
+				fprintf(stderr, "line %" PRIu64 ": "
+					"unable to read line\n",
+					b.lineno + 1);
+				b.failed = true;
+				break;
+			}
+			continue;
+		}
+
+		if (!batch_block(&b, ib[cur].buf, done) || eof)
+			break;
+
+		/* Carry the incomplete last line over to the next block,
+		 * and read the rest of it while this one is evaluated */
+		rest = ib[cur].len - done;
+		ib[!cur].len = 0;
+
+		if (!out_reserve(&ib[!cur], rest)) {
+			fprintf(stderr, "Error: unable to allocate "
+				"enough memory!\n");
+			b.failed = true;
+			break;
+		}
+
+		memcpy(ib[!cur].buf, ib[cur].buf + done, rest);
+		ib[!cur].len = rest;
+
+		if (!fill(in, &ib[!cur], &eof)) {
+			b.failed = true;
+			break;
+		}
+
+		cur = !cur;
+	}
+
+ out:
+	/* Wait for the threads before freeing what they're reading */
+	jobs = batch_finish(&b);
+
+	free(ib[0].buf);
+	free(ib[1].buf);
+
+	return jobs;
+}
+
+/* Evaluate every line of a file, writing results to out,
+ * using the given number of threads. The file is mapped in
+ * memory, and lines are evaluated straight from the mapping.
+ * Returns 0 if every line was evaluated, 1 otherwise. */
+int
+batch_file(struct evaluator *ev, const char *path, int out,
+	   unsigned int jobs)
+{
+	struct batch_state b;
+	struct stat st;
+	const char *map, *nl;
+	size_t off = 0, end, block = (size_t)BATCH_BUFSIZE * jobs;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+
+	/* Pipes and other special files can't be mapped */
+	if (!S_ISREG(st.st_mode)) {
+		int status = batch(ev, fd, out, jobs);
+
+		close(fd);
+		return status;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		perror(path);
+		return 1;
+	}
+
+	posix_madvise((void *)map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+	if (batch_start(&b, ev, jobs, out)) {
+		b.name = path;
+
+		/* Split the mapping into blocks at line boundaries */
+		while (off < (size_t)st.st_size) {
+			end = off + block;
+
+			if (end >= (size_t)st.st_size)
+				end = st.st_size;
+			else if ((nl = memchr(map + end, '\n',
+					      st.st_size - end)) != NULL)
+				end = nl - map + 1;
+			else
+				end = st.st_size;
+
+			if (!batch_block(&b, map + off, end - off))
+				break;
+
+			off = end;
+		}
+	} else
+		b.failed = true;
+
+	jobs = batch_finish(&b);
+	munmap((void *)map, st.st_size);
+
+	return jobs;
+}
+
+/* Evaluate the n expressions of exprs, writing their results to out
+ * like batch() does; the ones that can't be evaluated are reported on
+ * stderr, after the expression. Returns 0, or 1 if some failed. */
+int
+batch_args(struct evaluator *ev, char *const *exprs, unsigned int n,
+	   int out)
+{
+	/* Start small: there are few results to write, and only once */
+	struct outbuf ob = { malloc(256), 0, 256 };
+	uint64_t result;
+	size_t len;
+	int status = 0;
+	bool ok = ob.buf != NULL;
+
+	for (unsigned int i = 0; ok && i < n; i++) {
+		len = strlen(exprs[i]);
+
+		if (ev->exact ? evaluate_big(ev, exprs[i], len)
+		    : evaluate(ev, exprs[i], len, &result))
+			ok = ev->exact ? out_big(&ob, &ev->big)
+				: ev->floating ? out_double(&ob, result)
+				: out_result(&ob, result);
+		else if (ev->err != NULL) {
+			fprintf(stderr, "%s: %s\n", exprs[i], ev->err);
+			status = 1;
+		}
+	}
+
+	if (!ok) {
+		fprintf(stderr, "Error: unable to allocate enough memory!\n");
+		status = 1;
+	} else if (!write_all(out, ob.buf, ob.len)) {
+		perror("write");
+		status = 1;
+	}
+
+	free(ob.buf);
+	return status;
+}
+
+#endif
@@ -0,0 +1,695 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, bignum.h, runs programs compiled by vm.h exactly:
+ * values are signed, and never wrap around.
+ *
+ * Every value starts as a 64-bit machine word, and operations
+ * on words check for overflow. Only when one overflows are its
+ * operands promoted to arbitrary-precision integers, using GMP,
+ * if configure found it (HAVE_GMP is then 1, and 0 otherwise);
+ * without GMP, overflowing is an error instead. Big results
+ * that fit in a word again are demoted, so the rest of the
+ * expression goes back to the fast path.
+ *
+ * Big integers are only limited by BIG_MAX_BITS, which stops
+ * a typo from exhausting memory. They are kept between runs,
+ * so their limbs are allocated once, and reused by every
+ * later expression.
+ *
+ * Usage:
+ * struct arena arena = { .exact = true };
+ * parse(), build_ast() and compile(), as usual, then:
+ * if (run_big(&bn, &prog, &arena)) {
+ * 	char *str = malloc(big_size(&bn));
+ * 	big_str(&bn, str);
+ * }
+ * big_free(&bn);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#if defined(HAVE_GMP_H) && defined(HAVE_LIBGMP)
+#define HAVE_GMP 1
+#else
+#define HAVE_GMP 0
+#endif
+
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_GMP
+#include <gmp.h>
+#endif
+
+#include "arith.h"
+#include "format.h"
+#include "parse.h"
+#include "vm.h"
+
+/* Largest result, in bits (256 MiB) */
+#define BIG_MAX_BITS ((size_t)1 << 31)
+
+/* Exact evaluator state.
+ * Entry i of the stack is stack[i] if isbig[i] is set,
+ * and small[i] otherwise; the result is entry 0. */
+struct bignum {
+	int64_t *small;		/* Machine words */
+	uint8_t *isbig;		/* Is the entry a big integer? */
+#if HAVE_GMP
+	mpz_t *stack;		/* Big integers, always initialised */
+#endif
+	uint32_t cap;		/* Entries allocated */
+	const char *err;	/* Last error message */
+};
+
+/* Function prototypes */
+static inline bool big_reserve(struct bignum *, uint32_t);
+static inline bool small_invert(int64_t, int64_t, int64_t *);
+static inline int small_shift(int64_t *, int64_t, bool);
+static inline int small_pow(int64_t *, int64_t);
+static inline int small_op(uint8_t, int64_t *);
+#if HAVE_GMP
+static inline void big_set_u64(mpz_t, uint64_t);
+static inline void big_promote(struct bignum *, uint32_t);
+static inline void big_demote(struct bignum *, uint32_t);
+static inline int big_shift(mpz_t, mpz_t, bool);
+static inline int big_pow(mpz_t, mpz_t);
+static inline int big_powmod(mpz_t, mpz_t, mpz_t);
+static inline int big_fact(mpz_t);
+static inline int big_op(uint8_t, mpz_t *);
+#endif
+bool run_big(struct bignum *, const struct program *,
+	     const struct arena *);
+size_t big_size(const struct bignum *);
+size_t big_str(const struct bignum *, char *);
+void big_free(struct bignum *);
+
+/* Make sure the stack has at least n entries */
+static inline bool
+big_reserve(struct bignum *bn, uint32_t n)
+{
+	void *p;
+
+	if (n <= bn->cap)
+		return true;
+
+	if ((p = realloc(bn->small, n * sizeof(*bn->small))) == NULL)
+		goto nomem;
+	bn->small = p;
+
+	if ((p = realloc(bn->isbig, n * sizeof(*bn->isbig))) == NULL)
+		goto nomem;
+	bn->isbig = p;
+
+#if HAVE_GMP
+	if ((p = realloc(bn->stack, n * sizeof(*bn->stack))) == NULL)
+		goto nomem;
+	bn->stack = p;
+
+	while (bn->cap < n)
+		mpz_init(bn->stack[bn->cap++]);
+#endif
+
+	bn->cap = n;
+	return true;
+
+ nomem:
+	bn->err = "Error: unable to allocate enough memory!";
+	return false;
+}
+
+/* Inverse of a modulo m, with 0 <= a < m, by the extended
+ * Euclidean algorithm; its coefficients never exceed m */
+static inline bool
+small_invert(int64_t a, int64_t m, int64_t *inv)
+{
+	int64_t t = 0, nt = 1, r = m, nr = a, q, tmp;
+
+	while (nr != 0) {
+		q = r / nr;
+		tmp = t - q * nt;
+		t = nt;
+		nt = tmp;
+		tmp = r - q * nr;
+		r = nr;
+		nr = tmp;
+	}
+
+	if (r != 1)
+		return false;
+
+	*inv = t < 0 ? t + m : t;
+	return true;
+}
+
+/* x << n, or x >> n: negative counts shift the other way,
+ * and right shifts round towards minus infinity */
+static inline int
+small_shift(int64_t *x, int64_t n, bool left)
+{
+	int64_t r;
+
+	if (n < 0) {
+		if (n == INT64_MIN)
+			return ARITH_OVERFLOW;
+
+		n = -n;
+		left = !left;
+	}
+
+	if (!left) {
+		*x = n > 63 ? (*x < 0 ? -1 : 0) : *x >> n;
+		return ARITH_OK;
+	}
+
+	if (*x == 0)
+		return ARITH_OK;
+
+	/* Shift the bits out, and see if they come back */
+	if (n > 62)
+		return ARITH_OVERFLOW;
+
+	r = (int64_t)((uint64_t)*x << n);
+	if (r >> n != *x)
+		return ARITH_OVERFLOW;
+
+	*x = r;
+	return ARITH_OK;
+}
+
+/* *x ^ n, left in *x; like big_pow(), a negative exponent gives
+ * 1 / *x ^ -n, truncated. ipow() works on unsigned words, so it
+ * is given the magnitude of *x, and the sign is put back here. */
+static inline int
+small_pow(int64_t *x, int64_t n)
+{
+	uint64_t mag = *x < 0 ? 0 - (uint64_t)*x : (uint64_t)*x, r;
+	bool neg = *x < 0 && (n & 1);
+	int status;
+
+	if (n < 0) {
+		if (mag == 0)
+			return ARITH_DIV_ZERO;
+
+		/* Only 1 and -1 don't truncate to 0 */
+		*x = mag != 1 ? 0 : neg ? -1 : 1;
+		return ARITH_OK;
+	}
+
+	if ((status = ipow(mag, n, &r)) != ARITH_OK)
+		return status;
+
+	if (r > (uint64_t)INT64_MAX + neg)
+		return ARITH_OVERFLOW;
+
+	*x = neg ? (int64_t)(0 - r) : (int64_t)r;
+	return ARITH_OK;
+}
+
+/* Apply an operator to the machine words starting at s,
+ * leaving the result in s[0]. Returns ARITH_OVERFLOW if
+ * the result needs a big integer. */
+static inline int
+small_op(uint8_t op, int64_t *s)
+{
+	int64_t x = s[0], y = s[1], m;
+	uint64_t r, e;
+	int status;
+
+	switch (op) {
+	/* On overflow, the operands must be left as they were */
+	case OP_ADD:
+		if (__builtin_add_overflow(x, y, &m))
+			return ARITH_OVERFLOW;
+
+		s[0] = m;
+		return ARITH_OK;
+
+	case OP_SUB:
+		if (__builtin_sub_overflow(x, y, &m))
+			return ARITH_OVERFLOW;
+
+		s[0] = m;
+		return ARITH_OK;
+
+	case OP_MUL:
+		if (__builtin_mul_overflow(x, y, &m))
+			return ARITH_OVERFLOW;
+
+		s[0] = m;
+		return ARITH_OK;
+
+	case OP_DIV:
+	case OP_MOD:
+		if (y == 0)
+			return ARITH_DIV_ZERO;
+
+		/* -2^63 / -1 is the only quotient that overflows */
+		if (y == -1)
+			return op == OP_MOD ? (s[0] = 0, ARITH_OK)
+			       : small_op(OP_NEG, s);
+
+		s[0] = op == OP_DIV ? x / y : x % y;
+		return ARITH_OK;
+
+	case OP_LSHIFT:
+	case OP_RSHIFT:
+		return small_shift(s, y, op == OP_LSHIFT);
+
+	case OP_POWER:
+		return small_pow(s, y);
+
+	case OP_NEG:
+		if (x == INT64_MIN)
+			return ARITH_OVERFLOW;
+
+		s[0] = -x;
+		return ARITH_OK;
+
+	case OP_FACT:
+		if (x < 0)
+			return ARITH_NEGATIVE;
+
+		/* 20! is the largest that fits, even signed */
+		if ((status = ifact(x, &r)) != ARITH_OK)
+			return status;
+
+		s[0] = r;
+		return ARITH_OK;
+
+	case OP_POWMOD:
+		/* The sign of the modulus doesn't matter */
+		if ((m = s[2]) == 0)
+			return ARITH_DIV_ZERO;
+		if (m == INT64_MIN)
+			return ARITH_OVERFLOW;
+		if (m < 0)
+			m = -m;
+
+		if ((x %= m) < 0)
+			x += m;
+
+		/* A negative power is a power of the inverse */
+		e = y;
+		if (y < 0) {
+			if (!small_invert(x, m, &x))
+				return ARITH_NO_INVERSE;
+			e = 0 - e;
+		}
+
+		powmod(x, e, m, &r);
+		s[0] = r;
+		return ARITH_OK;
+
+	default:
+		return ARITH_OVERFLOW;
+	}
+}
+
+#if HAVE_GMP
+/* Set z to an unsigned 64-bit value, even where longs are 32 bits */
+static inline void
+big_set_u64(mpz_t z, uint64_t v)
+{
+#if ULONG_MAX >= UINT64_MAX
+	mpz_set_ui(z, v);
+#else
+	mpz_import(z, 1, -1, sizeof(v), 0, 0, &v);
+#endif
+}
+
+/* Turn entry i into a big integer */
+static inline void
+big_promote(struct bignum *bn, uint32_t i)
+{
+	int64_t v = bn->small[i];
+
+	if (bn->isbig[i])
+		return;
+
+#if LONG_MAX >= INT64_MAX
+	mpz_set_si(bn->stack[i], v);
+#else
+	big_set_u64(bn->stack[i], v < 0 ? 0 - (uint64_t)v : (uint64_t)v);
+	if (v < 0)
+		mpz_neg(bn->stack[i], bn->stack[i]);
+#endif
+
+	bn->isbig[i] = 1;
+}
+
+/* Turn entry i back into a machine word, if it fits */
+static inline void
+big_demote(struct bignum *bn, uint32_t i)
+{
+#if LONG_MAX >= INT64_MAX
+	if (!mpz_fits_slong_p(bn->stack[i]))
+		return;
+
+	bn->small[i] = mpz_get_si(bn->stack[i]);
+#else
+	uint64_t mag = 0;
+
+	if (mpz_sizeinbase(bn->stack[i], 2) > 63)
+		return;
+
+	mpz_export(&mag, NULL, -1, sizeof(mag), 0, 0, bn->stack[i]);
+	bn->small[i] = mpz_sgn(bn->stack[i]) < 0 ? -(int64_t)mag : (int64_t)mag;
+#endif
+
+	bn->isbig[i] = 0;
+}
+
+/* Big integer version of small_shift() */
+static inline int
+big_shift(mpz_t x, mpz_t n, bool left)
+{
+	if (mpz_sgn(n) < 0) {
+		mpz_neg(n, n);
+		left = !left;
+	}
+
+	if (!left) {
+		if (mpz_cmp_ui(n, BIG_MAX_BITS) > 0)
+			mpz_set_si(x, mpz_sgn(x) < 0 ? -1 : 0);
+		else
+			mpz_fdiv_q_2exp(x, x, mpz_get_ui(n));
+		return ARITH_OK;
+	}
+
+	if (mpz_sgn(x) == 0)
+		return ARITH_OK;
+
+	if (mpz_sizeinbase(x, 2) > BIG_MAX_BITS
+	    || mpz_cmp_ui(n, BIG_MAX_BITS - mpz_sizeinbase(x, 2)) > 0)
+		return ARITH_TOO_LARGE;
+
+	mpz_mul_2exp(x, x, mpz_get_ui(n));
+	return ARITH_OK;
+}
+
+/* x ^ n; a negative exponent gives 1 / x ^ -n, truncated */
+static inline int
+big_pow(mpz_t x, mpz_t n)
+{
+	size_t bits;
+
+	/* 0, 1 and -1 stay small, whatever the exponent */
+	if (mpz_cmpabs_ui(x, 1) <= 0) {
+		if (mpz_sgn(n) < 0 && mpz_sgn(x) == 0)
+			return ARITH_DIV_ZERO;
+
+		if (mpz_sgn(n) == 0)
+			mpz_set_ui(x, 1);
+		else if (mpz_sgn(x) < 0 && mpz_even_p(n))
+			mpz_neg(x, x);
+		return ARITH_OK;
+	}
+
+	if (mpz_sgn(n) < 0) {
+		mpz_set_ui(x, 0);
+		return ARITH_OK;
+	}
+
+	/* The result has at least (bits - 1) * n + 1 bits */
+	bits = mpz_sizeinbase(x, 2) - 1;
+	if (mpz_cmp_ui(n, BIG_MAX_BITS / bits) > 0)
+		return ARITH_TOO_LARGE;
+
+	mpz_pow_ui(x, x, mpz_get_ui(n));
+	return ARITH_OK;
+}
+
+/* (x ^ e) % m, left in x; a negative exponent
+ * uses the inverse of x modulo m, if there is one */
+static inline int
+big_powmod(mpz_t x, mpz_t e, mpz_t m)
+{
+	if (mpz_sgn(m) == 0)
+		return ARITH_DIV_ZERO;
+
+	/* Everything is 0 modulo 1 */
+	if (mpz_cmpabs_ui(m, 1) == 0) {
+		mpz_set_ui(x, 0);
+		return ARITH_OK;
+	}
+
+	if (mpz_sgn(e) < 0) {
+		if (mpz_invert(x, x, m) == 0)
+			return ARITH_NO_INVERSE;
+
+		mpz_neg(e, e);
+	}
+
+	mpz_powm(x, x, e, m);
+	return ARITH_OK;
+}
+
+/* x! */
+static inline int
+big_fact(mpz_t x)
+{
+	double n;
+
+	if (mpz_sgn(x) < 0)
+		return ARITH_NEGATIVE;
+
+	/* n! has fewer than n * log2(n) bits */
+	n = mpz_get_d(x);
+	if (!mpz_fits_ulong_p(x) || n * log2(n) > BIG_MAX_BITS)
+		return ARITH_TOO_LARGE;
+
+	mpz_fac_ui(x, mpz_get_ui(x));
+	return ARITH_OK;
+}
+
+/* Big integer version of small_op() */
+static inline int
+big_op(uint8_t op, mpz_t *s)
+{
+	switch (op) {
+	case OP_ADD:
+		mpz_add(s[0], s[0], s[1]);
+		return ARITH_OK;
+
+	case OP_SUB:
+		mpz_sub(s[0], s[0], s[1]);
+		return ARITH_OK;
+
+	case OP_MUL:
+		if (mpz_sizeinbase(s[0], 2) + mpz_sizeinbase(s[1], 2)
+		    > BIG_MAX_BITS)
+			return ARITH_TOO_LARGE;
+
+		mpz_mul(s[0], s[0], s[1]);
+		return ARITH_OK;
+
+	case OP_DIV:
+	case OP_MOD:
+		if (mpz_sgn(s[1]) == 0)
+			return ARITH_DIV_ZERO;
+
+		/* Truncate towards zero, like C */
+		if (op == OP_DIV)
+			mpz_tdiv_q(s[0], s[0], s[1]);
+		else
+			mpz_tdiv_r(s[0], s[0], s[1]);
+		return ARITH_OK;
+
+	case OP_LSHIFT:
+	case OP_RSHIFT:
+		return big_shift(s[0], s[1], op == OP_LSHIFT);
+
+	case OP_POWER:
+		return big_pow(s[0], s[1]);
+
+	case OP_NEG:
+		mpz_neg(s[0], s[0]);
+		return ARITH_OK;
+
+	case OP_POWMOD:
+		return big_powmod(s[0], s[1], s[2]);
+
+	case OP_FACT:
+		return big_fact(s[0]);
+
+	default:
+		return ARITH_TOO_LARGE;
+	}
+}
+#endif
+
+/* Run a compiled program exactly; its BIGVAL operands are read
+ * from a->text. The result is left in entry 0 of the stack, see
+ * big_str(). On error, bn->err is set and false is returned. */
+bool
+run_big(struct bignum *bn, const struct program *prog,
+	const struct arena *a)
+{
+	const uint8_t *pc = prog->code;
+	const uint64_t *k = prog->consts;
+	uint32_t sp = 0, n, i;
+	uint8_t op, big;
+	int status;
+
+	if (!big_reserve(bn, prog->max_stack))
+		return false;
+
+	for (;;) {
+		switch (op = *pc++) {
+		case OP_PUSH:
+			if (*k <= INT64_MAX) {
+				bn->small[sp] = *k++;
+				bn->isbig[sp++] = 0;
+				continue;
+			}
+
+#if HAVE_GMP
+			big_set_u64(bn->stack[sp], *k++);
+			bn->isbig[sp++] = 1;
+			continue;
+#else
+			status = ARITH_OVERFLOW;
+			goto fail;
+#endif
+
+		case OP_BIGPUSH:
+#if HAVE_GMP
+			/* The base, then the digits */
+			mpz_set_str(bn->stack[sp], a->text + *k + 1,
+				    a->text[*k]);
+			k++;
+			bn->isbig[sp++] = 1;
+			continue;
+#else
+			(void)a;
+			status = ARITH_OVERFLOW;
+			goto fail;
+#endif
+
+		case OP_VAR:
+			bn->err = "Error: variables have no value";
+			return false;
+
+		case OP_FPUSH:
+			bn->err = "Error: special values aren't exact";
+			return false;
+
+		case OP_SQRT:
+		case OP_LOG:
+		case OP_EXP:
+		case OP_SIN:
+		case OP_COS:
+			bn->err = "Error: this function isn't exact";
+			return false;
+
+		case OP_END:
+			return true;
+
+		case OP_NEG:
+		case OP_FACT:
+			n = 1;
+			break;
+
+		case OP_POWMOD:
+			n = 3;
+			break;
+
+		default:
+			n = 2;
+		}
+
+		/* The operands are the top n entries */
+		sp -= n;
+
+		for (big = 0, i = sp; i < sp + n; i++)
+			big |= bn->isbig[i];
+
+		if (!big) {
+			status = small_op(op, bn->small + sp);
+
+			if (status == ARITH_OK) {
+				sp++;
+				continue;
+			}
+
+			if (status != ARITH_OVERFLOW)
+				goto fail;
+		}
+
+#if HAVE_GMP
+		for (i = sp; i < sp + n; i++)
+			big_promote(bn, i);
+
+		if ((status = big_op(op, bn->stack + sp)) != ARITH_OK)
+			goto fail;
+
+		big_demote(bn, sp++);
+#else
+		goto fail;
+#endif
+	}
+
+ fail:
+	bn->err = arith_error(status);
+	return false;
+}
+
+/* Most bytes big_str() needs: digits, a sign and a NUL */
+size_t
+big_size(const struct bignum *bn)
+{
+#if HAVE_GMP
+	if (bn->isbig[0])
+		return mpz_sizeinbase(bn->stack[0], 10) + 2;
+#endif
+
+	(void)bn;
+	return 21;
+}
+
+/* Write the result of the last run in decimal, returning its length */
+size_t
+big_str(const struct bignum *bn, char *buf)
+{
+	size_t len;
+
+#if HAVE_GMP
+	if (bn->isbig[0]) {
+		mpz_get_str(buf, 10, bn->stack[0]);
+		return strlen(buf);
+	}
+#endif
+
+	len = fmt_i64(buf, bn->small[0]);
+	buf[len] = '\0';
+	return len;
+}
+
+/* Release the memory held by the stack */
+void
+big_free(struct bignum *bn)
+{
+#if HAVE_GMP
+	for (uint32_t i = 0; i < bn->cap; i++)
+		mpz_clear(bn->stack[i]);
+
+	free(bn->stack);
+#endif
+
+	free(bn->small);
+	free(bn->isbig);
+	memset(bn, 0, sizeof(*bn));
+}
+
+#endif
@@ -0,0 +1,261 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, cache.h, implements a bounded LRU cache of
+ * results, keyed by the token stream produced by parse().
+ * Since the lexer already drops whitespace, "1+1" and " 1 + 1 "
+ * share the same entry, and a hit skips building the AST,
+ * compiling and running the program.
+ *
+ * Usage:
+ * parse(&arena, str, len);
+ * if (!cache_lookup(&cache, &arena, &result)) {
+ * 	... evaluate ...
+ * 	cache_store(&cache, result);
+ * }
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse.h"
+
+#define CACHE_SIZE 256		/* Number of entries, a power of 2 */
+#define CACHE_MAX_TOKENS 1024	/* Longer expressions aren't cached */
+
+/* Sentinel index meaning "no entry" */
+#define NO_ENTRY UINT32_MAX
+
+/* Cache entry */
+struct cache_entry {
+	uint64_t hash;		/* Hash of the token stream */
+	uint64_t result;	/* Result of the expression */
+	uint8_t *type;		/* Token types */
+	uint64_t *value;	/* Token values */
+	uint32_t len;		/* Tokens in use */
+	uint32_t cap;		/* Tokens allocated */
+	uint32_t chain;		/* Next entry in the same bucket */
+	uint32_t prev;		/* Previous entry in LRU order */
+	uint32_t next;		/* Next entry in LRU order */
+};
+
+/* Result cache */
+struct cache {
+	struct cache_entry entries[CACHE_SIZE];
+	uint32_t buckets[CACHE_SIZE];	/* First entry of each bucket */
+	uint32_t head;		/* Most recently used entry */
+	uint32_t tail;		/* Least recently used entry */
+	uint32_t used;		/* Entries handed out so far */
+	uint32_t pending;	/* Entry reserved for the next miss */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bytes;		/* Bytes allocated for tokens */
+	bool staged;		/* The pending entry holds the last miss */
+	bool initialised;
+};
+
+/* Function prototypes */
+static inline uint64_t cache_hash(struct arena *);
+static inline void cache_init(struct cache *);
+static inline void bucket_remove(struct cache *, uint32_t);
+static inline void lru_remove(struct cache *, uint32_t);
+static inline void lru_push(struct cache *, uint32_t);
+bool cache_lookup(struct cache *, struct arena *, uint64_t *);
+void cache_store(struct cache *, uint64_t);
+void cache_free(struct cache *);
+
+/* Hash the tokens in the arena */
+static inline uint64_t
+cache_hash(struct arena *a)
+{
+	uint64_t h = 0xcbf29ce484222325 ^ a->len;
+
+	for (uint32_t i = 0; i < a->len; i++) {
+		h = (h ^ a->type[i]) * 0x100000001b3;
+		h = (h ^ a->value[i]) * 0x9e3779b97f4a7c15;
+		h ^= h >> 29;
+	}
+
+	return h;
+}
+
+/* Set up an empty cache */
+static inline void
+cache_init(struct cache *c)
+{
+	for (uint32_t i = 0; i < CACHE_SIZE; i++)
+		c->buckets[i] = NO_ENTRY;
+
+	c->head = c->tail = c->pending = NO_ENTRY;
+	c->initialised = true;
+}
+
+/* Remove an entry from its bucket */
+static inline void
+bucket_remove(struct cache *c, uint32_t e)
+{
+	uint32_t *link = &c->buckets[c->entries[e].hash & (CACHE_SIZE - 1)];
+
+	while (*link != e)
+		link = &c->entries[*link].chain;
+	*link = c->entries[e].chain;
+}
+
+/* Remove an entry from the LRU list */
+static inline void
+lru_remove(struct cache *c, uint32_t e)
+{
+	struct cache_entry *ent = &c->entries[e];
+
+	if (ent->prev != NO_ENTRY)
+		c->entries[ent->prev].next = ent->next;
+	else
+		c->head = ent->next;
+
+	if (ent->next != NO_ENTRY)
+		c->entries[ent->next].prev = ent->prev;
+	else
+		c->tail = ent->prev;
+}
+
+/* Make an entry the most recently used one */
+static inline void
+lru_push(struct cache *c, uint32_t e)
+{
+	struct cache_entry *ent = &c->entries[e];
+
+	ent->prev = NO_ENTRY;
+	ent->next = c->head;
+
+	if (c->head != NO_ENTRY)
+		c->entries[c->head].prev = e;
+	else
+		c->tail = e;
+
+	c->head = e;
+}
+
+/* Look up the tokens in the arena.
+ * On a hit, store the result in *result and return true.
+ * On a miss, stage an entry for cache_store() and return false. */
+bool
+cache_lookup(struct cache *c, struct arena *a, uint64_t *result)
+{
+	struct cache_entry *ent;
+	uint64_t hash;
+	uint32_t e;
+
+	if (!c->initialised)
+		cache_init(c);
+
+	c->staged = false;
+	hash = cache_hash(a);
+
+	for (e = c->buckets[hash & (CACHE_SIZE - 1)]; e != NO_ENTRY;
+	     e = ent->chain) {
+		ent = &c->entries[e];
+
+		if (ent->hash != hash || ent->len != a->len
+		    || memcmp(ent->type, a->type, a->len) != 0
+		    || memcmp(ent->value, a->value,
+			      a->len * sizeof(*a->value)) != 0)
+			continue;
+
+		if (c->head != e) {
+			lru_remove(c, e);
+			lru_push(c, e);
+		}
+
+		c->hits++;
+		*result = ent->result;
+		return true;
+	}
+
+	c->misses++;
+
+	if (a->len > CACHE_MAX_TOKENS)
+		return false;
+
+	/* Pick an entry to stage the tokens in: the one left over
+	 * from a failed evaluation, an unused one, or the LRU one */
+	if ((e = c->pending) == NO_ENTRY) {
+		if (c->used < CACHE_SIZE)
+			e = c->used++;
+		else {
+			e = c->tail;
+			bucket_remove(c, e);
+			lru_remove(c, e);
+		}
+	}
+
+	ent = &c->entries[e];
+	c->pending = e;
+
+	if (ent->cap < a->len) {
+		void *p;
+
+		if ((p = realloc(ent->type, a->len)) == NULL)
+			return false;
+		ent->type = p;
+
+		if ((p = realloc(ent->value, a->len * sizeof(*ent->value)))
+		    == NULL)
+			return false;
+		ent->value = p;
+
+		c->bytes += (uint64_t)(a->len - ent->cap)
+			    * (sizeof(*ent->type) + sizeof(*ent->value));
+		ent->cap = a->len;
+	}
+
+	/* Copy the tokens now: building the AST modifies the arena */
+	memcpy(ent->type, a->type, a->len);
+	memcpy(ent->value, a->value, a->len * sizeof(*a->value));
+	ent->hash = hash;
+	ent->len = a->len;
+	c->staged = true;
+
+	return false;
+}
+
+/* Store the result of the expression staged by the last miss */
+void
+cache_store(struct cache *c, uint64_t result)
+{
+	struct cache_entry *ent;
+	uint32_t e = c->pending;
+
+	if (!c->staged)
+		return;
+
+	ent = &c->entries[e];
+	ent->result = result;
+
+	ent->chain = c->buckets[ent->hash & (CACHE_SIZE - 1)];
+	c->buckets[ent->hash & (CACHE_SIZE - 1)] = e;
+
+	lru_push(c, e);
+	c->pending = NO_ENTRY;
+	c->staged = false;
+}
+
+/* Release the memory held by the cache */
+void
+cache_free(struct cache *c)
+{
+	for (uint32_t i = 0; i < CACHE_SIZE; i++) {
+		free(c->entries[i].type);
+		free(c->entries[i].value);
+	}
+
+	memset(c, 0, sizeof(*c));
+}
+
+#endif
@@ -2,7 +2,9 @@
  *
  * calc is a Simple Calculator written in C by Salonia Matteo.
  * It takes input from stdin using libreadline, and prints the
- * result from the requested operation to stdout.
+ * result from the requested operation to stdout. readline is only
+ * loaded when the prompt is shown (see prompt.h): the other modes,
+ * such as "calc -e EXPR", start without it.
  *
  * Made by Salonia Matteo <saloniamatteo@pm.me>
  *
@@ -12,7 +14,9 @@
 #define _FORTIFY_SOURCE 2
 #define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <math.h>
 #include <signal.h>
 #include <stdint.h>
@@ -20,7 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <readline/readline.h>
+#include <unistd.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -30,9 +34,14 @@
 #define PACKAGE_STRING "calc 2.1"
 #endif
 
+#include "batch.h"
+#include "columns.h"
 #include "color.h"
+#include "eval.h"
+#include "prompt.h"
 #include "rpn.c"
-#include "parse.h"
+#include "serve.h"
+#include "shm.h"
 
 /* Instead of constantly writing color(string, 1, rvideo),
  * only write color_rvid(string) */
@@ -51,25 +60,39 @@ enum calc_flags {
 	showflags = 1 << 1,	/* Print program flags? (Default: yes) */
 	showsamp = 1 << 2,	/* Print examples? (Default: yes) */
 	justcalc = 1 << 3,	/* Enter just-calculator mode? (Default: no (0); yes (1)) */
+	batchmode = 1 << 4,	/* Evaluate stdin line by line? (Default: if not a TTY) */
 };
 
 static const char *JC_CMDS[] = {
 	"clear", "exit", "help", "quit", "nocalc", "rpn", NULL
 };
 static const char *NORM_CMDS[] = {
-    	"calc", "clear", "color", "examples", "exit", "flags",
-	"help", "nocolor", "noexamples", "noflags", "operands",
-	"ops", "quit", "rpn",
-	NULL
+    	"cache", "cachestats", "calc", "clear", "color", "examples",
+	"exit", "flags", "help", "nocache", "nocolor", "noexamples",
+	"noflags", "nostats", "operands", "ops", "quit", "rpn", "specvals",
+	"stats", NULL
 };
 
 static const char *FLAGS[] = {
+	"--big, -B",		"\tEvaluate exactly, with big integers if needed",
+	"--no-cache, -C",	"Don't cache results",
+	"--no-examples, -E",	"Don't show examples",
+	"--batch, -b",		"\tEvaluate stdin line by line, without prompts",
+	"--jobs, -j N",		"\tUse N threads (0: one per CPU)",
 	"--just-calc, -c",	"Enter just-calculator mode",
-	"--no-examples, -e",	"Don't show examples",
+	"--eval, -e EXPR",	"Print the result of EXPR, and exit",
 	"--no-flags, -f",	"\tDon't show these flags",
 	"--help, -h",		"\tShow this help",
 	"--no-color, -n",	"\tDon't color the output",
+	"--output, -o FMT",	"Output dec, signed, hex, oct, bin or raw",
 	"--rpn, -r",		"\tEnter RPN mode (Reverse Polish Notation)",
+	"--rpn-prog, -R RPN",	"Run RPN over each line of values ($1, $2...)",
+	"--stats, -s",		"\tTime each phase of every evaluation",
+	"--serve, -S PATH",	"Answer clients of the Unix socket PATH",
+	"--shm, -Q NAME",	"Answer a client through shared memory NAME",
+	"--csv, -x EXPR",	"Evaluate EXPR over every row of a CSV",
+	"--jit, -J",		"\tCompile EXPR to machine code in CSV mode",
+	"--verify, -V",		"\tCheck CSV results with the reference evaluator",
 	NULL
 };
 
@@ -101,18 +124,65 @@ static const char *OPS_STR[] = {
 	">",	"Right bit-shift operator: shift bits to the right.\n",
 	"^",	"Power operator: multiply a number by itself.\n",
 	"%",	"Modulus operator: get the remainder of a division.\n",
+	"powmod",	"Modular power: powmod(b, e, m) is (b ^ e) % m.\n",
+	"fact",	"Factorial: fact(n) is 1 * 2 * ... * n.\n",
+	"sqrt",	"Square root: sqrt(x).\n",
+	"log",	"Natural logarithm: log(x), so log(E) is 1.\n",
+	"exp",	"Exponential: exp(x) is E ^ x.\n",
+	"sin",	"Sine: sin(x), x being in radians.\n",
+	"cos",	"Cosine: cos(x), x being in radians.\n",
+	NULL
+};
+
+static const char *SPEC_HEAD[] = {
+	"[Name]\t\t[Value]",
+	NULL
+};
+
+static const char *SPEC_STR[] = {
+	"E",	"Euler's number, 2.7182818285\n",
+	"Pi",	"Pi, 3.1415926536\n",
+	"Pi2",	"Pi / 2, 1.5707963268\n",
+	"Pi4",	"Pi / 4, 0.7853981634\n",
+	"1Pi",	"1 / Pi, 0.3183098862\n",
+	"2Pi",	"2 / Pi, 0.6366197724\n",
+	"Pisq",	"Pi squared, 9.8696044011\n",
 	NULL
 };
 
 static unsigned short int flags = 0;	/* Used to store flags */
+static unsigned int jobs = 1;		/* Threads of batch and serve mode */
+static const char *csvexpr = NULL;	/* Expression evaluated over CSV rows */
+static unsigned int csvopts = 0;	/* COLUMNS_* options of CSV mode */
+static const char *rpnsrc = NULL;	/* RPN run over lines of values */
+static const char *sockpath = NULL;	/* Unix socket served on */
+static const char *shmname = NULL;	/* Shared memory served on */
+static char **exprs = NULL;		/* Expressions given with -e */
+static unsigned int nexprs = 0;
+static struct evaluator ev = {		/* Used to evaluate expressions */
+	.usecache = true
+};
 
 /* Function prototypes */
+static void cleanup(void);
 static void clearScr(void);
 static void parseInput(char *);
+static void printResult(const char *, size_t);
 static void printHelp(void);
 static void printOps(void);
+static void printSpecVals(void);
 static void sigHandler(int);
 
+/* Free allocated memory to prevent memory leaks */
+static void
+cleanup(void)
+{
+	if (_free_color() != 0)
+		fprintf(stderr, "WARNING! Failed to free coloredStr!\n");
+
+	evaluator_free(&ev);
+}
+
 /* Clear the screen */
 static void
 clearScr(void)
@@ -135,88 +205,219 @@ clearScr(void)
 static void
 parseInput(char *input)
 {
-	/* Enter just-calculator mode, if we aren't already inside */
-	if (!strcasecmp(input, "calc") && !(flags & justcalc)) {
-		flags |= justcalc;
-		fprintf(stderr, "[Entered just-calculator mode]\n");
-
-	/* Clear the screen */
-	} else if (!strcasecmp(input, "clear"))
-		clearScr();
-
-	/* Enable colors, if we aren't in just-calc mode */
-	else if (!strcasecmp(input, "color") && !(flags & justcalc)) {
-		flags |= usecolor;
-		fprintf(stderr, "[Enabled color]\n");
-
-	/* Exit without errors */
-	} else if (!strcasecmp(input, "exit") || !strcasecmp(input, "quit"))
-		exit(0);
-
-	/* Enable examples in help section,
-	 * if we aren't in just-calc mode */
-	else if (!strcasecmp(input, "examples") && !(flags & justcalc)) {
-		flags |= showsamp;
-		fprintf(stderr, "[Enabled examples]\n");
-
-	/* Show flags, if we aren't in just-calc mode */
-	} else if (!strcasecmp(input, "flags") && !(flags & justcalc)) {
-		flags |= showflags;
-		fprintf(stderr, "[Enabled flags]\n");
-
-	/* Print this program's help */
-	} else if (!strcasecmp(input, "help"))
-		printHelp();
-
-	/* Print available operands,
-	 * if we aren't in just-calc mode */
-	else if ((!strcasecmp(input, "operands") || !strcasecmp(input, "ops"))
-		 && !(flags & justcalc))
-		printOps();
-
-	/* Exit out of just-calculator mode, if we're inside */
-	else if (!strcasecmp(input, "nocalc") && ((flags & justcalc) != 0)) {
-		flags &= ~justcalc;
-		fprintf(stderr, "[Disabled just-calculator mode]\n");
-
-	/* Disable color, if we
-	 * aren't in just-calc mode */
-	} else if (!strcasecmp(input, "nocolor") && !(flags & justcalc)) {
-		flags &= ~usecolor;
-		fprintf(stderr, "[Disabled color]\n");
-
-	/* Don't show examples, if we
-	 * aren't in just-calc mode */
-	} else if (!strcasecmp(input, "noexamples") && !(flags & justcalc)) {
-		flags &= ~showsamp;
-		fprintf(stderr, "[Disabled examples]\n");
-
-	/* Don't show flags, if we
-	 * aren't in just-calc mode */
-	} else if (!strcasecmp(input, "noflags") && !(flags & justcalc)) {
-		flags &= ~showflags;
-		fprintf(stderr, "[Disabled flags]\n");
-
-	/* Enter RPN mode, regardless of our mode */
-	} else if (!strcasecmp(input, "rpn")) {
-		fprintf(stderr, "[Entered RPN mode (exit with CTRL+D)]\n");
-		rpnInit();
+	size_t len = strlen(input);
+	const struct keyword *kw = keyword(input, len);
+	bool jc = (flags & justcalc) != 0;
+
+	/* Commands that don't apply to the current mode are
+	 * parsed like any other expression, and rejected there */
+	if (kw != NULL && kw->kind == KW_COMMAND) {
+		switch (kw->id) {
+		/* Enable the result cache, if we aren't in just-calc mode */
+		case CMD_CACHE:
+			if (jc)
+				break;
+			ev.usecache = true;
+			fprintf(stderr, "[Enabled cache]\n");
+			return;
 
-	/* Parse the entered string */
-	} else {
-		if (parse(input)) {
-			build_ast(&token_head);
-			uint64_t result = solve(token_head.next);
-
-			if (result != 1) {
-				if ((flags & usecolor) != 0
-				    && !(flags & justcalc))
-					printf("\e[1m%ld\e[0m\n", result);
-				else
-					printf("%ld\n", result);
+		/* Print cache statistics, if we aren't in just-calc mode */
+		case CMD_CACHESTATS:
+			if (jc)
+				break;
+			printf("Cache: %" PRIu64 " hits, %" PRIu64
+			       " misses (%s)\n", ev.cache.hits,
+			       ev.cache.misses,
+			       ev.usecache ? "enabled" : "disabled");
+			return;
+
+		/* Enter just-calculator mode, if we aren't already inside */
+		case CMD_CALC:
+			if (jc)
+				break;
+			flags |= justcalc;
+			fprintf(stderr, "[Entered just-calculator mode]\n");
+			return;
+
+		/* Clear the screen */
+		case CMD_CLEAR:
+			clearScr();
+			return;
+
+		/* Enable colors, if we aren't in just-calc mode */
+		case CMD_COLOR:
+			if (jc)
+				break;
+			flags |= usecolor;
+			fprintf(stderr, "[Enabled color]\n");
+			return;
+
+		/* Exit without errors */
+		case CMD_EXIT:
+		case CMD_QUIT:
+			exit(0);
+
+		/* Enable examples in help section,
+		 * if we aren't in just-calc mode */
+		case CMD_EXAMPLES:
+			if (jc)
+				break;
+			flags |= showsamp;
+			fprintf(stderr, "[Enabled examples]\n");
+			return;
+
+		/* Show flags, if we aren't in just-calc mode */
+		case CMD_FLAGS:
+			if (jc)
+				break;
+			flags |= showflags;
+			fprintf(stderr, "[Enabled flags]\n");
+			return;
+
+		/* Print this program's help */
+		case CMD_HELP:
+			printHelp();
+			return;
+
+		/* Print available operands,
+		 * if we aren't in just-calc mode */
+		case CMD_OPERANDS:
+		case CMD_OPS:
+			if (jc)
+				break;
+			printOps();
+			return;
+
+		/* Print available special values,
+		 * if we aren't in just-calc mode */
+		case CMD_SPECVALS:
+			if (jc)
+				break;
+			printSpecVals();
+			return;
+
+		/* Disable the result cache, if we aren't in just-calc mode */
+		case CMD_NOCACHE:
+			if (jc)
+				break;
+			ev.usecache = false;
+			fprintf(stderr, "[Disabled cache]\n");
+			return;
+
+		/* Exit out of just-calculator mode, if we're inside */
+		case CMD_NOCALC:
+			if (!jc)
+				break;
+			flags &= ~justcalc;
+			fprintf(stderr, "[Disabled just-calculator mode]\n");
+			return;
+
+		/* Disable color, if we
+		 * aren't in just-calc mode */
+		case CMD_NOCOLOR:
+			if (jc)
+				break;
+			flags &= ~usecolor;
+			fprintf(stderr, "[Disabled color]\n");
+			return;
+
+		/* Don't show examples, if we
+		 * aren't in just-calc mode */
+		case CMD_NOEXAMPLES:
+			if (jc)
+				break;
+			flags &= ~showsamp;
+			fprintf(stderr, "[Disabled examples]\n");
+			return;
+
+		/* Don't show flags, if we
+		 * aren't in just-calc mode */
+		case CMD_NOFLAGS:
+			if (jc)
+				break;
+			flags &= ~showflags;
+			fprintf(stderr, "[Disabled flags]\n");
+			return;
+
+		/* Print what the last evaluation, and every one so far,
+		 * took, if we aren't in just-calc mode */
+		case CMD_STATS:
+			if (jc)
+				break;
+			if (!ev.usestats) {
+				ev.usestats = true;
+				fprintf(stderr, "[Enabled stats]\n");
+				return;
 			}
+			stats_print(stdout, "Last", &ev.last);
+			stats_print(stdout, "Total", &ev.total);
+			return;
+
+		/* Stop counting what evaluations take,
+		 * if we aren't in just-calc mode */
+		case CMD_NOSTATS:
+			if (jc)
+				break;
+			ev.usestats = false;
+			fprintf(stderr, "[Disabled stats]\n");
+			return;
+
+		/* Enter RPN mode, regardless of our mode */
+		case CMD_RPN:
+			fprintf(stderr, "[Entered RPN mode "
+				"(exit with CTRL+D)]\n");
+			rpnInit();
+			return;
 		}
 	}
+
+	/* Parse the entered string exactly */
+	if (ev.exact) {
+		char *str;
+
+		if (evaluate_big(&ev, input, len)) {
+			if ((str = malloc(big_size(&ev.big))) == NULL) {
+				fprintf(stderr, "Error: unable to allocate "
+					"enough memory!\n");
+				return;
+			}
+
+			printResult(str, big_str(&ev.big, str));
+			free(str);
+		} else if (ev.err != NULL)
+			fprintf(stderr, "%s\n", ev.err);
+
+	/* Parse the entered string */
+	} else {
+		uint64_t result;
+		char str[FMT_MAX];
+
+		if (evaluate(&ev, input, len, &result)) {
+			/* Special values give a double, written out
+			 * as such, unless it's written out raw */
+			if (ev.floating && out_fmt != FMT_RAW) {
+				double d;
+
+				memcpy(&d, &result, sizeof(d));
+				printResult(str, fmt_double(str, d));
+			} else
+				printResult(str, fmt_int(str, result, out_fmt));
+		} else if (ev.err != NULL)
+			fprintf(stderr, "%s\n", ev.err);
+	}
+}
+
+/* Print a result, in bold if colors are enabled */
+static void
+printResult(const char *str, size_t len)
+{
+	/* Raw results are only their bytes */
+	if (out_fmt == FMT_RAW)
+		fwrite(str, 1, len, stdout);
+	else if ((flags & usecolor) != 0 && (flags & justcalc) == 0)
+		printf("\e[1m%.*s\e[0m\n", (int)len, str);
+	else
+		printf("%.*s\n", (int)len, str);
 }
 
 /* Print this program's help */
@@ -339,6 +540,31 @@ printOps(void)
 	}
 }
 
+/* Print available special values */
+static void
+printSpecVals(void)
+{
+	printf("Available special values (results using them "
+	       "are not exact):\n");
+
+	/* Check if we have to use colors */
+	if ((flags & usecolor) == usecolor)
+		puts(color_bu((char *)SPEC_HEAD[0]));
+	else
+		puts((char *)SPEC_HEAD[0]);
+
+	for (uint64_t i = 0; SPEC_STR[i] != NULL; i++) {
+		if ((i % 2) == 0) {
+			/* Check if we have to use colors */
+			if ((flags & usecolor) == usecolor)
+				printf("\e[1m%s\e[0m", SPEC_STR[i]);
+			else
+				printf("%s", SPEC_STR[i]);
+		} else
+			printf("\t\t%s", SPEC_STR[i]);
+	}
+}
+
 /* Handle signals */
 static void __attribute__((noreturn))
 sigHandler(int sigNum)
@@ -360,8 +586,7 @@ sigHandler(int sigNum)
 	memset(&sigNum, 0, sizeof(sigNum));
 
 	/* Free allocated memory to prevent memory leaks */
-	if (_free_color() != 0)
-		fprintf(stderr, "WARNING! Failed to free coloredStr!\n");
+	cleanup();
 
 	exit(0);
 }
@@ -382,22 +607,65 @@ main(int argc, char **argv)
 	/* Enter just-calculator mode? (Default: no (0); yes (1)) */
 	flags &= ~justcalc;
 
+	/* Evaluate stdin line by line? (Default: if not a TTY) */
+	flags &= ~batchmode;
+
 	/* Struct containing program options/flags */
 	static struct option longopts[] = {
+		{"big", no_argument, 0, 'B'},
+		{"no-cache", no_argument, 0, 'C'},
+		{"no-examples", no_argument, 0, 'E'},
+		{"batch", no_argument, 0, 'b'},
+		{"jobs", required_argument, 0, 'j'},
 		{"just-calc", no_argument, 0, 'c'},
-		{"no-examples", no_argument, 0, 'e'},
+		{"eval", required_argument, 0, 'e'},
 		{"no-flags", no_argument, 0, 'f'},
 		{"help", no_argument, 0, 'h'},
 		{"no-color", no_argument, 0, 'n'},
+		{"output", required_argument, 0, 'o'},
 		{"rpn", no_argument, 0, 'r'},
+		{"rpn-prog", required_argument, 0, 'R'},
+		{"stats", no_argument, 0, 's'},
+		{"serve", required_argument, 0, 'S'},
+		{"shm", required_argument, 0, 'Q'},
+		{"csv", required_argument, 0, 'x'},
+		{"jit", no_argument, 0, 'J'},
+		{"verify", no_argument, 0, 'V'},
+		{0, 0, 0, 0}
 	};
 
-	int ind = 0;
+	unsigned long num;
+	long ncpus;
+	bool rpnmode = false;
+	int ind = 0, fmt;
+	char *end;
 
 	/* Check if flags have been passed */
-	while ((ind = getopt_long(argc, argv, ":cefhnr", longopts, &ind)) != 1) {
+	while ((ind = getopt_long(argc, argv, ":BCEJQ:R:S:Vbce:fhj:no:rsx:", longopts, &ind)) != 1) {
 		switch (ind) {
 
+			/* Evaluate expressions exactly, with GMP */
+		case 'B':
+			ev.exact = true;
+#if HAVE_GMP
+			fprintf(stderr, "[Enabled arbitrary precision]\n");
+#else
+			fprintf(stderr, "[Enabled overflow checks "
+				"(built without GMP)]\n");
+#endif
+			break;
+
+			/* Don't cache results */
+		case 'C':
+			ev.usecache = false;
+			fprintf(stderr, "[Disabled cache]\n");
+			break;
+
+			/* Evaluate stdin line by line */
+		case 'b':
+			flags |= batchmode;
+			break;
+
 			/* Enter "just-calculator" mode */
 		case 'c':
 			flags |= justcalc;
@@ -405,12 +673,45 @@ main(int argc, char **argv)
 			fprintf(stderr, "[Enabled just-calculator mode]\n");
 			break;
 
+			/* Number of threads to use in batch or serve mode */
+		case 'j':
+			errno = 0;
+			num = strtoul(optarg, &end, 10);
+
+			if (end == optarg || *end != '\0' || errno != 0
+			    || num > MAX_JOBS) {
+				fprintf(stderr, "Error: jobs must be a number "
+					"between 0 and %d!\n", MAX_JOBS);
+				return 1;
+			}
+
+			/* One thread per CPU, as many as we can have */
+			if (num == 0) {
+				ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+				num = ncpus < 1 ? 1 : ncpus > MAX_JOBS
+				      ? MAX_JOBS : (unsigned long)ncpus;
+			}
+
+			jobs = num;
+			break;
+
 			/* Don't show examples when printing help */
-		case 'e':
+		case 'E':
 			flags &= ~showsamp;
 			fprintf(stderr, "[Disabled examples]\n");
 			break;
 
+			/* Evaluate an expression, and exit */
+		case 'e':
+			if (exprs == NULL
+			    && (exprs = malloc(argc * sizeof(*exprs))) == NULL) {
+				fprintf(stderr, "Error: unable to allocate "
+					"enough memory!\n");
+				return 1;
+			}
+			exprs[nexprs++] = optarg;
+			break;
+
 			/* Don't show flags when printing help */
 		case 'f':
 			flags &= ~showflags;
@@ -430,11 +731,55 @@ main(int argc, char **argv)
 			fprintf(stderr, "[Disabled colored output]\n");
 			break;
 
+			/* Write results in another base, or raw */
+		case 'o':
+			if ((fmt = fmt_lookup(optarg)) < 0) {
+				fprintf(stderr, "Error: output must be dec, "
+					"signed, hex, oct, bin or raw!\n");
+				return 1;
+			}
+			out_fmt = fmt;
+			break;
+
 			/* Enter rpn mode */
 		case 'r':
-			fprintf(stderr,
-				"[Entered RPN mode (exit with CTRL+D)]\n");
-			rpnInit();
+			rpnmode = true;
+			break;
+
+			/* Run RPN over lines of values */
+		case 'R':
+			rpnsrc = optarg;
+			break;
+
+			/* Count what each evaluation takes */
+		case 's':
+			ev.usestats = true;
+			fprintf(stderr, "[Enabled stats]\n");
+			break;
+
+			/* Serve clients of a Unix socket */
+		case 'S':
+			sockpath = optarg;
+			break;
+
+			/* Answer a client through shared memory */
+		case 'Q':
+			shmname = optarg;
+			break;
+
+			/* Evaluate an expression over CSV rows */
+		case 'x':
+			csvexpr = optarg;
+			break;
+
+			/* Compile the CSV expression to machine code */
+		case 'J':
+			csvopts |= COLUMNS_JIT;
+			break;
+
+			/* Check CSV results against solve() */
+		case 'V':
+			csvopts |= COLUMNS_VERIFY;
 			break;
 		}
 
@@ -442,29 +787,209 @@ main(int argc, char **argv)
 			break;
 	}
 
+	/* Exact results are only written in decimal, with their sign,
+	 * and the answers of serve mode are lines */
+	if (out_fmt != FMT_DEC && out_fmt != FMT_SIGNED && ev.exact) {
+		fprintf(stderr, "Error: -B only writes decimal results!\n");
+		cleanup();
+		return 1;
+	}
+
+	if (out_fmt == FMT_RAW && sockpath != NULL) {
+		fprintf(stderr, "Error: -S can't write raw results!\n");
+		cleanup();
+		return 1;
+	}
+
+	/* CSV, shared-memory and RPN mode only work on 64-bit words
+	 * and doubles: they would wrap instead of being exact */
+	if (ev.exact && (csvexpr != NULL || shmname != NULL
+			 || rpnsrc != NULL || rpnmode)) {
+		fprintf(stderr, "Error: -B doesn't work with -x, -Q, "
+			"-r or -R!\n");
+		cleanup();
+		return 1;
+	}
+
+	/* Enter RPN mode, once every other flag has been read */
+	if (rpnmode) {
+		int status;
+
+		fprintf(stderr, "[Entered RPN mode (exit with CTRL+D)]\n");
+		status = rpnInit();
+		cleanup();
+		return status;
+	}
+
+	/* Print the results of the expressions given with -e, without
+	 * looking at stdin, nor at the terminal */
+	if (exprs != NULL) {
+		int status;
+
+		if (optind < argc) {
+			fprintf(stderr, "Error: -e doesn't take files!\n");
+			free(exprs);
+			cleanup();
+			return 1;
+		}
+
+		status = batch_args(&ev, exprs, nexprs, STDOUT_FILENO);
+
+		if (ev.usestats)
+			stats_print(stderr, "Stats", &ev.total);
+
+		free(exprs);
+		cleanup();
+		return status;
+	}
+
+	/* Evaluate an expression over the CSV files given after
+	 * the flags, or over stdin */
+	if (csvexpr != NULL) {
+		int status = 0, fd;
+
+		if (optind == argc)
+			status = columns(&ev.arena, &ev.prog, csvexpr,
+					 STDIN_FILENO, STDOUT_FILENO, csvopts);
+
+		for (int i = optind; i < argc; i++) {
+			if (strcmp(argv[i], "-") == 0)
+				fd = STDIN_FILENO;
+			else if ((fd = open(argv[i], O_RDONLY)) < 0) {
+				perror(argv[i]);
+				status = 1;
+				continue;
+			}
+
+			status |= columns(&ev.arena, &ev.prog, csvexpr, fd,
+					  STDOUT_FILENO, csvopts);
+
+			if (fd != STDIN_FILENO)
+				close(fd);
+		}
+
+		cleanup();
+		return status;
+	}
+
+	/* Compile RPN once, and run it over every line of the files
+	 * given after the flags, or of stdin */
+	if (rpnsrc != NULL) {
+		struct rpn_prog prog = { 0 };
+		int status = 0, fd;
+
+		if (!rpn_compile(&prog, rpnsrc)) {
+			fprintf(stderr, "RPN: %s\n", prog.err);
+			rpn_prog_free(&prog);
+			cleanup();
+			return 1;
+		}
+
+		if (optind == argc)
+			status = rpn_run(&prog, STDIN_FILENO, STDOUT_FILENO);
+
+		for (int i = optind; i < argc; i++) {
+			if (strcmp(argv[i], "-") == 0)
+				fd = STDIN_FILENO;
+			else if ((fd = open(argv[i], O_RDONLY)) < 0) {
+				perror(argv[i]);
+				status = 1;
+				continue;
+			}
+
+			status |= rpn_run(&prog, fd, STDOUT_FILENO);
+
+			if (fd != STDIN_FILENO)
+				close(fd);
+		}
+
+		rpn_prog_free(&prog);
+		cleanup();
+		return status;
+	}
+
+	/* Answer clients until stopped */
+	if (sockpath != NULL) {
+		int status = serve(&ev, sockpath, jobs);
+
+		if (ev.usestats)
+			stats_print(stderr, "Stats", &ev.total);
+
+		cleanup();
+		return status;
+	}
+
+	/* Answer a client through shared memory, until stopped */
+	if (shmname != NULL) {
+		int status = shm_serve(&ev, shmname);
+
+		if (ev.usestats)
+			stats_print(stderr, "Stats", &ev.total);
+
+		cleanup();
+		return status;
+	}
+
+	/* Evaluate the files given after the flags; "-" is stdin */
+	if (optind < argc) {
+		int status = 0;
+
+		for (int i = optind; i < argc; i++) {
+			if (strcmp(argv[i], "-") == 0)
+				status |= batch(&ev, STDIN_FILENO,
+						STDOUT_FILENO, jobs);
+			else
+				status |= batch_file(&ev, argv[i],
+						     STDOUT_FILENO, jobs);
+		}
+
+		if (ev.usestats)
+			stats_print(stderr, "Stats", &ev.total);
+
+		cleanup();
+		return status;
+	}
+
+	/* Evaluate stdin without readline, if asked to,
+	 * or if it isn't a terminal */
+	if ((flags & batchmode) || !isatty(STDIN_FILENO)) {
+		int status = batch(&ev, STDIN_FILENO, STDOUT_FILENO, jobs);
+
+		if (ev.usestats)
+			stats_print(stderr, "Stats", &ev.total);
+
+		cleanup();
+		return status;
+	}
+
 	/* Print program info */
 	printHelp();
 
+	/* Handle signals */
+	signal(SIGABRT, sigHandler);
+	signal(SIGFPE, sigHandler);
+	signal(SIGILL, sigHandler);
+	/* CTRL+C */
+	signal(SIGINT, sigHandler);
+	/* CTRL+D */
+	signal(SIGSEGV, sigHandler);
+	signal(SIGTERM, sigHandler);
+
 	/* Run indefinitely */
 	for (;;) {
-
-		/* Handle signals */
-		signal(SIGABRT, sigHandler);
-		signal(SIGFPE, sigHandler);
-		signal(SIGILL, sigHandler);
-		/* CTRL+C */
-		signal(SIGINT, sigHandler);
-		/* CTRL+D */
-		signal(SIGSEGV, sigHandler);
-		signal(SIGTERM, sigHandler);
-
 		/* Ask user input */
 		char *input;
 
 		if ((flags & usecolor) != 0)
-			input = readline("\e[1;4mcalc>\e[0m ");
+			input = prompt("\e[1;4mcalc>\e[0m ");
 		else
-			input = readline("calc>\e[0m ");
+			input = prompt("calc>\e[0m ");
+
+		/* Exit gracefully on EOF (CTRL+D) */
+		if (input == NULL) {
+			putchar('\n');
+			break;
+		}
 
 		/* Parse the input */
 		parseInput(input);
@@ -473,6 +998,6 @@ main(int argc, char **argv)
 		free(input);
 	}
 
-	/* If this point is somehow reached, exit gracefully */
+	cleanup();
 	return 0;
 }
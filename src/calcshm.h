@@ -0,0 +1,357 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, calcshm.h, lets a program talk to "calc -Q NAME"
+ * through POSIX shared memory, without any system call: requests
+ * and answers go through two rings in the region calc creates,
+ * and both sides busy-poll them.
+ *
+ * Each region has a single client, which writes requests, and
+ * calc, which answers them, in order: the answer to a request is
+ * always in the slot with the same index in the answer ring, so
+ * each ring only needs the index its writer publishes. A request
+ * is either an expression, evaluated like any other, or, after
+ * compiling an expression once with calcshm_compile(), the ID
+ * calc gave it and the values of the variables a to h it uses.
+ *
+ * Pollers spin for a while, then yield the CPU, and, if nothing
+ * happens for long, sleep between polls. With a single CPU,
+ * spinning would only delay the other side, so they yield at once.
+ *
+ * This header only depends on libc, and on the atomic builtins of
+ * GCC and Clang; define _POSIX_C_SOURCE as 200809L before including
+ * it, and link with -lrt on older systems.
+ *
+ * Usage:
+ * struct calcshm_client c;
+ * struct calcshm_resp r;
+ * calcshm_attach(&c, "/calc");
+ * calcshm_compile(&c, "a * 3 + b", 9);
+ * calcshm_wait(&c, &r);			r.val is the ID
+ * calcshm_run(&c, r.val, (uint64_t[]){ 1, 2 }, 2);
+ * calcshm_wait(&c, &r);			r.val is 5
+ * calcshm_detach(&c);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef CALCSHM_H
+#define CALCSHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CALCSHM_MAGIC 0x6d68736361636c01ULL	/* Layout version 1 */
+#define CALCSHM_SLOTS 1024	/* Entries of each ring, a power of two */
+#define CALCSHM_ARGS 8		/* Variables of compiled expressions, a to h */
+#define CALCSHM_EXPR 184	/* Longest expression */
+#define CALCSHM_ERR 112		/* Longest error message, with its NUL */
+#define CALCSHM_SPIN 4096	/* Polls spent spinning */
+#define CALCSHM_YIELD 65536	/* Polls spent yielding, before sleeping */
+
+/* Kinds of requests */
+enum calcshm_kind {
+	CALCSHM_EVAL,		/* Evaluate expr */
+	CALCSHM_COMPILE,	/* Compile expr, and answer with its ID */
+	CALCSHM_RUN,		/* Run the compiled expression len on args */
+};
+
+/* What an answer holds */
+enum calcshm_status {
+	CALCSHM_INT,		/* val is an unsigned integer */
+	CALCSHM_FLOAT,		/* val holds the bits of a double */
+	CALCSHM_ID,		/* val is the ID of a compiled expression */
+	CALCSHM_BLANK,		/* expr was blank */
+	CALCSHM_ERROR,		/* err says why expr failed */
+};
+
+/* Request, 256 bytes */
+struct calcshm_req {
+	uint32_t kind;		/* enum calcshm_kind */
+	uint32_t len;		/* Bytes of expr, or ID to run */
+	uint64_t args[CALCSHM_ARGS];	/* Values of a to h */
+	char expr[CALCSHM_EXPR];
+};
+
+/* Answer, 128 bytes */
+struct calcshm_resp {
+	uint32_t status;	/* enum calcshm_status */
+	uint32_t pad;
+	uint64_t val;
+	char err[CALCSHM_ERR];
+};
+
+/* Shared region. The indices are on cache lines of their own,
+ * so that each side only writes to lines the other reads. */
+struct calcshm {
+	uint64_t magic;		/* CALCSHM_MAGIC, once calc is ready */
+	uint32_t closed;	/* Has calc stopped answering? */
+	int32_t pid;		/* calc's process ID */
+	char pad0[48];
+	uint64_t req_head;	/* Requests written by the client */
+	char pad1[56];
+	uint64_t resp_head;	/* Answers written by calc */
+	char pad2[56];
+	struct calcshm_req req[CALCSHM_SLOTS];
+	struct calcshm_resp resp[CALCSHM_SLOTS];
+};
+
+/* Client state */
+struct calcshm_client {
+	struct calcshm *shm;
+	uint64_t head;		/* Requests sent */
+	uint64_t tail;		/* Answers read */
+	uint64_t ready;		/* Answers calc wrote, last we looked */
+	uint32_t spin;		/* Polls spent spinning */
+};
+
+/* Function prototypes */
+static inline void calcshm_relax(void);
+static inline void calcshm_idle(uint64_t *, uint32_t);
+static inline uint32_t calcshm_spin(void);
+static inline bool calcshm_alive(const struct calcshm *);
+static inline int calcshm_attach(struct calcshm_client *, const char *);
+static inline void calcshm_detach(struct calcshm_client *);
+static inline struct calcshm_req *calcshm_slot(struct calcshm_client *);
+static inline bool calcshm_send(struct calcshm_client *, uint32_t,
+				const char *, size_t);
+static inline bool calcshm_eval(struct calcshm_client *, const char *,
+				size_t);
+static inline bool calcshm_compile(struct calcshm_client *, const char *,
+				   size_t);
+static inline bool calcshm_run(struct calcshm_client *, uint32_t,
+			       const uint64_t *, unsigned int);
+static inline bool calcshm_poll(struct calcshm_client *,
+				struct calcshm_resp *);
+static inline bool calcshm_wait(struct calcshm_client *,
+				struct calcshm_resp *);
+static inline double calcshm_double(const struct calcshm_resp *);
+
+/* Tell the CPU we're spinning */
+static inline void
+calcshm_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/* Wait a little before polling again; *idle counts the polls
+ * that found nothing, of which the first spin are spent spinning */
+static inline void
+calcshm_idle(uint64_t *idle, uint32_t spin)
+{
+	struct timespec ts = { 0, 50000 };
+
+	if (++*idle < spin)
+		calcshm_relax();
+	else if (*idle < spin + CALCSHM_YIELD)
+		sched_yield();
+	else
+		nanosleep(&ts, NULL);
+}
+
+/* Polls worth spinning for, before yielding */
+static inline uint32_t
+calcshm_spin(void)
+{
+	return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? CALCSHM_SPIN : 0;
+}
+
+/* Is calc still answering on the region? */
+static inline bool
+calcshm_alive(const struct calcshm *shm)
+{
+	if (__atomic_load_n(&shm->closed, __ATOMIC_ACQUIRE))
+		return false;
+
+	/* calc may have been killed before it could say so */
+	return kill(shm->pid, 0) == 0 || errno != ESRCH;
+}
+
+/* Attach to the region calc created with the given name, waiting
+ * for the answers a previous client may have left behind.
+ * Returns 0, or -1 with errno set (ENOENT: calc isn't ready yet). */
+static inline int
+calcshm_attach(struct calcshm_client *c, const char *name)
+{
+	struct calcshm *shm;
+	uint64_t idle = 0;
+	int fd;
+
+	memset(c, 0, sizeof(*c));
+
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0)
+		return -1;
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+
+	if (shm == MAP_FAILED)
+		return -1;
+
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != CALCSHM_MAGIC
+	    || !calcshm_alive(shm)) {
+		munmap(shm, sizeof(*shm));
+		errno = ENOENT;
+		return -1;
+	}
+
+	c->shm = shm;
+	c->spin = calcshm_spin();
+	c->head = c->tail = shm->req_head;
+
+	while ((c->ready = __atomic_load_n(&shm->resp_head,
+					   __ATOMIC_ACQUIRE)) != c->head) {
+		if (!calcshm_alive(shm)) {
+			calcshm_detach(c);
+			errno = ENOENT;
+			return -1;
+		}
+
+		calcshm_idle(&idle, c->spin);
+	}
+
+	return 0;
+}
+
+/* Detach from the region; calc keeps running */
+static inline void
+calcshm_detach(struct calcshm_client *c)
+{
+	if (c->shm != NULL)
+		munmap(c->shm, sizeof(*c->shm));
+
+	c->shm = NULL;
+}
+
+/* Slot of the next request, or NULL if CALCSHM_SLOTS
+ * requests are waiting to be answered or read */
+static inline struct calcshm_req *
+calcshm_slot(struct calcshm_client *c)
+{
+	if (c->head - c->tail >= CALCSHM_SLOTS)
+		return NULL;
+
+	return &c->shm->req[c->head & (CALCSHM_SLOTS - 1)];
+}
+
+/* Send a request holding an expression */
+static inline bool
+calcshm_send(struct calcshm_client *c, uint32_t kind, const char *expr,
+	     size_t len)
+{
+	struct calcshm_req *r;
+
+	if (len > CALCSHM_EXPR || (r = calcshm_slot(c)) == NULL)
+		return false;
+
+	r->kind = kind;
+	r->len = len;
+	memcpy(r->expr, expr, len);
+	__atomic_store_n(&c->shm->req_head, ++c->head, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Ask for len bytes of expr to be evaluated.
+ * Returns false if the ring is full, or expr is too long. */
+static inline bool
+calcshm_eval(struct calcshm_client *c, const char *expr, size_t len)
+{
+	return calcshm_send(c, CALCSHM_EVAL, expr, len);
+}
+
+/* Ask for len bytes of expr, which may use the variables a to h,
+ * to be compiled; the answer holds its ID, or why it failed.
+ * Returns false if the ring is full, or expr is too long. */
+static inline bool
+calcshm_compile(struct calcshm_client *c, const char *expr, size_t len)
+{
+	return calcshm_send(c, CALCSHM_COMPILE, expr, len);
+}
+
+/* Ask for the compiled expression id to be run, with its variables,
+ * from a on, set to the nargs values of args; the others are 0.
+ * Returns false if the ring is full, or nargs too large. */
+static inline bool
+calcshm_run(struct calcshm_client *c, uint32_t id, const uint64_t *args,
+	    unsigned int nargs)
+{
+	struct calcshm_req *r;
+
+	if (nargs > CALCSHM_ARGS || (r = calcshm_slot(c)) == NULL)
+		return false;
+
+	r->kind = CALCSHM_RUN;
+	r->len = id;
+	memcpy(r->args, args, nargs * sizeof(*args));
+	memset(r->args + nargs, 0, (CALCSHM_ARGS - nargs) * sizeof(*args));
+	__atomic_store_n(&c->shm->req_head, ++c->head, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Copy the next answer to *resp, if there is one yet */
+static inline bool
+calcshm_poll(struct calcshm_client *c, struct calcshm_resp *resp)
+{
+	if (c->tail == c->head)
+		return false;
+
+	/* Only look at calc's index once we've read every answer
+	 * it already published */
+	if (c->tail == c->ready) {
+		c->ready = __atomic_load_n(&c->shm->resp_head,
+					   __ATOMIC_ACQUIRE);
+
+		if (c->tail == c->ready)
+			return false;
+	}
+
+	*resp = c->shm->resp[c->tail++ & (CALCSHM_SLOTS - 1)];
+	return true;
+}
+
+/* Wait for the next answer, and copy it to *resp.
+ * Returns false if no request is waiting, or calc stopped. */
+static inline bool
+calcshm_wait(struct calcshm_client *c, struct calcshm_resp *resp)
+{
+	uint64_t idle = 0;
+
+	while (!calcshm_poll(c, resp)) {
+		if (c->tail == c->head
+		    || __atomic_load_n(&c->shm->closed, __ATOMIC_ACQUIRE))
+			return false;
+
+		/* Only look for calc itself once we're sleeping */
+		if (idle >= c->spin + CALCSHM_YIELD && !calcshm_alive(c->shm))
+			return false;
+
+		calcshm_idle(&idle, c->spin);
+	}
+
+	return true;
+}
+
+/* Value of a CALCSHM_FLOAT answer */
+static inline double
+calcshm_double(const struct calcshm_resp *resp)
+{
+	double d;
+
+	memcpy(&d, &resp->val, sizeof(d));
+	return d;
+}
+
+#endif
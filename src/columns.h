@@ -0,0 +1,860 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, columns.h, evaluates a single expression over
+ * every row of a CSV file, whose first line names the columns:
+ * names used in the expression refer to the value of that column
+ * in the current row. Cells are integers, separated by commas;
+ * quoted cells are not supported.
+ *
+ * The expression is parsed and compiled once. Rows are then
+ * loaded COLUMN_BATCH at a time into one array per column, and
+ * the bytecode is run over whole arrays instead of single values,
+ * so every instruction is dispatched once per batch, and its loop
+ * can be vectorised. On x86-64, the kernels are also built for
+ * AVX2, and the best version is picked at run time.
+ * Expressions using special values or functions such as sqrt are
+ * run on doubles instead, by a second kernel, which calls the
+ * array versions of the functions of mathfn.h.
+ *
+ * With COLUMNS_JIT, the expression is instead translated into
+ * machine code by jit.h, and run once per row. With
+ * COLUMNS_VERIFY, every result is checked against solve(), or,
+ * for doubles, against run_float().
+ *
+ * One result is written per row, under a "result" header.
+ * Rows that can't be evaluated are reported on stderr, along
+ * with their line number, and leave an empty line behind.
+ * Raw results (see format.h) have neither the header nor the
+ * empty lines.
+ *
+ * Usage:
+ * int status = columns(&arena, &prog, "(a * 3 + b) % 7",
+ * 			STDIN_FILENO, STDOUT_FILENO, 0);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "batch.h"
+#include "jit.h"
+#include "parse.h"
+#include "vm.h"
+
+#define COLUMN_BATCH 256	/* Rows evaluated at once */
+
+/* Options of columns() */
+#define COLUMNS_JIT	(1 << 0)	/* Run as machine code */
+#define COLUMNS_VERIFY	(1 << 1)	/* Check results with solve() */
+
+/* Reasons a row couldn't be evaluated:
+ * an ARITH_* error, or one of these */
+enum {
+	ROW_OK = ARITH_OK,
+	ROW_BAD_CELL = ARITH_LAST + 1,	/* A cell isn't a number */
+	ROW_NOT_INTEGER			/* powmod got a double */
+};
+
+/* Columnar evaluation state */
+struct columns {
+	struct arena *arena;	/* Used to parse the expression and cells */
+	struct program *prog;	/* Compiled expression */
+	struct jit jit;		/* Translated expression */
+	unsigned int opts;	/* COLUMNS_* options */
+	uint32_t root;		/* Root of the AST, for solve() */
+	char **names;		/* Column names, from the header */
+	uint32_t ncols;
+	bool *used;		/* Is the column used by the expression? */
+	uint64_t *vals;		/* Cells of this batch, by column */
+	uint64_t *stack;	/* Value stack, one array per entry */
+	uint64_t *row;		/* Cells of a single row */
+	uint8_t bad[COLUMN_BATCH];	/* Why each row failed, or ROW_OK */
+	char errs[COLUMN_BATCH][ERR_SIZE];	/* Messages of bad cells */
+	uint64_t lines[COLUMN_BATCH];	/* Line number of each row */
+	uint32_t rows;		/* Rows loaded in this batch */
+	bool floating;		/* Is the expression run on doubles? */
+	bool failed;		/* Couldn't some row be evaluated? */
+};
+
+/* Function prototypes */
+static inline bool columns_header(struct columns *, const char *, size_t);
+static inline bool columns_compile(struct columns *, const char *);
+static inline bool columns_cell(struct columns *, const char *, size_t,
+				uint64_t *);
+static inline void columns_row(struct columns *, const char *, size_t,
+			       uint64_t);
+static inline void row_fail(uint8_t *, int);
+static inline void columns_kernel(const uint8_t *, const uint64_t *,
+				  const uint64_t *, uint64_t *, uint8_t *);
+static inline void columns_fkernel(const uint8_t *, const uint64_t *,
+				   const uint64_t *, double *, uint8_t *);
+static inline void columns_gather(struct columns *, uint32_t);
+static inline void columns_verify(struct columns *, const uint8_t *);
+static inline void columns_fverify(struct columns *, const uint8_t *);
+static inline bool columns_flush(struct columns *, struct outbuf *, int);
+static inline void columns_free(struct columns *);
+int columns(struct arena *, struct program *, const char *, int, int,
+	    unsigned int);
+
+/* Split the header line into column names */
+static inline bool
+columns_header(struct columns *c, const char *line, size_t len)
+{
+	const char *end = line + len, *comma;
+	size_t n;
+
+	for (;;) {
+		if ((comma = memchr(line, ',', end - line)) == NULL)
+			comma = end;
+
+		/* Trim spaces around the name */
+		while (line < comma && (*line == ' ' || *line == '\t'))
+			line++;
+		for (n = comma - line; n > 0 && (line[n - 1] == ' '
+						 || line[n - 1] == '\t'); n--)
+			;
+
+		char **p = realloc(c->names, (c->ncols + 1) * sizeof(*p));
+
+		if (p == NULL)
+			return false;
+		c->names = p;
+
+		if ((c->names[c->ncols] = malloc(n + 1)) == NULL)
+			return false;
+
+		memcpy(c->names[c->ncols], line, n);
+		c->names[c->ncols++][n] = '\0';
+
+		if (comma == end)
+			return true;
+
+		line = comma + 1;
+	}
+}
+
+/* Parse a cell, with an optional sign, into *val.
+ * On error, a message is left in c->arena->err. */
+static inline bool
+columns_cell(struct columns *c, const char *cell, size_t len, uint64_t *val)
+{
+	size_t i = 0, end;
+	NODE_TYPE type;
+	bool neg = false;
+
+	while (i < len && (cell[i] == ' ' || cell[i] == '\t'))
+		i++;
+	while (len > i && (cell[len - 1] == ' ' || cell[len - 1] == '\t'))
+		len--;
+
+	if (i < len && (cell[i] == '-' || cell[i] == '+'))
+		neg = cell[i++] == '-';
+
+	if (i == len || cell[i] < '0' || cell[i] > '9') {
+		arena_error(c->arena, "Invalid number: \"%.*s\"",
+			    (int)(len > 20 ? 20 : len), cell);
+		return false;
+	}
+
+	if ((end = lex_number(c->arena, cell, len, i, &type, val)) == 0)
+		return false;
+
+	if (end != len) {
+		arena_error(c->arena, "Invalid number: \"%.*s\"",
+			    (int)(len > 20 ? 20 : len), cell);
+		return false;
+	}
+
+	if (neg)
+		*val = 0 - *val;
+
+	return true;
+}
+
+/* Load the cells of a row into the next lane of the batch */
+static inline void
+columns_row(struct columns *c, const char *line, size_t len, uint64_t lineno)
+{
+	const char *end = line + len, *comma;
+	uint32_t lane = c->rows++;
+
+	c->bad[lane] = ROW_OK;
+	c->lines[lane] = lineno;
+
+	for (uint32_t col = 0; col < c->ncols; col++) {
+		if (line > end) {
+			if (c->used[col] && c->bad[lane] == ROW_OK) {
+				snprintf(c->errs[lane], ERR_SIZE,
+					 "Missing column \"%s\"",
+					 c->names[col]);
+				c->bad[lane] = ROW_BAD_CELL;
+			}
+			continue;
+		}
+
+		if ((comma = memchr(line, ',', end - line)) == NULL)
+			comma = end;
+
+		if (c->used[col] && c->bad[lane] == ROW_OK
+		    && !columns_cell(c, line, comma - line,
+				     &c->vals[col * COLUMN_BATCH + lane])) {
+			memcpy(c->errs[lane], c->arena->err, ERR_SIZE);
+			c->bad[lane] = ROW_BAD_CELL;
+		}
+
+		line = comma + 1;
+	}
+}
+
+/* Record why a row failed, unless it already has: later operators
+ * still run on it, but the other evaluators stop at the first error */
+static inline void
+row_fail(uint8_t *bad, int status)
+{
+	if (*bad == ROW_OK)
+		*bad = status;
+}
+
+/* Run the program over COLUMN_BATCH rows at once.
+ * Every lane is computed, even past the last loaded row,
+ * so that the loops have a constant trip count. */
+SIMD_CLONES static inline void
+columns_kernel(const uint8_t *pc, const uint64_t *k, const uint64_t *vals,
+	       uint64_t *stack, uint8_t *bad)
+{
+	uint64_t *x = stack, *y = stack, *z;
+	uint32_t sp = 0, i;
+	uint8_t op;
+	int s;
+
+/* Array holding the nth entry from the top of the stack */
+#define TOP(n)	(stack + (size_t)(sp - (n)) * COLUMN_BATCH)
+
+	for (;;) {
+		op = *pc++;
+
+		/* Binary operators pop b into y, and leave a op b in x */
+		if (op != OP_PUSH && op != OP_VAR && op != OP_NEG
+		    && op != OP_POWMOD && op != OP_FACT && op != OP_END) {
+			y = TOP(1);
+			x = TOP(2);
+			sp--;
+		}
+
+		switch (op) {
+		case OP_PUSH:
+			x = TOP(0);
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = *k;
+			k++;
+			sp++;
+			break;
+
+		case OP_VAR:
+			memcpy(TOP(0), vals + *k++ * COLUMN_BATCH,
+			       COLUMN_BATCH * sizeof(*vals));
+			sp++;
+			break;
+
+		case OP_ADD:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] += y[i];
+			break;
+
+		case OP_SUB:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] -= y[i];
+			break;
+
+		case OP_MUL:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] *= y[i];
+			break;
+
+		case OP_DIV:
+			/* There is no vector integer division */
+			for (i = 0; i < COLUMN_BATCH; i++) {
+				if (y[i] == 0) {
+					row_fail(&bad[i], ARITH_DIV_ZERO);
+					x[i] = 0;
+				} else
+					x[i] /= y[i];
+			}
+			break;
+
+		case OP_MOD:
+			for (i = 0; i < COLUMN_BATCH; i++) {
+				if (y[i] == 0) {
+					row_fail(&bad[i], ARITH_DIV_ZERO);
+					x[i] = 0;
+				} else
+					x[i] %= y[i];
+			}
+			break;
+
+		case OP_LSHIFT:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = y[i] < 64 ? x[i] << y[i] : 0;
+			break;
+
+		case OP_RSHIFT:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = y[i] < 64 ? x[i] >> y[i] : 0;
+			break;
+
+		case OP_POWER:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				if ((s = ipow(x[i], y[i], &x[i])) != ARITH_OK)
+					row_fail(&bad[i], s);
+			break;
+
+		case OP_NEG:
+			x = TOP(1);
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = 0 - x[i];
+			break;
+
+		case OP_POWMOD:
+			/* Base, exponent and modulus, from the bottom */
+			x = TOP(3);
+			y = TOP(2);
+			z = TOP(1);
+			for (i = 0; i < COLUMN_BATCH; i++)
+				if ((s = powmod(x[i], y[i], z[i], &x[i]))
+				    != ARITH_OK)
+					row_fail(&bad[i], s);
+			sp -= 2;
+			break;
+
+		case OP_FACT:
+			x = TOP(1);
+			for (i = 0; i < COLUMN_BATCH; i++)
+				if ((s = ifact(x[i], &x[i])) != ARITH_OK)
+					row_fail(&bad[i], s);
+			break;
+
+		case OP_END:
+			return;
+		}
+	}
+
+#undef TOP
+}
+
+/* Run the program over COLUMN_BATCH rows at once, on doubles,
+ * like columns_kernel(). Cells are taken as unsigned, as calc
+ * prints them. */
+SIMD_CLONES static inline void
+columns_fkernel(const uint8_t *pc, const uint64_t *k, const uint64_t *vals,
+		double *stack, uint8_t *bad)
+{
+	double *x = stack, *y = stack, *z;
+	const uint64_t *v;
+	uint64_t a, b, m;
+	uint32_t sp = 0, i;
+	uint8_t op;
+	int s;
+
+/* Array holding the nth entry from the top of the stack */
+#define TOP(n)	(stack + (size_t)(sp - (n)) * COLUMN_BATCH)
+
+	for (;;) {
+		op = *pc++;
+
+		/* Binary operators, OP_ADD to OP_POWER, pop b into y,
+		 * and leave a op b in x; functions work on x in place */
+		if (op >= OP_ADD && op <= OP_POWER) {
+			y = TOP(1);
+			x = TOP(2);
+			sp--;
+		} else if (op != OP_PUSH && op != OP_FPUSH && op != OP_VAR
+			   && op != OP_POWMOD && op != OP_END)
+			x = TOP(1);
+
+		switch (op) {
+		case OP_PUSH:
+			x = TOP(0);
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = (double)*k;
+			k++;
+			sp++;
+			break;
+
+		case OP_FPUSH:
+			x = TOP(0);
+			for (i = 0; i < COLUMN_BATCH; i++)
+				memcpy(&x[i], k, sizeof(*x));
+			k++;
+			sp++;
+			break;
+
+		case OP_VAR:
+			x = TOP(0);
+			v = vals + *k++ * COLUMN_BATCH;
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = (double)v[i];
+			sp++;
+			break;
+
+		case OP_ADD:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] += y[i];
+			break;
+
+		case OP_SUB:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] -= y[i];
+			break;
+
+		case OP_MUL:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] *= y[i];
+			break;
+
+		case OP_DIV:
+			for (i = 0; i < COLUMN_BATCH; i++) {
+				if (y[i] == 0)
+					row_fail(&bad[i], ARITH_DIV_ZERO);
+				x[i] /= y[i];
+			}
+			break;
+
+		case OP_MOD:
+			for (i = 0; i < COLUMN_BATCH; i++) {
+				if (y[i] == 0)
+					row_fail(&bad[i], ARITH_DIV_ZERO);
+				x[i] = fmod(x[i], y[i]);
+			}
+			break;
+
+		/* See run_float() */
+		case OP_LSHIFT:
+		case OP_RSHIFT:
+			for (i = 0; i < COLUMN_BATCH; i++) {
+				double n = y[i] > 4096 ? 4096
+					   : y[i] < -4096 ? -4096 : y[i];
+
+				x[i] = ldexp(x[i], op == OP_LSHIFT ? n : -n);
+			}
+			break;
+
+		case OP_POWER:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = pow(x[i], y[i]);
+			break;
+
+		case OP_NEG:
+			for (i = 0; i < COLUMN_BATCH; i++)
+				x[i] = -x[i];
+			break;
+
+		case OP_FACT:
+			for (i = 0; i < COLUMN_BATCH; i++) {
+				if (x[i] < 0)
+					row_fail(&bad[i], ARITH_NEGATIVE);
+				x[i] = tgamma(x[i] + 1);
+			}
+			break;
+
+		case OP_POWMOD:
+			x = TOP(3);
+			y = TOP(2);
+			z = TOP(1);
+			for (i = 0; i < COLUMN_BATCH; i++) {
+				if (!float_uint(x[i], &a)
+				    || !float_uint(y[i], &b)
+				    || !float_uint(z[i], &m))
+					row_fail(&bad[i], ROW_NOT_INTEGER);
+				else if ((s = powmod(a, b, m, &a)) != ARITH_OK)
+					row_fail(&bad[i], s);
+				else
+					x[i] = a;
+			}
+			sp -= 2;
+			break;
+
+		case OP_SQRT:
+			vec_sqrt(x, COLUMN_BATCH);
+			break;
+
+		case OP_LOG:
+			vec_log(x, COLUMN_BATCH);
+			break;
+
+		case OP_EXP:
+			vec_exp(x, COLUMN_BATCH);
+			break;
+
+		case OP_SIN:
+			vec_sin(x, COLUMN_BATCH);
+			break;
+
+		case OP_COS:
+			vec_cos(x, COLUMN_BATCH);
+			break;
+
+		case OP_END:
+			return;
+		}
+	}
+
+#undef TOP
+}
+
+/* Copy the cells of a row out of the columns */
+static inline void
+columns_gather(struct columns *c, uint32_t lane)
+{
+	for (uint32_t col = 0; col < c->ncols; col++)
+		if (c->used[col])
+			c->row[col] = c->vals[col * COLUMN_BATCH + lane];
+}
+
+/* Check the results of the loaded rows against solve() */
+static inline void
+columns_verify(struct columns *c, const uint8_t *bad)
+{
+	struct arena *a = c->arena;
+	uint64_t expect;
+	bool failed;
+
+	a->vals = c->row;
+
+	for (uint32_t i = 0; i < c->rows; i++) {
+		if (c->bad[i] != ROW_OK)
+			continue;
+
+		columns_gather(c, i);
+		a->err[0] = '\0';
+		expect = solve(a, c->root);
+		failed = a->err[0] != '\0';
+
+		/* Either may stop at a different error */
+		if (failed ? bad[i] != ROW_OK
+		    : bad[i] == ROW_OK && expect == c->stack[i])
+			continue;
+
+		if (failed)
+			fprintf(stderr, "line %" PRIu64 ": got %" PRIu64
+				", but solve() failed: %s\n", c->lines[i],
+				c->stack[i], a->err);
+		else if (bad[i] != ROW_OK)
+			fprintf(stderr, "line %" PRIu64 ": %s, but solve() "
+				"returned %" PRIu64 "\n", c->lines[i],
+				arith_error(bad[i]), expect);
+		else
+			fprintf(stderr, "line %" PRIu64 ": got %" PRIu64
+				", but solve() returned %" PRIu64 "\n",
+				c->lines[i], c->stack[i], expect);
+
+		c->failed = true;
+	}
+
+	a->vals = NULL;
+}
+
+/* Check the results of the loaded rows against run_float() */
+static inline void
+columns_fverify(struct columns *c, const uint8_t *bad)
+{
+	struct program *prog = c->prog;
+	double expect, got;
+	bool failed;
+
+	prog->vars = c->row;
+
+	for (uint32_t i = 0; i < c->rows; i++) {
+		if (c->bad[i] != ROW_OK)
+			continue;
+
+		columns_gather(c, i);
+		failed = !run_float(prog, &expect);
+		memcpy(&got, &c->stack[i], sizeof(got));
+
+		/* The kernel runs the same code, so results must be
+		 * identical, NaNs aside */
+		if (failed ? bad[i] != ROW_OK : bad[i] == ROW_OK
+		    && (memcmp(&expect, &got, sizeof(got)) == 0
+			|| (expect != expect && got != got)))
+			continue;
+
+		if (failed)
+			fprintf(stderr, "line %" PRIu64 ": got %.17g, but "
+				"run_float() failed: %s\n", c->lines[i], got,
+				prog->err);
+		else if (bad[i] != ROW_OK)
+			fprintf(stderr, "line %" PRIu64 ": row failed, but "
+				"run_float() returned %.17g\n", c->lines[i],
+				expect);
+		else
+			fprintf(stderr, "line %" PRIu64 ": got %.17g, but "
+				"run_float() returned %.17g\n", c->lines[i],
+				got, expect);
+
+		c->failed = true;
+	}
+
+	prog->vars = NULL;
+}
+
+/* Evaluate the rows loaded so far, and write out their results.
+ * Returns false if the results couldn't be written out. */
+static inline bool
+columns_flush(struct columns *c, struct outbuf *out, int fd)
+{
+	uint8_t bad[COLUMN_BATCH];
+
+	if (c->rows == 0)
+		return true;
+
+	memcpy(bad, c->bad, sizeof(bad));
+
+	if (c->opts & COLUMNS_JIT) {
+		for (uint32_t i = 0; i < c->rows; i++) {
+			if (c->bad[i] != ROW_OK)
+				continue;
+
+			columns_gather(c, i);
+			bad[i] = jit_run(&c->jit, c->row, &c->stack[i]);
+		}
+	} else if (c->floating)
+		columns_fkernel(c->prog->code, c->prog->consts, c->vals,
+				(double *)c->stack, bad);
+	else
+		columns_kernel(c->prog->code, c->prog->consts, c->vals,
+			       c->stack, bad);
+
+	if ((c->opts & COLUMNS_VERIFY) && c->floating)
+		columns_fverify(c, bad);
+	else if (c->opts & COLUMNS_VERIFY)
+		columns_verify(c, bad);
+
+	out->len = 0;
+
+	for (uint32_t i = 0; i < c->rows; i++) {
+		if (c->bad[i] == ROW_BAD_CELL)
+			fprintf(stderr, "line %" PRIu64 ": %s\n", c->lines[i],
+				c->errs[i]);
+		else if (bad[i] == ROW_NOT_INTEGER)
+			fprintf(stderr, "line %" PRIu64 ": Error: powmod "
+				"needs integers\n", c->lines[i]);
+		else if (bad[i] != ROW_OK)
+			fprintf(stderr, "line %" PRIu64 ": %s\n", c->lines[i],
+				arith_error(bad[i]));
+		else if (!(c->floating ? out_double(out, c->stack[i])
+			   : out_result(out, c->stack[i])))
+			goto nomem;
+		else
+			continue;
+
+		/* Keep the results in line with the rows, unless
+		 * they're raw, where a line would be garbage */
+		c->failed = true;
+		if (out_fmt == FMT_RAW)
+			continue;
+		if (!out_reserve(out, 1))
+			goto nomem;
+		out->buf[out->len++] = '\n';
+	}
+
+	c->rows = 0;
+
+	if (!write_all(fd, out->buf, out->len)) {
+		perror("write");
+		return false;
+	}
+
+	return true;
+
+ nomem:
+	fprintf(stderr, "Error: unable to allocate enough memory!\n");
+	return false;
+}
+
+/* Release the memory held by the columnar state */
+static inline void
+columns_free(struct columns *c)
+{
+	for (uint32_t i = 0; i < c->ncols; i++)
+		free(c->names[i]);
+
+	free(c->names);
+	free(c->used);
+	free(c->vals);
+	free(c->stack);
+	free(c->row);
+	jit_free(&c->jit);
+}
+
+/* Compile the expression, now that the header tells
+ * which names it may use.
+ * Returns false, after printing why, if it couldn't be compiled. */
+static inline bool
+columns_compile(struct columns *c, const char *expr)
+{
+	struct arena *a = c->arena;
+
+	a->vars = (const char *const *)c->names;
+	a->nvars = c->ncols;
+
+	if (!parse(a, expr, strlen(expr))) {
+		fprintf(stderr, "%s\n", a->err);
+		return false;
+	}
+
+	if (a->len == 0) {
+		fprintf(stderr, "Error: empty expression\n");
+		return false;
+	}
+
+	if ((c->root = build_ast(a)) == NO_NODE) {
+		fprintf(stderr, "%s\n", a->err);
+		return false;
+	}
+
+	if (!compile(c->prog, a, c->root)) {
+		fprintf(stderr, "%s\n", c->prog->err);
+		return false;
+	}
+
+	/* Only load the columns used by the expression */
+	c->used = calloc(c->ncols, sizeof(*c->used));
+	c->vals = calloc((size_t)c->ncols * COLUMN_BATCH, sizeof(*c->vals));
+	c->stack = calloc((size_t)c->prog->max_stack * COLUMN_BATCH,
+			  sizeof(*c->stack));
+	c->row = calloc(c->ncols, sizeof(*c->row));
+
+	if (c->used == NULL || c->vals == NULL || c->stack == NULL
+	    || c->row == NULL) {
+		fprintf(stderr, "Error: unable to allocate enough memory!\n");
+		return false;
+	}
+
+	for (uint32_t i = 0; i < a->len; i++)
+		if (a->type[i] == VAR)
+			c->used[a->value[i]] = true;
+
+	/* Fall back to the vector kernels if it can't be translated */
+	c->floating = a->floating;
+	if ((c->opts & COLUMNS_JIT) && c->floating) {
+		fprintf(stderr, "[JIT disabled: it only handles integers]\n");
+		c->opts &= ~COLUMNS_JIT;
+	} else if ((c->opts & COLUMNS_JIT)
+		   && !jit_compile(&c->jit, c->prog)) {
+		fprintf(stderr, "[JIT disabled: %s]\n", c->jit.err);
+		c->opts &= ~COLUMNS_JIT;
+	}
+
+	return true;
+}
+
+/* Evaluate expr over every row of the CSV read from in,
+ * writing the results to out, with the given COLUMNS_* options.
+ * Returns 0 if every row was evaluated, 1 otherwise. */
+int
+columns(struct arena *a, struct program *prog, const char *expr, int in,
+	int out, unsigned int opts)
+{
+	struct columns c = { .arena = a, .prog = prog, .opts = opts };
+	struct outbuf ib = { 0 }, ob = { 0 };
+	const char *line, *end, *nl;
+	uint64_t lineno = 0;
+	size_t n;
+	bool eof = false, header = true;
+
+	if (!out_reserve(&ib, BATCH_BUFSIZE))
+		goto nomem;
+
+	while (!eof) {
+		if (!fill(in, &ib, &eof))
+			goto fail;
+
+		line = ib.buf;
+		end = ib.buf + ib.len;
+
+		/* Only handle complete lines, unless we're done */
+		while (line < end) {
+			if ((nl = memchr(line, '\n', end - line)) == NULL) {
+				if (!eof)
+					break;
+				nl = end;
+			}
+
+			n = nl - line;
+			lineno++;
+
+			/* Accept DOS line endings */
+			if (n > 0 && line[n - 1] == '\r')
+				n--;
+
+			if (header) {
+				if (!columns_header(&c, line, n))
+					goto nomem;
+
+				if (!columns_compile(&c, expr))
+					goto fail;
+
+				if (out_fmt != FMT_RAW
+				    && !write_all(out, "result\n", 7)) {
+					perror("write");
+					goto fail;
+				}
+
+				header = false;
+			} else if (n > 0) {
+				/* Blank lines are skipped */
+				columns_row(&c, line, n, lineno);
+
+				if (c.rows == COLUMN_BATCH
+				    && !columns_flush(&c, &ob, out))
+					goto fail;
+			}
+
+			line = nl + 1;
+		}
+
+		/* Keep the incomplete last line for the next read */
+		ib.len = line < end ? end - line : 0;
+		memmove(ib.buf, line, ib.len);
+
+		/* A single line doesn't fit: make room for it */
+		if (ib.len == ib.cap && !out_reserve(&ib, ib.cap))
+			goto nomem;
+	}
+
+	if (header) {
+		fprintf(stderr, "Error: missing CSV header\n");
+		goto fail;
+	}
+
+	if (!columns_flush(&c, &ob, out))
+		goto fail;
+
+	goto done;
+
+ nomem:
+	fprintf(stderr, "Error: unable to allocate enough memory!\n");
+ fail:
+	c.failed = true;
+ done:
+	a->vars = NULL;
+	a->nvars = 0;
+
+	columns_free(&c);
+	free(ib.buf);
+	free(ob.buf);
+
+	return c.failed ? 1 : 0;
+}
+
+#endif
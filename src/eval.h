@@ -0,0 +1,297 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, eval.h, ties parse.h, vm.h and cache.h together:
+ * it evaluates a string using an evaluator, which holds all the
+ * state needed to do so. Evaluators don't share anything, so
+ * each thread can safely use its own.
+ *
+ * Usage:
+ * static struct evaluator ev = { .usecache = true };
+ * if (evaluate(&ev, str, strlen(str), &result))
+ * 	printf("%lu\n", result);
+ * else if (ev.err != NULL)
+ * 	fprintf(stderr, "%s\n", ev.err);
+ * evaluator_free(&ev);
+ *
+ * If the expression used a special value, such as Pi, it was
+ * evaluated in double precision: ev.floating is then set, and
+ * result holds the bits of a double.
+ *
+ * evaluate_big() evaluates a string exactly instead, leaving
+ * the result in ev.big (see bignum.h).
+ *
+ * If ev.usestats is set, ev.last counts what the last evaluation
+ * took, and ev.total what every one did (see stats.h).
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef EVAL_H
+#define EVAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bignum.h"
+#include "cache.h"
+#include "parse.h"
+#include "stats.h"
+#include "vm.h"
+
+/* Evaluator state */
+struct evaluator {
+	struct arena arena;	/* Tokens and AST of the last expression */
+	struct program prog;	/* Last compiled expression */
+	struct cache cache;	/* Results of recent expressions */
+	bool usecache;		/* Look up results in the cache? */
+	bool exact;		/* Use evaluate_big() instead of evaluate()? */
+	bool floating;		/* Is the last result a double? */
+	bool usestats;		/* Count what each evaluation takes? */
+	struct stats last;	/* What the last evaluation took */
+	struct stats total;	/* What every evaluation took */
+	struct bignum big;	/* Exact evaluator */
+	const char *err;	/* Last error message, NULL if none */
+};
+
+/* Function prototypes */
+static inline uint64_t evaluator_bytes(const struct evaluator *);
+static inline void stats_begin(struct evaluator *);
+static inline void stats_end(struct evaluator *, bool);
+static inline void eval_phase(struct evaluator *, enum stats_phase);
+static inline bool eval_word(struct evaluator *, const char *, size_t,
+			     uint64_t *);
+static inline bool eval_exact(struct evaluator *, const char *, size_t);
+bool evaluate(struct evaluator *, const char *, size_t, uint64_t *);
+bool evaluate_big(struct evaluator *, const char *, size_t);
+void evaluator_free(struct evaluator *);
+
+/* Bytes the evaluator has allocated, but for GMP's own */
+static inline uint64_t
+evaluator_bytes(const struct evaluator *ev)
+{
+	const struct arena *a = &ev->arena;
+	const struct program *p = &ev->prog;
+	uint64_t bytes = ev->cache.bytes + a->textcap;
+
+	bytes += (uint64_t)a->cap * (sizeof(*a->type) + sizeof(*a->value)
+				     + sizeof(*a->left) + sizeof(*a->right));
+	bytes += (uint64_t)p->cap * (sizeof(*p->code) + sizeof(*p->consts)
+				     + sizeof(*p->work));
+	bytes += (uint64_t)p->stack_cap * sizeof(*p->stack);
+	bytes += (uint64_t)ev->big.cap * (sizeof(*ev->big.small)
+					  + sizeof(*ev->big.isbig));
+#if HAVE_GMP
+	bytes += (uint64_t)ev->big.cap * sizeof(*ev->big.stack);
+#endif
+
+	return bytes;
+}
+
+/* Start counting what an evaluation takes */
+static inline void
+stats_begin(struct evaluator *ev)
+{
+	stats_start(&ev->last);
+	ev->last.bytes = evaluator_bytes(ev);
+}
+
+/* Finish counting, and add the counts to the total; ok is
+ * what the evaluation returned, and without building an AST,
+ * its result can only have come from the cache */
+static inline void
+stats_end(struct evaluator *ev, bool ok)
+{
+	ev->last.hits = ok && ev->last.builds == 0;
+	ev->last.tokens = ev->arena.len;
+	ev->last.bytes = evaluator_bytes(ev) - ev->last.bytes;
+
+	/* Blank lines aren't expressions */
+	if (ev->arena.len > 0 || ev->err != NULL)
+		stats_add(&ev->total, &ev->last);
+}
+
+/* Charge the time since the last phase to this one, if counting */
+static inline void
+eval_phase(struct evaluator *ev, enum stats_phase phase)
+{
+	if (ev->usestats)
+		stats_phase(&ev->last, phase);
+}
+
+/* evaluate(), without counting what it takes */
+static inline bool
+eval_word(struct evaluator *ev, const char *str, size_t len,
+	  uint64_t *result)
+{
+	uint32_t root;
+	double d;
+	bool ok;
+
+	ev->err = NULL;
+	ev->arena.exact = false;
+
+	ok = parse(&ev->arena, str, len);
+	eval_phase(ev, PHASE_PARSE);
+
+	if (!ok) {
+		ev->err = ev->arena.err;
+		return false;
+	}
+
+	if (ev->arena.len == 0)
+		return false;
+
+	/* Special values are part of the tokens, so the cache
+	 * can hold the bits of their results too */
+	ev->floating = ev->arena.floating;
+
+	/* Skip building the AST if we've seen this expression before */
+	if (ev->usecache) {
+		ok = cache_lookup(&ev->cache, &ev->arena, result);
+		eval_phase(ev, PHASE_CACHE);
+
+		if (ok)
+			return true;
+	}
+
+	root = build_ast(&ev->arena);
+	eval_phase(ev, PHASE_BUILD_AST);
+
+	if (root == NO_NODE) {
+		ev->err = ev->arena.err;
+		return false;
+	}
+
+	ok = compile(&ev->prog, &ev->arena, root);
+	eval_phase(ev, PHASE_COMPILE);
+
+	if (!ok) {
+		ev->err = ev->prog.err;
+		return false;
+	}
+
+	if (ev->floating) {
+		ok = run_float(&ev->prog, &d);
+		memcpy(result, &d, sizeof(d));
+	} else
+		ok = run(&ev->prog, result);
+
+	if (ev->usestats) {
+		stats_phase(&ev->last, PHASE_RUN);
+		ev->last.depth = program_depth(&ev->prog);
+	}
+
+	if (!ok) {
+		ev->err = ev->prog.err;
+		return false;
+	}
+
+	if (ev->usecache)
+		cache_store(&ev->cache, *result);
+
+	return true;
+}
+
+/* evaluate_big(), without counting what it takes */
+static inline bool
+eval_exact(struct evaluator *ev, const char *str, size_t len)
+{
+	uint32_t root;
+	bool ok;
+
+	ev->err = NULL;
+	ev->floating = false;
+	ev->arena.exact = true;
+
+	ok = parse(&ev->arena, str, len);
+	eval_phase(ev, PHASE_PARSE);
+
+	if (!ok) {
+		ev->err = ev->arena.err;
+		return false;
+	}
+
+	if (ev->arena.len == 0)
+		return false;
+
+	root = build_ast(&ev->arena);
+	eval_phase(ev, PHASE_BUILD_AST);
+
+	if (root == NO_NODE) {
+		ev->err = ev->arena.err;
+		return false;
+	}
+
+	ok = compile(&ev->prog, &ev->arena, root);
+	eval_phase(ev, PHASE_COMPILE);
+
+	if (!ok) {
+		ev->err = ev->prog.err;
+		return false;
+	}
+
+	ok = run_big(&ev->big, &ev->prog, &ev->arena);
+
+	if (ev->usestats) {
+		stats_phase(&ev->last, PHASE_RUN);
+		ev->last.depth = program_depth(&ev->prog);
+	}
+
+	if (!ok) {
+		ev->err = ev->big.err;
+		return false;
+	}
+
+	return true;
+}
+
+/* Evaluate len bytes of str, storing the result in *result,
+ * or the bits of a double, if ev->floating is set.
+ * Returns false if the expression couldn't be evaluated, with
+ * ev->err set, or if it was blank, with ev->err set to NULL. */
+bool
+evaluate(struct evaluator *ev, const char *str, size_t len, uint64_t *result)
+{
+	bool ok;
+
+	if (!ev->usestats)
+		return eval_word(ev, str, len, result);
+
+	stats_begin(ev);
+	ok = eval_word(ev, str, len, result);
+	stats_end(ev, ok);
+	return ok;
+}
+
+/* Evaluate len bytes of str exactly, leaving the result in
+ * ev->big: numbers are promoted to big integers as needed, or,
+ * without GMP, overflowing is an error.
+ * The cache only holds 64-bit results, so it isn't used.
+ * Returns false like evaluate() does. */
+bool
+evaluate_big(struct evaluator *ev, const char *str, size_t len)
+{
+	bool ok;
+
+	if (!ev->usestats)
+		return eval_exact(ev, str, len);
+
+	stats_begin(ev);
+	ok = eval_exact(ev, str, len);
+	stats_end(ev, ok);
+	return ok;
+}
+
+/* Release the memory held by an evaluator */
+void
+evaluator_free(struct evaluator *ev)
+{
+	arena_free(&ev->arena);
+	program_free(&ev->prog);
+	cache_free(&ev->cache);
+	big_free(&ev->big);
+}
+
+#endif
@@ -0,0 +1,566 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, format.h, writes results out as text, without going
+ * through printf(): integers in decimal, unsigned or signed, in
+ * hexadecimal, octal or binary, with the prefixes calc reads back
+ * (0x, 0o, 0b), or as 8 raw little-endian bytes; doubles with the
+ * fewest digits that read back as the same double.
+ *
+ * Decimal digits are counted without branches, from the position
+ * of the highest bit set, then written two at a time from a table,
+ * from the last one on; the sign is also written without a branch.
+ *
+ * Doubles go through Grisu2 (Florian Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers",
+ * PLDI 2010): the double, and the halfway points to its neighbours,
+ * are scaled by a cached power of ten into 64-bit integers, and
+ * digits are generated until they fall between the halfway points.
+ * What comes out always reads back as the same double, and is the
+ * shortest such string for all but about 0.1% of doubles, where it
+ * has a digit more. Digits are written like JavaScript does: in
+ * fixed notation from 1e-6 to 1e21, in exponent notation otherwise.
+ *
+ * Every function writes at most FMT_MAX bytes, without a NUL,
+ * and returns how many it wrote.
+ *
+ * Usage:
+ * char buf[FMT_MAX];
+ * size_t len = fmt_int(buf, result, FMT_HEX);
+ * len = fmt_double(buf, 0.1 + 0.2);		"0.30000000000000004"
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FMT_MAX 72		/* Most bytes written: "0b" and 64 digits */
+
+/* How integer results are written out */
+enum out_format {
+	FMT_DEC,		/* Unsigned decimal, as results are computed */
+	FMT_SIGNED,		/* Signed decimal, in two's complement */
+	FMT_HEX,		/* 0x, then hexadecimal digits */
+	FMT_OCT,		/* 0o, then octal digits */
+	FMT_BIN,		/* 0b, then binary digits */
+	FMT_RAW,		/* 8 bytes, little-endian, doubles too */
+};
+
+/* Number with a 64-bit significand: f * 2 ^ e */
+struct diyfp {
+	uint64_t f;
+	int e;
+};
+
+/* Cached power of ten: 10 ^ k is about f * 2 ^ e */
+struct cached_pow {
+	uint64_t f;
+	int e;
+	int k;
+};
+
+/* Every pair of decimal digits, from 00 to 99 */
+static const char fmt_pairs[201] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+/* Powers of ten that fit in 64 bits */
+static const uint64_t fmt_pow10[20] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+	1000000000, 10000000000, 100000000000, 1000000000000,
+	10000000000000, 100000000000000, 1000000000000000,
+	10000000000000000, 100000000000000000, 1000000000000000000,
+	10000000000000000000U,
+};
+
+/* 10 ^ k, for k from -300 to 324 in steps of 8, rounded to
+ * 64 bits: enough to bring any double within the range Grisu2
+ * works in (see fmt_cached()) */
+static const struct cached_pow fmt_cached_pows[] = {
+	{ 0xAB70FE17C79AC6CA, -1060, -300 },
+	{ 0xFF77B1FCBEBCDC4F, -1034, -292 },
+	{ 0xBE5691EF416BD60C, -1007, -284 },
+	{ 0x8DD01FAD907FFC3C, -980, -276 },
+	{ 0xD3515C2831559A83, -954, -268 },
+	{ 0x9D71AC8FADA6C9B5, -927, -260 },
+	{ 0xEA9C227723EE8BCB, -901, -252 },
+	{ 0xAECC49914078536D, -874, -244 },
+	{ 0x823C12795DB6CE57, -847, -236 },
+	{ 0xC21094364DFB5637, -821, -228 },
+	{ 0x9096EA6F3848984F, -794, -220 },
+	{ 0xD77485CB25823AC7, -768, -212 },
+	{ 0xA086CFCD97BF97F4, -741, -204 },
+	{ 0xEF340A98172AACE5, -715, -196 },
+	{ 0xB23867FB2A35B28E, -688, -188 },
+	{ 0x84C8D4DFD2C63F3B, -661, -180 },
+	{ 0xC5DD44271AD3CDBA, -635, -172 },
+	{ 0x936B9FCEBB25C996, -608, -164 },
+	{ 0xDBAC6C247D62A584, -582, -156 },
+	{ 0xA3AB66580D5FDAF6, -555, -148 },
+	{ 0xF3E2F893DEC3F126, -529, -140 },
+	{ 0xB5B5ADA8AAFF80B8, -502, -132 },
+	{ 0x87625F056C7C4A8B, -475, -124 },
+	{ 0xC9BCFF6034C13053, -449, -116 },
+	{ 0x964E858C91BA2655, -422, -108 },
+	{ 0xDFF9772470297EBD, -396, -100 },
+	{ 0xA6DFBD9FB8E5B88F, -369, -92 },
+	{ 0xF8A95FCF88747D94, -343, -84 },
+	{ 0xB94470938FA89BCF, -316, -76 },
+	{ 0x8A08F0F8BF0F156B, -289, -68 },
+	{ 0xCDB02555653131B6, -263, -60 },
+	{ 0x993FE2C6D07B7FAC, -236, -52 },
+	{ 0xE45C10C42A2B3B06, -210, -44 },
+	{ 0xAA242499697392D3, -183, -36 },
+	{ 0xFD87B5F28300CA0E, -157, -28 },
+	{ 0xBCE5086492111AEB, -130, -20 },
+	{ 0x8CBCCC096F5088CC, -103, -12 },
+	{ 0xD1B71758E219652C, -77, -4 },
+	{ 0x9C40000000000000, -50, 4 },
+	{ 0xE8D4A51000000000, -24, 12 },
+	{ 0xAD78EBC5AC620000, 3, 20 },
+	{ 0x813F3978F8940984, 30, 28 },
+	{ 0xC097CE7BC90715B3, 56, 36 },
+	{ 0x8F7E32CE7BEA5C70, 83, 44 },
+	{ 0xD5D238A4ABE98068, 109, 52 },
+	{ 0x9F4F2726179A2245, 136, 60 },
+	{ 0xED63A231D4C4FB27, 162, 68 },
+	{ 0xB0DE65388CC8ADA8, 189, 76 },
+	{ 0x83C7088E1AAB65DB, 216, 84 },
+	{ 0xC45D1DF942711D9A, 242, 92 },
+	{ 0x924D692CA61BE758, 269, 100 },
+	{ 0xDA01EE641A708DEA, 295, 108 },
+	{ 0xA26DA3999AEF774A, 322, 116 },
+	{ 0xF209787BB47D6B85, 348, 124 },
+	{ 0xB454E4A179DD1877, 375, 132 },
+	{ 0x865B86925B9BC5C2, 402, 140 },
+	{ 0xC83553C5C8965D3D, 428, 148 },
+	{ 0x952AB45CFA97A0B3, 455, 156 },
+	{ 0xDE469FBD99A05FE3, 481, 164 },
+	{ 0xA59BC234DB398C25, 508, 172 },
+	{ 0xF6C69A72A3989F5C, 534, 180 },
+	{ 0xB7DCBF5354E9BECE, 561, 188 },
+	{ 0x88FCF317F22241E2, 588, 196 },
+	{ 0xCC20CE9BD35C78A5, 614, 204 },
+	{ 0x98165AF37B2153DF, 641, 212 },
+	{ 0xE2A0B5DC971F303A, 667, 220 },
+	{ 0xA8D9D1535CE3B396, 694, 228 },
+	{ 0xFB9B7CD9A4A7443C, 720, 236 },
+	{ 0xBB764C4CA7A44410, 747, 244 },
+	{ 0x8BAB8EEFB6409C1A, 774, 252 },
+	{ 0xD01FEF10A657842C, 800, 260 },
+	{ 0x9B10A4E5E9913129, 827, 268 },
+	{ 0xE7109BFBA19C0C9D, 853, 276 },
+	{ 0xAC2820D9623BF429, 880, 284 },
+	{ 0x80444B5E7AA7CF85, 907, 292 },
+	{ 0xBF21E44003ACDD2D, 933, 300 },
+	{ 0x8E679C2F5E44FF8F, 960, 308 },
+	{ 0xD433179D9C8CB841, 986, 316 },
+	{ 0x9E19DB92B4E31BA9, 1013, 324 },
+};
+
+/* Function prototypes */
+static inline unsigned int fmt_ndigits(uint64_t);
+static inline size_t fmt_u64(char *, uint64_t);
+static inline size_t fmt_i64(char *, uint64_t);
+static inline size_t fmt_radix(char *, uint64_t, unsigned int);
+static inline size_t fmt_le64(char *, uint64_t);
+static inline size_t fmt_int(char *, uint64_t, enum out_format);
+static inline struct diyfp fmt_mul(struct diyfp, struct diyfp);
+static inline struct diyfp fmt_normalize(struct diyfp);
+static inline const struct cached_pow *fmt_cached(int);
+static inline void fmt_round(char *, size_t, uint64_t, uint64_t, uint64_t,
+			     uint64_t);
+static inline size_t fmt_digits(char *, int *, struct diyfp, struct diyfp,
+				struct diyfp);
+static inline size_t fmt_grisu(char *, int *, uint64_t);
+static inline size_t fmt_place(char *, size_t, int);
+static inline size_t fmt_double(char *, double);
+static inline int fmt_lookup(const char *);
+
+/* Decimal digits of v, from 1 to 20 */
+static inline unsigned int
+fmt_ndigits(uint64_t v)
+{
+	unsigned int bits;
+
+#ifdef __GNUC__
+	bits = 64 - __builtin_clzll(v | 1);
+#else
+	for (bits = 1; bits < 64 && (v >> bits) != 0; bits++)
+		;
+#endif
+
+	/* bits * log10(2) is, at most, one digit short; 0 has one */
+	bits = bits * 1233 >> 12;
+	return bits + ((v | 1) >= fmt_pow10[bits]);
+}
+
+/* Write v in decimal */
+static inline size_t
+fmt_u64(char *buf, uint64_t v)
+{
+	size_t len = fmt_ndigits(v);
+	char *p = buf + len;
+
+	while (v >= 100) {
+		const char *d = fmt_pairs + v % 100 * 2;
+
+		v /= 100;
+		*--p = d[1];
+		*--p = d[0];
+	}
+
+	if (v >= 10) {
+		*--p = fmt_pairs[v * 2 + 1];
+		*--p = fmt_pairs[v * 2];
+	} else
+		*--p = '0' + v;
+
+	return len;
+}
+
+/* Write v, taken as a signed integer, in decimal */
+static inline size_t
+fmt_i64(char *buf, uint64_t v)
+{
+	uint64_t neg = v >> 63, mask = 0 - neg;
+
+	/* The sign is overwritten by the first digit of positive v */
+	buf[0] = '-';
+	return neg + fmt_u64(buf + neg, (v ^ mask) - mask);
+}
+
+/* Write v in base 2 ^ shift (1, 3 or 4), after its prefix */
+static inline size_t
+fmt_radix(char *buf, uint64_t v, unsigned int shift)
+{
+	unsigned int bits = 1, len;
+	char *p;
+
+#ifdef __GNUC__
+	bits = 64 - __builtin_clzll(v | 1);
+#else
+	while (bits < 64 && (v >> bits) != 0)
+		bits++;
+#endif
+
+	len = (bits + shift - 1) / shift;
+	buf[0] = '0';
+	buf[1] = shift == 4 ? 'x' : shift == 3 ? 'o' : 'b';
+
+	for (p = buf + 2 + len; p > buf + 2; v >>= shift)
+		*--p = "0123456789abcdef"[v & ((1 << shift) - 1)];
+
+	return 2 + len;
+}
+
+/* Write the 8 bytes of v, from the lowest */
+static inline size_t
+fmt_le64(char *buf, uint64_t v)
+{
+	/* Compilers turn this into a single store on little-endian CPUs */
+	for (int i = 0; i < 8; i++)
+		buf[i] = (char)(v >> i * 8);
+
+	return 8;
+}
+
+/* Write an integer result the given way */
+static inline size_t
+fmt_int(char *buf, uint64_t v, enum out_format fmt)
+{
+	switch (fmt) {
+	case FMT_SIGNED:
+		return fmt_i64(buf, v);
+
+	case FMT_HEX:
+		return fmt_radix(buf, v, 4);
+
+	case FMT_OCT:
+		return fmt_radix(buf, v, 3);
+
+	case FMT_BIN:
+		return fmt_radix(buf, v, 1);
+
+	case FMT_RAW:
+		return fmt_le64(buf, v);
+
+	default:
+		return fmt_u64(buf, v);
+	}
+}
+
+/* x * y, rounded to the 64 highest bits of the product */
+static inline struct diyfp
+fmt_mul(struct diyfp x, struct diyfp y)
+{
+	struct diyfp r = { 0, x.e + y.e + 64 };
+
+#ifdef __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 uint128_t;
+	uint128_t p = (uint128_t)x.f * y.f;
+
+	r.f = (uint64_t)(p >> 64) + ((uint64_t)p >> 63);
+#else
+	uint64_t a = x.f >> 32, b = x.f & 0xFFFFFFFF;
+	uint64_t c = y.f >> 32, d = y.f & 0xFFFFFFFF;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t mid = (bd >> 32) + (ad & 0xFFFFFFFF) + (bc & 0xFFFFFFFF);
+
+	/* Round up if bit 63 of the low half is set */
+	mid += (uint64_t)1 << 31;
+	r.f = ac + (ad >> 32) + (bc >> 32) + (mid >> 32);
+#endif
+
+	return r;
+}
+
+/* Shift x left until its highest bit is set; x.f isn't 0 */
+static inline struct diyfp
+fmt_normalize(struct diyfp x)
+{
+	int shift;
+
+#ifdef __GNUC__
+	shift = __builtin_clzll(x.f);
+#else
+	for (shift = 0; !(x.f >> (63 - shift) & 1); shift++)
+		;
+#endif
+
+	x.f <<= shift;
+	x.e -= shift;
+	return x;
+}
+
+/* Cached power of ten that brings a normalized number with binary
+ * exponent e to one with an exponent from -60 to -32, so that its
+ * integer part fits in 32 bits */
+static inline const struct cached_pow *
+fmt_cached(int e)
+{
+	/* ceil((-61 - e) * log10(2)), as integers */
+	int f = -61 - e;
+	int k = f * 78913 / (1 << 18) + (f > 0);
+
+	return &fmt_cached_pows[(300 + k + 7) / 8];
+}
+
+/* Move the last digit of buf towards w, while the digits stay
+ * within the halfway points; rest is what's left of the upper one,
+ * after the digits, and ten one unit of the last digit */
+static inline void
+fmt_round(char *buf, size_t len, uint64_t dist, uint64_t delta,
+	  uint64_t rest, uint64_t ten)
+{
+	while (rest < dist && delta - rest >= ten
+	       && (rest + ten < dist || dist - rest > rest + ten - dist)) {
+		buf[len - 1]--;
+		rest += ten;
+	}
+}
+
+/* Generate the digits of the shortest number between lo and hi,
+ * the halfway points around w, scaled by the cached power, and
+ * rounded inwards. *exp is the decimal exponent of the last one. */
+static inline size_t
+fmt_digits(char *buf, int *exp, struct diyfp lo, struct diyfp w,
+	   struct diyfp hi)
+{
+	struct diyfp one = { (uint64_t)1 << -hi.e, hi.e };
+	uint64_t delta = hi.f - lo.f, dist = hi.f - w.f, rest, p2;
+	uint32_t p1 = (uint32_t)(hi.f >> -one.e), pow10 = 1000000000;
+	unsigned int n = 10;
+	size_t len = 0;
+
+	p2 = hi.f & (one.f - 1);
+
+	/* Digits of the integer part */
+	while (n > 1 && p1 < pow10) {
+		pow10 /= 10;
+		n--;
+	}
+
+	while (n > 0) {
+		buf[len++] = '0' + p1 / pow10;
+		p1 %= pow10;
+		n--;
+
+		rest = ((uint64_t)p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*exp += n;
+			fmt_round(buf, len, dist, delta, rest,
+				  (uint64_t)pow10 << -one.e);
+			return len;
+		}
+
+		pow10 /= 10;
+	}
+
+	/* Digits of the fractional part */
+	for (;;) {
+		p2 *= 10;
+		buf[len++] = '0' + (p2 >> -one.e);
+		p2 &= one.f - 1;
+		delta *= 10;
+		dist *= 10;
+		(*exp)--;
+
+		if (p2 <= delta)
+			break;
+	}
+
+	fmt_round(buf, len, dist, delta, p2, one.f);
+	return len;
+}
+
+/* Write the digits of the positive finite double with the given
+ * bits, and store the decimal exponent of the last one in *exp */
+static inline size_t
+fmt_grisu(char *buf, int *exp, uint64_t bits)
+{
+	const struct cached_pow *c;
+	struct diyfp v, hi, lo, scale;
+	int e = bits >> 52;
+
+	v.f = bits & (((uint64_t)1 << 52) - 1);
+
+	/* Subnormals have no hidden bit */
+	if (e == 0)
+		v.e = 1 - 1075;
+	else {
+		v.f |= (uint64_t)1 << 52;
+		v.e = e - 1075;
+	}
+
+	/* The halfway point below is closer for powers of two,
+	 * the neighbour below them being in a smaller binade */
+	hi = fmt_normalize((struct diyfp){ v.f * 2 + 1, v.e - 1 });
+	if (v.f == (uint64_t)1 << 52 && e > 1)
+		lo = (struct diyfp){ v.f * 4 - 1, v.e - 2 };
+	else
+		lo = (struct diyfp){ v.f * 2 - 1, v.e - 1 };
+
+	lo.f <<= lo.e - hi.e;
+	lo.e = hi.e;
+	v = fmt_normalize(v);
+
+	c = fmt_cached(hi.e);
+	scale = (struct diyfp){ c->f, c->e };
+	v = fmt_mul(v, scale);
+	lo = fmt_mul(lo, scale);
+	hi = fmt_mul(hi, scale);
+
+	/* The products are off by at most one: stay inside */
+	lo.f++;
+	hi.f--;
+
+	*exp = -c->k;
+	return fmt_digits(buf, exp, lo, v, hi);
+}
+
+/* Place the decimal point in the len digits of buf, whose last one
+ * has the decimal exponent exp, or write an exponent after them */
+static inline size_t
+fmt_place(char *buf, size_t len, int exp)
+{
+	/* The point goes after the first point digits */
+	int point = (int)len + exp;
+
+	if ((int)len <= point && point <= 21) {
+		memset(buf + len, '0', point - len);
+		return point;
+	}
+
+	if (0 < point && point <= 21) {
+		memmove(buf + point + 1, buf + point, len - point);
+		buf[point] = '.';
+		return len + 1;
+	}
+
+	if (-6 < point && point <= 0) {
+		memmove(buf + 2 - point, buf, len);
+		buf[0] = '0';
+		buf[1] = '.';
+		memset(buf + 2, '0', -point);
+		return len + 2 - point;
+	}
+
+	/* d.ddde-x, or de-x with a single digit */
+	if (len > 1) {
+		memmove(buf + 2, buf + 1, len - 1);
+		buf[1] = '.';
+		len++;
+	}
+
+	buf[len++] = 'e';
+	exp = point - 1;
+	if (exp < 0) {
+		buf[len++] = '-';
+		exp = -exp;
+	}
+
+	return len + fmt_u64(buf + len, exp);
+}
+
+/* Write d with the fewest digits that read back as d */
+static inline size_t
+fmt_double(char *buf, double d)
+{
+	uint64_t bits;
+	size_t neg, len;
+	int exp;
+
+	/* Look at the bits, which -ffast-math can't assume away,
+	 * unlike isnan() and isinf() */
+	memcpy(&bits, &d, sizeof(bits));
+	neg = bits >> 63;
+	bits &= ~((uint64_t)1 << 63);
+
+	buf[0] = '-';
+	buf += neg;
+
+	if (bits >= (uint64_t)0x7FF << 52) {
+		memcpy(buf, bits == (uint64_t)0x7FF << 52 ? "inf" : "nan", 3);
+		return neg + 3;
+	}
+
+	if (bits == 0) {
+		buf[0] = '0';
+		return neg + 1;
+	}
+
+	len = fmt_grisu(buf, &exp, bits);
+	return neg + fmt_place(buf, len, exp);
+}
+
+/* Way of writing out integer results called name, such as "hex".
+ * Returns it, or -1 if there's no such way. */
+static inline int
+fmt_lookup(const char *name)
+{
+	static const char *const names[] = {
+		[FMT_DEC] = "dec",
+		[FMT_SIGNED] = "signed",
+		[FMT_HEX] = "hex",
+		[FMT_OCT] = "oct",
+		[FMT_BIN] = "bin",
+		[FMT_RAW] = "raw",
+	};
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+
+	return -1;
+}
+
+#endif
@@ -0,0 +1,475 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, jit.h, translates a program compiled by vm.h
+ * into x86-64 machine code, so that an expression evaluated
+ * over and over (for example, once per CSV row, with different
+ * variables every time) doesn't pay for dispatching bytecode.
+ *
+ * The top of the stack lives in rax, the rest on the native
+ * stack. A constant or variable operand is folded into the
+ * instruction that uses it, instead of being pushed.
+ * Code is written into an anonymous mapping, which is made
+ * executable (and no longer writable) before it is run.
+ *
+ * The JIT is only available on x86-64 Linux; elsewhere,
+ * jit_compile() fails, and callers should use run() instead.
+ *
+ * Usage:
+ * if (jit_compile(&jit, &prog))
+ * 	ok = jit_run(&jit, vars, &result);
+ * else
+ * 	ok = run(&prog, &result);
+ * jit_free(&jit);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "vm.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define HAVE_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define HAVE_JIT 0
+#endif
+
+#define JIT_MAX_STACK 65536	/* Deeper programs aren't translated */
+#define JIT_OP_SIZE 48		/* Most bytes emitted per instruction */
+
+/* Translated program: returns ARITH_OK, and stores the result,
+ * or returns the ARITH_* error it stopped at */
+typedef int (*jit_fn)(const uint64_t *vars, uint64_t *result);
+
+/* What helpers called from translated code return, in rax:rdx */
+struct jit_ret {
+	uint64_t value;
+	uint64_t status;	/* ARITH_* outcome */
+};
+
+/* JIT state */
+struct jit {
+	uint8_t *mem;		/* Mapped pages */
+	size_t size;		/* Bytes mapped */
+	size_t len;		/* Bytes emitted */
+	jit_fn fn;		/* Entry point of the last translation */
+	const char *err;	/* Why the last translation failed */
+};
+
+/* Emit the listed bytes */
+#define EMIT(j, ...)	jit_emit((j), (const uint8_t[]){ __VA_ARGS__ }, \
+				 sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+/* Function prototypes */
+static inline struct jit_ret jit_power(uint64_t, uint64_t);
+static inline struct jit_ret jit_powmod(uint64_t, uint64_t, uint64_t);
+static inline struct jit_ret jit_fact(uint64_t);
+static inline void jit_call(struct jit *, uintptr_t, uint32_t, size_t);
+static inline void jit_emit(struct jit *, const uint8_t *, size_t);
+static inline void jit_emit32(struct jit *, uint32_t);
+static inline void jit_emit64(struct jit *, uint64_t);
+static inline void jit_load(struct jit *, uint8_t, uint64_t);
+static inline void jit_exit(struct jit *);
+static inline bool jit_fold(struct jit *, uint8_t, uint8_t, uint64_t);
+bool jit_compile(struct jit *, const struct program *);
+static inline int jit_run(struct jit *, const uint64_t *, uint64_t *);
+void jit_free(struct jit *);
+
+/* a ^ b, for OP_POWER */
+static inline struct jit_ret
+jit_power(uint64_t a, uint64_t b)
+{
+	struct jit_ret r;
+
+	r.status = ipow(a, b, &r.value);
+	return r;
+}
+
+/* (a ^ b) % m, for OP_POWMOD */
+static inline struct jit_ret
+jit_powmod(uint64_t a, uint64_t b, uint64_t m)
+{
+	struct jit_ret r;
+
+	r.status = powmod(a, b, m, &r.value);
+	return r;
+}
+
+/* a!, for OP_FACT */
+static inline struct jit_ret
+jit_fact(uint64_t a)
+{
+	struct jit_ret r;
+
+	r.status = ifact(a, &r.value);
+	return r;
+}
+
+/* Append n bytes of code */
+static inline void
+jit_emit(struct jit *j, const uint8_t *bytes, size_t n)
+{
+	memcpy(j->mem + j->len, bytes, n);
+	j->len += n;
+}
+
+/* Append a little-endian 32-bit immediate */
+static inline void
+jit_emit32(struct jit *j, uint32_t v)
+{
+	EMIT(j, v, v >> 8, v >> 16, v >> 24);
+}
+
+/* Append a little-endian 64-bit immediate */
+static inline void
+jit_emit64(struct jit *j, uint64_t v)
+{
+	jit_emit32(j, v);
+	jit_emit32(j, v >> 32);
+}
+
+/* Load a constant into a register: 0 is rax, 1 is rcx */
+static inline void
+jit_load(struct jit *j, uint8_t reg, uint64_t k)
+{
+	if (k <= UINT32_MAX) {
+		/* mov e?x, imm32 (zero-extended) */
+		EMIT(j, 0xB8 + reg);
+		jit_emit32(j, k);
+	} else if ((int64_t)k >= INT32_MIN && (int64_t)k < 0) {
+		/* mov r?x, imm32 (sign-extended) */
+		EMIT(j, 0x48, 0xC7, 0xC0 + reg);
+		jit_emit32(j, k);
+	} else {
+		/* movabs r?x, imm64 */
+		EMIT(j, 0x48, 0xB8 + reg);
+		jit_emit64(j, k);
+	}
+}
+
+/* Call a helper, with its arguments already in place, while
+ * depth values are on the native stack; if it fails, jump to
+ * the error exit at offset fail */
+static inline void
+jit_call(struct jit *j, uintptr_t fn, uint32_t depth, size_t fail)
+{
+	/* movabs rax, fn */
+	EMIT(j, 0x48, 0xB8);
+	jit_emit64(j, fn);
+
+	/* call rax, keeping the stack aligned across
+	 * the call with sub rsp, 8 and add rsp, 8 */
+	if (depth % 2 != 0)
+		EMIT(j, 0x48, 0x83, 0xEC, 0x08, 0xFF, 0xD0,
+		     0x48, 0x83, 0xC4, 0x08);
+	else
+		EMIT(j, 0xFF, 0xD0);
+
+	/* test edx, edx; jnz fail */
+	EMIT(j, 0x85, 0xD2, 0x0F, 0x85);
+	jit_emit32(j, (uint32_t)fail - (uint32_t)(j->len + 4));
+}
+
+/* Return from the translated program, with eax already set:
+ * lea rsp, [rbp - 16]; pop r12; pop rbx; pop rbp; ret */
+static inline void
+jit_exit(struct jit *j)
+{
+	EMIT(j, 0x48, 0x8D, 0x65, 0xF0, 0x41, 0x5C, 0x5B, 0x5D, 0xC3);
+}
+
+/* Apply a binary operator to rax and an operand that doesn't
+ * need to be pushed: the constant k (OP_PUSH), or the variable
+ * number k (OP_VAR). Returns false if the pair can't be folded. */
+static inline bool
+jit_fold(struct jit *j, uint8_t src, uint8_t op, uint64_t k)
+{
+	bool imm32 = src == OP_PUSH && (int64_t)k >= INT32_MIN
+		     && (int64_t)k <= INT32_MAX;
+
+	if (src == OP_VAR) {
+		if (k > (INT32_MAX >> 3))
+			return false;
+
+		switch (op) {
+		case OP_ADD:		/* add rax, [rbx + disp32] */
+			EMIT(j, 0x48, 0x03, 0x83);
+			break;
+
+		case OP_SUB:		/* sub rax, [rbx + disp32] */
+			EMIT(j, 0x48, 0x2B, 0x83);
+			break;
+
+		case OP_MUL:		/* imul rax, [rbx + disp32] */
+			EMIT(j, 0x48, 0x0F, 0xAF, 0x83);
+			break;
+
+		default:
+			return false;
+		}
+
+		jit_emit32(j, k * sizeof(uint64_t));
+		return true;
+	}
+
+	switch (op) {
+	case OP_ADD:
+	case OP_SUB:
+		if (!imm32) {
+			jit_load(j, 1, k);
+			/* add/sub rax, rcx */
+			EMIT(j, 0x48, op == OP_ADD ? 0x01 : 0x29, 0xC8);
+		} else {
+			/* add/sub rax, imm32 */
+			EMIT(j, 0x48, op == OP_ADD ? 0x05 : 0x2D);
+			jit_emit32(j, k);
+		}
+		return true;
+
+	case OP_MUL:
+		if (!imm32) {
+			/* imul rax, rcx */
+			jit_load(j, 1, k);
+			EMIT(j, 0x48, 0x0F, 0xAF, 0xC1);
+		} else {
+			/* imul rax, rax, imm32 */
+			EMIT(j, 0x48, 0x69, 0xC0);
+			jit_emit32(j, k);
+		}
+		return true;
+
+	case OP_DIV:
+	case OP_MOD:
+		/* Let the generic code report division by zero */
+		if (k == 0)
+			return false;
+
+		jit_load(j, 1, k);
+		EMIT(j, 0x31, 0xD2,			/* xor edx, edx */
+		     0x48, 0xF7, 0xF1);			/* div rcx */
+		if (op == OP_MOD)
+			EMIT(j, 0x48, 0x89, 0xD0);	/* mov rax, rdx */
+		return true;
+
+	case OP_LSHIFT:
+	case OP_RSHIFT:
+		if (k >= 64)
+			EMIT(j, 0x31, 0xC0);		/* xor eax, eax */
+		else				/* shl/shr rax, imm8 */
+			EMIT(j, 0x48, 0xC1, op == OP_LSHIFT ? 0xE0 : 0xE8,
+			     k);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* Translate a compiled program into machine code.
+ * On failure, j->err is set and false is returned. */
+bool
+jit_compile(struct jit *j, const struct program *prog)
+{
+#if HAVE_JIT
+	const uint64_t *k = prog->consts;
+	size_t size, entry, fail, page = sysconf(_SC_PAGESIZE);
+	uint32_t depth = 0;
+	uint8_t op;
+
+	if (prog->max_stack > JIT_MAX_STACK) {
+		j->err = "Error: expression too deep to be compiled";
+		return false;
+	}
+
+	size = ((size_t)prog->len * JIT_OP_SIZE + 64 + page - 1) & ~(page - 1);
+
+	/* Reuse the mapping if it's big enough */
+	if (j->mem != NULL && size > j->size) {
+		munmap(j->mem, j->size);
+		j->mem = NULL;
+	}
+
+	if (j->mem == NULL) {
+		j->mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (j->mem == MAP_FAILED) {
+			j->mem = NULL;
+			j->err = "Error: unable to allocate enough memory!";
+			return false;
+		}
+
+		j->size = size;
+	} else if (mprotect(j->mem, j->size, PROT_READ | PROT_WRITE) < 0) {
+		j->err = "Error: unable to write compiled code";
+		return false;
+	}
+
+	j->len = 0;
+
+	/* Division by zero jumps back here: mov eax, ARITH_DIV_ZERO */
+	EMIT(j, 0xB8, ARITH_DIV_ZERO, 0, 0, 0);
+	jit_exit(j);
+
+	/* Failed helpers jump back here: mov eax, edx */
+	fail = j->len;
+	EMIT(j, 0x89, 0xD0);
+	jit_exit(j);
+
+	/* push rbp; mov rbp, rsp; push rbx; push r12;
+	 * mov rbx, rdi; mov r12, rsi */
+	entry = j->len;
+	EMIT(j, 0x55, 0x48, 0x89, 0xE5, 0x53, 0x41, 0x54,
+	     0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4);
+
+	/* The stack is now 16-byte aligned, and every value
+	 * pushed on it, besides the top one, takes 8 bytes */
+	for (const uint8_t *pc = prog->code; (op = *pc++) != OP_END;) {
+		switch (op) {
+		case OP_PUSH:
+		case OP_VAR:
+			/* Fold the operand into the next instruction */
+			if (depth > 0 && jit_fold(j, op, *pc, *k)) {
+				pc++;
+				k++;
+				continue;
+			}
+
+			if (depth++ > 0)
+				EMIT(j, 0x50);		/* push rax */
+
+			if (op == OP_PUSH)
+				jit_load(j, 0, *k++);
+			else {
+				/* mov rax, [rbx + disp32] */
+				EMIT(j, 0x48, 0x8B, 0x83);
+				jit_emit32(j, *k++ * sizeof(uint64_t));
+			}
+			continue;
+
+		case OP_NEG:
+			EMIT(j, 0x48, 0xF7, 0xD8);	/* neg rax */
+			continue;
+
+		case OP_POWMOD:
+			/* pop rsi; pop rdi; mov rdx, rax */
+			EMIT(j, 0x5E, 0x5F, 0x48, 0x89, 0xC2);
+			depth -= 2;
+			jit_call(j, (uintptr_t)jit_powmod, depth - 1, fail);
+			continue;
+
+		case OP_FACT:
+			EMIT(j, 0x48, 0x89, 0xC7);	/* mov rdi, rax */
+			jit_call(j, (uintptr_t)jit_fact, depth - 1, fail);
+			continue;
+		}
+
+		/* Binary operators: b is in rax, a is popped into rcx */
+		EMIT(j, 0x59);				/* pop rcx */
+		depth--;
+
+		switch (op) {
+		case OP_ADD:
+			EMIT(j, 0x48, 0x01, 0xC8);	/* add rax, rcx */
+			break;
+
+		case OP_SUB:
+			/* sub rcx, rax; mov rax, rcx */
+			EMIT(j, 0x48, 0x29, 0xC1, 0x48, 0x89, 0xC8);
+			break;
+
+		case OP_MUL:
+			/* imul rax, rcx */
+			EMIT(j, 0x48, 0x0F, 0xAF, 0xC1);
+			break;
+
+		case OP_DIV:
+		case OP_MOD:
+			/* test rax, rax; jz back to the error exit */
+			EMIT(j, 0x48, 0x85, 0xC0, 0x0F, 0x84);
+			jit_emit32(j, 0 - (uint32_t)(j->len + 4));
+
+			/* mov r8, rax; mov rax, rcx; xor edx, edx; div r8 */
+			EMIT(j, 0x49, 0x89, 0xC0, 0x48, 0x89, 0xC8,
+			     0x31, 0xD2, 0x49, 0xF7, 0xF0);
+
+			/* mov rax, rdx */
+			if (op == OP_MOD)
+				EMIT(j, 0x48, 0x89, 0xD0);
+			break;
+
+		case OP_LSHIFT:
+		case OP_RSHIFT:
+			/* mov r8, rax; mov rax, rcx; mov ecx, r8d;
+			 * shl/shr rax, cl */
+			EMIT(j, 0x49, 0x89, 0xC0, 0x48, 0x89, 0xC8,
+			     0x44, 0x89, 0xC1, 0x48, 0xD3,
+			     op == OP_LSHIFT ? 0xE0 : 0xE8);
+
+			/* Shifting by 64 bits or more leaves nothing:
+			 * xor edx, edx; cmp r8, 64; cmovae rax, rdx */
+			EMIT(j, 0x31, 0xD2, 0x49, 0x83, 0xF8, 0x40,
+			     0x48, 0x0F, 0x43, 0xC2);
+			break;
+
+		case OP_POWER:
+			/* mov rdi, rcx; mov rsi, rax */
+			EMIT(j, 0x48, 0x89, 0xCF, 0x48, 0x89, 0xC6);
+			jit_call(j, (uintptr_t)jit_power, depth - 1, fail);
+			break;
+
+		default:
+			j->err = "Unsupported operation";
+			return false;
+		}
+	}
+
+	/* mov [r12], rax; xor eax, eax */
+	EMIT(j, 0x49, 0x89, 0x04, 0x24, 0x31, 0xC0);
+	jit_exit(j);
+
+	if (mprotect(j->mem, j->size, PROT_READ | PROT_EXEC) < 0) {
+		j->err = "Error: unable to run compiled code";
+		return false;
+	}
+
+	/* ISO C has no cast from object to function pointers */
+	*(void **)&j->fn = j->mem + entry;
+	return true;
+#else
+	(void)prog;
+	j->err = "Error: JIT compilation is not supported on this platform";
+	return false;
+#endif
+}
+
+/* Run the last translated program, with the given variables.
+ * Returns ARITH_OK, or the error it stopped at. */
+static inline int
+jit_run(struct jit *j, const uint64_t *vars, uint64_t *result)
+{
+	return j->fn(vars, result);
+}
+
+/* Release the memory held by the JIT */
+void
+jit_free(struct jit *j)
+{
+#if HAVE_JIT
+	if (j->mem != NULL)
+		munmap(j->mem, j->size);
+#endif
+	memset(j, 0, sizeof(*j));
+}
+
+#endif
@@ -0,0 +1,164 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, keywords.h, was generated by tools/genkeywords.c:
+ * don't edit it; edit that instead, and run "make keywords".
+ *
+ * It holds a perfect hash table of the commands, special values
+ * and functions calc knows. Names are case-insensitive, and each
+ * one hashes to a slot of its own, so looking a name up takes a
+ * single probe and a single comparison.
+ *
+ * Usage:
+ * const struct keyword *kw = keyword("pi", 2);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+#define KW_SEED 0x0000037Du	/* Seed of the hash */
+#define KW_BITS 7		/* log2 of the size of the table */
+#define KW_MAX_LEN 10		/* Length of the longest name */
+
+/* What a keyword names */
+enum {
+	KW_COMMAND,
+	KW_CONST,		/* Special value */
+	KW_FUNCTION
+};
+
+/* Commands, see parseInput() in calc.c */
+enum {
+	CMD_CACHE = 0,
+	CMD_CACHESTATS,
+	CMD_CALC,
+	CMD_CLEAR,
+	CMD_COLOR,
+	CMD_EXAMPLES,
+	CMD_EXIT,
+	CMD_FLAGS,
+	CMD_HELP,
+	CMD_NOCACHE,
+	CMD_NOCALC,
+	CMD_NOCOLOR,
+	CMD_NOEXAMPLES,
+	CMD_NOFLAGS,
+	CMD_NOSTATS,
+	CMD_OPERANDS,
+	CMD_OPS,
+	CMD_QUIT,
+	CMD_RPN,
+	CMD_SPECVALS,
+	CMD_STATS,
+};
+
+/* Functions: these are the values of FUNCTION nodes, so they
+ * start past the NODE_TYPEs, see parse.h */
+#define FN_FIRST 32
+
+enum {
+	FN_POWMOD = FN_FIRST,
+	FN_FACT,
+	FN_SQRT,
+	FN_LOG,
+	FN_EXP,
+	FN_SIN,
+	FN_COS,
+	FN_LAST
+};
+
+/* Keyword */
+struct keyword {
+	const char *name;	/* NULL if the slot is empty */
+	uint8_t len;		/* Length of name */
+	uint8_t kind;		/* KW_* */
+	uint8_t id;		/* CMD_* or FN_* */
+	uint8_t arity;		/* Number of arguments of functions */
+	uint8_t floating;	/* Does the function return a double? */
+	double value;		/* Value of special values */
+};
+
+/* Keywords, by the slot their name hashes to */
+static const struct keyword keywords[1 << KW_BITS] = {
+	[ 1] = { "cos", 3, KW_FUNCTION, FN_COS, 1, 1, 0 },
+	[ 8] = { "specvals", 8, KW_COMMAND, CMD_SPECVALS, 0, 0, 0 },
+	[11] = { "fact", 4, KW_FUNCTION, FN_FACT, 1, 0, 0 },
+	[12] = { "e", 1, KW_CONST, 0, 0, 0, M_E },
+	[14] = { "nocolor", 7, KW_COMMAND, CMD_NOCOLOR, 0, 0, 0 },
+	[25] = { "nocache", 7, KW_COMMAND, CMD_NOCACHE, 0, 0, 0 },
+	[28] = { "sin", 3, KW_FUNCTION, FN_SIN, 1, 1, 0 },
+	[37] = { "sqrt", 4, KW_FUNCTION, FN_SQRT, 1, 1, 0 },
+	[39] = { "exit", 4, KW_COMMAND, CMD_EXIT, 0, 0, 0 },
+	[41] = { "flags", 5, KW_COMMAND, CMD_FLAGS, 0, 0, 0 },
+	[43] = { "log", 3, KW_FUNCTION, FN_LOG, 1, 1, 0 },
+	[44] = { "exp", 3, KW_FUNCTION, FN_EXP, 1, 1, 0 },
+	[57] = { "clear", 5, KW_COMMAND, CMD_CLEAR, 0, 0, 0 },
+	[59] = { "quit", 4, KW_COMMAND, CMD_QUIT, 0, 0, 0 },
+	[62] = { "pi2", 3, KW_CONST, 0, 0, 0, M_PI_2 },
+	[65] = { "pi4", 3, KW_CONST, 0, 0, 0, M_PI_4 },
+	[68] = { "powmod", 6, KW_FUNCTION, FN_POWMOD, 3, 0, 0 },
+	[69] = { "cache", 5, KW_COMMAND, CMD_CACHE, 0, 0, 0 },
+	[77] = { "1pi", 3, KW_CONST, 0, 0, 0, M_1_PI },
+	[78] = { "pi", 2, KW_CONST, 0, 0, 0, M_PI },
+	[79] = { "color", 5, KW_COMMAND, CMD_COLOR, 0, 0, 0 },
+	[80] = { "pisq", 4, KW_CONST, 0, 0, 0, M_PI * M_PI },
+	[82] = { "nocalc", 6, KW_COMMAND, CMD_NOCALC, 0, 0, 0 },
+	[83] = { "rpn", 3, KW_COMMAND, CMD_RPN, 0, 0, 0 },
+	[86] = { "stats", 5, KW_COMMAND, CMD_STATS, 0, 0, 0 },
+	[95] = { "noflags", 7, KW_COMMAND, CMD_NOFLAGS, 0, 0, 0 },
+	[98] = { "nostats", 7, KW_COMMAND, CMD_NOSTATS, 0, 0, 0 },
+	[103] = { "ops", 3, KW_COMMAND, CMD_OPS, 0, 0, 0 },
+	[107] = { "operands", 8, KW_COMMAND, CMD_OPERANDS, 0, 0, 0 },
+	[113] = { "2pi", 3, KW_CONST, 0, 0, 0, M_2_PI },
+	[116] = { "cachestats", 10, KW_COMMAND, CMD_CACHESTATS, 0, 0, 0 },
+	[117] = { "calc", 4, KW_COMMAND, CMD_CALC, 0, 0, 0 },
+	[118] = { "noexamples", 10, KW_COMMAND, CMD_NOEXAMPLES, 0, 0, 0 },
+	[124] = { "examples", 8, KW_COMMAND, CMD_EXAMPLES, 0, 0, 0 },
+	[125] = { "help", 4, KW_COMMAND, CMD_HELP, 0, 0, 0 },
+};
+
+/* Functions, by FN_* - FN_FIRST */
+static const struct keyword *const kw_funcs[] = {
+	&keywords[68],
+	&keywords[11],
+	&keywords[37],
+	&keywords[43],
+	&keywords[44],
+	&keywords[28],
+	&keywords[1],
+};
+
+/* Function prototypes */
+static const struct keyword *keyword(const char *, size_t);
+
+/* Look up a name of len bytes, whatever its case.
+ * Returns NULL if it isn't a keyword. */
+static const struct keyword *
+keyword(const char *name, size_t len)
+{
+	const struct keyword *kw;
+	uint32_t h = KW_SEED;
+
+	if (len == 0 || len > KW_MAX_LEN)
+		return NULL;
+
+	/* FNV-1a, on lowercase letters */
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ ((unsigned char)name[i] | 0x20)) * 0x01000193u;
+
+	kw = &keywords[h >> (32 - KW_BITS)];
+
+	if (kw->len != len || strncasecmp(kw->name, name, len) != 0)
+		return NULL;
+
+	return kw;
+}
+
+#endif
@@ -0,0 +1,242 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This file, libcalc.c, is libcalc (see libcalc.h): a context
+ * wraps an evaluator (see eval.h), and the expressions compiled
+ * with it, so that nothing is shared between contexts.
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Results are 64-bit words: leave GMP out, so that
+ * programs linking libcalc don't need it */
+#undef HAVE_GMP_H
+#undef HAVE_LIBGMP
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The evaluator's own functions aren't static: rename them,
+ * so they can't clash with those of programs linking libcalc.a */
+#define arena_reset libcalc_arena_reset
+#define arena_free libcalc_arena_free
+#define solve libcalc_solve
+#define build_ast libcalc_build_ast
+#define parse libcalc_parse
+#define compile libcalc_compile
+#define run libcalc_run
+#define run_float libcalc_run_float
+#define program_depth libcalc_program_depth
+#define program_free libcalc_program_free
+#define evaluate libcalc_evaluate
+#define evaluate_big libcalc_evaluate_big
+#define evaluator_free libcalc_evaluator_free
+#define cache_lookup libcalc_cache_lookup
+#define cache_store libcalc_cache_store
+#define cache_free libcalc_cache_free
+#define run_big libcalc_run_big
+#define big_size libcalc_big_size
+#define big_str libcalc_big_str
+#define big_free libcalc_big_free
+
+#include "eval.h"
+#include "libcalc.h"
+
+/* Only export the functions of libcalc.h from libcalc.so */
+#ifdef __GNUC__
+#define LIBCALC_API __attribute__((visibility("default")))
+#else
+#define LIBCALC_API
+#endif
+
+/* Evaluation context */
+struct calc_ctx {
+	struct evaluator ev;
+	struct program *progs;	/* Compiled expressions, by ID */
+	bool *floating;		/* Are they run on doubles? */
+	uint32_t nprogs;
+	uint32_t cap;		/* Compiled expressions allocated */
+	const char *err;	/* Last error message */
+};
+
+/* Function prototypes */
+static enum calc_status ctx_fail(struct calc_ctx *, const char *);
+static bool ctx_reserve(struct calc_ctx *);
+
+/* Remember why the last call failed */
+static enum calc_status
+ctx_fail(struct calc_ctx *ctx, const char *err)
+{
+	ctx->err = err;
+	return CALC_ERROR;
+}
+
+/* Make room for one more compiled expression */
+static bool
+ctx_reserve(struct calc_ctx *ctx)
+{
+	uint32_t cap = ctx->cap ? ctx->cap * 2 : 16;
+	struct program *progs;
+	bool *floating;
+
+	if (ctx->nprogs < ctx->cap)
+		return true;
+
+	if ((progs = realloc(ctx->progs, cap * sizeof(*progs))) == NULL)
+		return false;
+	ctx->progs = progs;
+
+	if ((floating = realloc(ctx->floating, cap * sizeof(*floating)))
+	    == NULL)
+		return false;
+	ctx->floating = floating;
+
+	memset(ctx->progs + ctx->cap, 0,
+	       (cap - ctx->cap) * sizeof(*ctx->progs));
+	ctx->cap = cap;
+	return true;
+}
+
+/* Make a new context, with the given CALC_* options.
+ * Returns NULL if there isn't enough memory for it. */
+LIBCALC_API struct calc_ctx *
+calc_create(unsigned int opts)
+{
+	struct calc_ctx *ctx;
+
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+		return NULL;
+
+	ctx->ev.usecache = !(opts & CALC_NOCACHE);
+	return ctx;
+}
+
+/* Evaluate len bytes of str, storing the result in *val */
+LIBCALC_API enum calc_status
+calc_eval(struct calc_ctx *ctx, const char *str, size_t len,
+	  union calc_value *val)
+{
+	uint64_t result;
+
+	ctx->err = NULL;
+
+	if (!evaluate(&ctx->ev, str, len, &result))
+		return ctx->ev.err != NULL ? ctx_fail(ctx, ctx->ev.err)
+			: CALC_BLANK;
+
+	if (ctx->ev.floating) {
+		memcpy(&val->d, &result, sizeof(val->d));
+		return CALC_FLOAT;
+	}
+
+	val->i = (int64_t)result;
+	return CALC_INT;
+}
+
+/* Compile len bytes of str, which may use the nvars variables
+ * named in vars; their names needn't outlive the call.
+ * Returns the ID to run it with, or -1 if it couldn't be compiled. */
+LIBCALC_API int
+calc_compile(struct calc_ctx *ctx, const char *str, size_t len,
+	     const char *const *vars, unsigned int nvars)
+{
+	struct arena *a = &ctx->ev.arena;
+	struct program *prog;
+	uint32_t root;
+	bool ok;
+
+	ctx->err = NULL;
+
+	if (ctx->nprogs == INT32_MAX || !ctx_reserve(ctx)) {
+		ctx_fail(ctx, "Error: unable to allocate enough memory!");
+		return -1;
+	}
+
+	/* Only compiled expressions may use variables */
+	a->vars = vars;
+	a->nvars = nvars;
+	a->exact = false;
+	ok = parse(a, str, len);
+	a->vars = NULL;
+	a->nvars = 0;
+
+	if (!ok) {
+		ctx_fail(ctx, a->err);
+		return -1;
+	}
+
+	if (a->len == 0) {
+		ctx_fail(ctx, "Error: empty expression");
+		return -1;
+	}
+
+	if ((root = build_ast(a)) == NO_NODE) {
+		ctx_fail(ctx, a->err);
+		return -1;
+	}
+
+	prog = &ctx->progs[ctx->nprogs];
+	if (!compile(prog, a, root)) {
+		ctx_fail(ctx, prog->err);
+		return -1;
+	}
+
+	ctx->floating[ctx->nprogs] = a->floating;
+	return ctx->nprogs++;
+}
+
+/* Run the expression compiled as id, with its variables set to
+ * vals, in the order they were named in; store the result in *val */
+LIBCALC_API enum calc_status
+calc_run(struct calc_ctx *ctx, int id, const int64_t *vals,
+	 union calc_value *val)
+{
+	struct program *prog;
+	uint64_t result;
+
+	ctx->err = NULL;
+
+	if (id < 0 || (uint32_t)id >= ctx->nprogs)
+		return ctx_fail(ctx, "Error: no such compiled expression!");
+
+	prog = &ctx->progs[id];
+	prog->vars = (const uint64_t *)vals;
+
+	if (ctx->floating[id])
+		return run_float(prog, &val->d) ? CALC_FLOAT
+			: ctx_fail(ctx, prog->err);
+
+	if (!run(prog, &result))
+		return ctx_fail(ctx, prog->err);
+
+	val->i = (int64_t)result;
+	return CALC_INT;
+}
+
+/* Why the last call failed, or NULL */
+LIBCALC_API const char *
+calc_error(const struct calc_ctx *ctx)
+{
+	return ctx->err;
+}
+
+/* Free a context, and everything compiled with it */
+LIBCALC_API void
+calc_destroy(struct calc_ctx *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	for (uint32_t i = 0; i < ctx->cap; i++)
+		program_free(&ctx->progs[i]);
+
+	evaluator_free(&ctx->ev);
+	free(ctx->progs);
+	free(ctx->floating);
+	free(ctx);
+}
@@ -0,0 +1,88 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, libcalc.h, is the interface of libcalc, which
+ * evaluates expressions the way calc does, from within another
+ * program: link with -lcalc -lm (libcalc.a or libcalc.so).
+ *
+ * Everything goes through a context, made by calc_create().
+ * Contexts share nothing, so any number of threads can evaluate
+ * expressions at once, each with its own context; a context must
+ * only be used by one thread at a time.
+ *
+ * A context keeps the memory the longest expression so far needed,
+ * and reuses it: once it has seen expressions as long as the ones
+ * that follow, evaluating or running them allocates nothing.
+ *
+ * Expressions that are evaluated over and over, on different
+ * values, can be compiled once, with named variables, and then
+ * run on the values of these variables, without being parsed again.
+ *
+ * Results are 64-bit integers, or doubles for expressions that use
+ * special values or functions such as sqrt; there is no
+ * arbitrary precision here.
+ *
+ * Usage:
+ * static const char *const vars[] = { "x", "y" };
+ * struct calc_ctx *ctx = calc_create(0);
+ * union calc_value v;
+ * int id;
+ *
+ * if (calc_eval(ctx, "2 ^ 10", 6, &v) == CALC_INT)
+ * 	printf("%lld\n", (long long)v.i);
+ * else
+ * 	fprintf(stderr, "%s\n", calc_error(ctx));
+ *
+ * id = calc_compile(ctx, "(x * 3 + y) % 7", 15, vars, 2);
+ * calc_run(ctx, id, (int64_t[]){ 10, 4 }, &v);	v.i is 6
+ * calc_destroy(ctx);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef LIBCALC_H
+#define LIBCALC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Options of calc_create() */
+#define CALC_NOCACHE (1 << 0)	/* Don't cache results */
+
+/* What calc_eval() and calc_run() give back */
+enum calc_status {
+	CALC_INT,		/* The result is an integer, in i */
+	CALC_FLOAT,		/* The result is a double, in d */
+	CALC_BLANK,		/* The expression was blank */
+	CALC_ERROR,		/* calc_error() says why it failed */
+};
+
+/* Result of an expression */
+union calc_value {
+	int64_t i;
+	double d;
+};
+
+/* Evaluation context, only handled through pointers */
+struct calc_ctx;
+
+/* Function prototypes */
+struct calc_ctx *calc_create(unsigned int);
+enum calc_status calc_eval(struct calc_ctx *, const char *, size_t,
+			   union calc_value *);
+int calc_compile(struct calc_ctx *, const char *, size_t,
+		 const char *const *, unsigned int);
+enum calc_status calc_run(struct calc_ctx *, int, const int64_t *,
+			  union calc_value *);
+const char *calc_error(const struct calc_ctx *);
+void calc_destroy(struct calc_ctx *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,344 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, mathfn.h, implements the functions calc can call
+ * on doubles: sqrt, log, exp, sin and cos, one value at a time
+ * (math_sqrt(), math_log(), ...) or over whole arrays
+ * (vec_sqrt(), vec_log(), ...).
+ *
+ * Each function reduces its argument to a small interval, and
+ * evaluates a polynomial there; they don't branch, so the array
+ * versions are vectorised by the compiler, and, on x86-64, are
+ * also built for AVX2 and picked at run time (see SIMD_CLONES).
+ * They follow fdlibm, and, measured with "make bench_mathfn"
+ * against long double results, their error is at most:
+ *
+ * [Function]	[Error]		[Inputs]
+ * sqrt		0.5 ULP		all (it's the hardware instruction)
+ * log		0.75 ULP	all
+ * exp		0.9 ULP		all
+ * sin, cos	0.8 ULP		|x| <= SINCOS_MAX, libm beyond
+ *
+ * Built with -Ofast, as calc is by default, subnormal results
+ * are flushed to zero, by these and by libm alike.
+ *
+ * Inputs out of range give what libm gives (log(-1) is NaN,
+ * log(0) is -inf, exp(1000) is inf), but errno is never set.
+ *
+ * These rely on exact IEEE 754 rounding, so they are always
+ * compiled without -ffast-math, even when calc is.
+ *
+ * Usage:
+ * double y = math_sin(x);
+ * vec_sin(xs, n);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef MATHFN_H
+#define MATHFN_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Let the compiler build an AVX2 version of a function,
+ * as well as the baseline one, and pick one at run time */
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+
+#ifndef SIMD_CLONES
+#define SIMD_CLONES
+#endif
+
+/* Largest argument math_sin() and math_cos() reduce themselves */
+#define SINCOS_MAX 0x1p20
+
+/* Reassociating, or assuming there are no NaNs, would break
+ * the argument reductions below */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("no-fast-math", "no-math-errno")
+#endif
+
+/* Function prototypes */
+static inline uint64_t f2u(double);
+static inline double u2f(uint64_t);
+static inline double math_sqrt(double);
+static inline double math_log(double);
+static inline double math_exp(double);
+static inline double sincos_kernel(double, int);
+static inline double math_sin(double);
+static inline double math_cos(double);
+SIMD_CLONES static inline void vec_sqrt(double *, size_t);
+SIMD_CLONES static inline void vec_log(double *, size_t);
+SIMD_CLONES static inline void vec_exp(double *, size_t);
+SIMD_CLONES static inline void vec_sincos(double *, size_t, int);
+static inline void vec_sin(double *, size_t);
+static inline void vec_cos(double *, size_t);
+
+/* Bits of a double */
+static inline uint64_t
+f2u(double d)
+{
+	uint64_t u;
+
+	memcpy(&u, &d, sizeof(u));
+	return u;
+}
+
+/* Double with the given bits */
+static inline double
+u2f(uint64_t u)
+{
+	double d;
+
+	memcpy(&d, &u, sizeof(d));
+	return d;
+}
+
+/* Square root, correctly rounded */
+static inline double
+math_sqrt(double x)
+{
+	return sqrt(x);
+}
+
+/* Natural logarithm.
+ * x = 2^k * m, with sqrt(2) / 2 <= m < sqrt(2), and
+ * log(m) = log(1 + f) = 2s + 2s^3 / 3 + ..., with s = f / (2 + f) */
+static inline double
+math_log(double x)
+{
+	const double ln2_hi = 0x1.62e42fee00000p-1;
+	const double ln2_lo = 0x1.a39ef35793c76p-33;
+	const double lg1 = 6.666666666666735130e-01;
+	const double lg2 = 3.999999999940941908e-01;
+	const double lg3 = 2.857142874366239149e-01;
+	const double lg4 = 2.222219843214978396e-01;
+	const double lg5 = 1.818357216161805012e-01;
+	const double lg6 = 1.531383769920937332e-01;
+	const double lg7 = 1.479819860511658591e-01;
+	double y, k, f, s, z, w, r, hfsq;
+	uint64_t u, e;
+	int sub = x < 0x1p-1022;
+
+	/* Subnormals are made normal first */
+	u = f2u(sub ? x * 0x1p54 : x);
+	e = (u >> 52) & 0x7ff;
+
+	/* Halve m if it's past sqrt(2) */
+	if ((u & 0xfffffffffffffULL) > 0x6a09e667f3bcdULL) {
+		u = (u & 0xfffffffffffffULL) | 0x3fe0000000000000ULL;
+		e++;
+	} else
+		u = (u & 0xfffffffffffffULL) | 0x3ff0000000000000ULL;
+
+	/* The exponent, as a double, without converting an integer */
+	k = u2f(0x4330000000000000ULL | e) - (0x1p52 + 1023)
+	    - (sub ? 54 : 0);
+
+	f = u2f(u) - 1;
+	s = f / (2 + f);
+	z = s * s;
+	w = z * z;
+	r = z * (lg1 + w * (lg3 + w * (lg5 + w * lg7)))
+	    + w * (lg2 + w * (lg4 + w * lg6));
+	hfsq = 0.5 * f * f;
+	y = k * ln2_hi - ((hfsq - (s * (hfsq + r) + k * ln2_lo)) - f);
+
+	/* Zero, negative numbers, infinity and NaN */
+	y = x == 0 ? -INFINITY : y;
+	y = x < 0 ? NAN : y;
+	y = x == INFINITY ? x : y;
+	return x != x ? x : y;
+}
+
+/* Exponential.
+ * x = k * log(2) + r, with |r| <= log(2) / 2, and
+ * exp(x) = 2^k * exp(r), exp(r) being a rational approximation */
+static inline double
+math_exp(double x)
+{
+	const double shift = 0x1.8p52;
+	const double log2e = 0x1.71547652b82fep+0;
+	const double ln2_hi = 0x1.62e42fee00000p-1;
+	const double ln2_lo = 0x1.a39ef35793c76p-33;
+	const double p1 = 1.66666666666666019037e-01;
+	const double p2 = -2.77777777770155933842e-03;
+	const double p3 = 6.61375632143793436117e-05;
+	const double p4 = -1.65339022054652515390e-06;
+	const double p5 = 4.13813679705723846039e-08;
+	double t, k, hi, lo, r, c, y;
+	int64_t n, n1;
+
+	/* Past these, the result is 0 or infinity anyway */
+	x = x > 710 ? 710 : x;
+	x = x < -746 ? -746 : x;
+
+	/* Round x / log(2) to an integer, in the low bits of t */
+	t = x * log2e + shift;
+	k = t - shift;
+	n = (int64_t)(f2u(t) - f2u(shift));
+
+	hi = x - k * ln2_hi;
+	lo = k * ln2_lo;
+	r = hi - lo;
+
+	t = r * r;
+	c = r - t * (p1 + t * (p2 + t * (p3 + t * (p4 + t * p5))));
+	y = 1 - ((lo - (r * c) / (2 - c)) - hi);
+
+	/* Scale by 2^n in two steps, so that neither
+	 * power of 2 overflows or is subnormal */
+	n1 = n >> 1;
+	y *= u2f((uint64_t)(n1 + 1023) << 52);
+	return y * u2f((uint64_t)(n - n1 + 1023) << 52);
+}
+
+/* Sine, if quadrant is 0, or cosine, if it's 1, of x.
+ * x = k * pi / 2 + r, with |r| <= pi / 4, and sin(x) and cos(x)
+ * are, depending on k, one of sin(r), cos(r), -sin(r) or -cos(r).
+ * pi / 2 is split in four parts, the first three of 33 bits,
+ * so that multiplying them by k is exact while |x| <= SINCOS_MAX. */
+static inline double
+sincos_kernel(double x, int quadrant)
+{
+	const double shift = 0x1.8p52;
+	const double twobypi = 0x1.45f306dc9c883p-1;
+	const double pio2_1 = 0x1.921fb54400000p+0;
+	const double pio2_2 = 0x1.0b4611a600000p-34;
+	const double pio2_3 = 0x1.3198a2e000000p-69;
+	const double pio2_4 = 0x1.b839a252049c1p-104;
+	const double s1 = -1.66666666666666324348e-01;
+	const double s2 = 8.33333333332248946124e-03;
+	const double s3 = -1.98412698298579493134e-04;
+	const double s4 = 2.75573137070700676789e-06;
+	const double s5 = -2.50507602534068634195e-08;
+	const double s6 = 1.58969099521155010221e-10;
+	const double c1 = 4.16666666666666019037e-02;
+	const double c2 = -1.38888888888741095749e-03;
+	const double c3 = 2.48015872894767294178e-05;
+	const double c4 = -2.75573143513906633035e-07;
+	const double c5 = 2.08757232129817482790e-09;
+	const double c6 = -1.13596475577881948265e-11;
+	double t, k, hi, lo, p, r, d, z, v, sin_r, cos_r, hz, w, y;
+	uint64_t q;
+
+	t = x * twobypi + shift;
+	k = t - shift;
+	q = f2u(t) + quadrant;
+
+	/* r = hi + lo: the first product is exact, and so is the
+	 * first difference, since x is close to it; the error of
+	 * the second is kept in lo */
+	hi = x - k * pio2_1;
+	p = k * pio2_2;
+	r = hi - p;
+	d = r - hi;
+	lo = (hi - (r - d)) - (p + d);
+	lo -= k * pio2_3;
+	lo -= k * pio2_4;
+	hi = r + lo;
+	lo = (r - hi) + lo;
+
+	/* The kernels add the effect of lo to that of hi */
+	z = hi * hi;
+	v = z * hi;
+	p = s2 + z * (s3 + z * (s4 + z * (s5 + z * s6)));
+	sin_r = hi - ((z * (0.5 * lo - v * p) - lo) - v * s1);
+	sin_r = x == 0 ? x : sin_r;	/* Keep the sign of -0 */
+
+	hz = 0.5 * z;
+	w = 1 - hz;
+	p = z * (c1 + z * (c2 + z * (c3 + z * (c4 + z * (c5 + z * c6)))));
+	cos_r = w + (((1 - w) - hz) + (z * p - hi * lo));
+
+	/* Odd quadrants use the other function, the last two
+	 * negate it */
+	y = q & 1 ? cos_r : sin_r;
+	return u2f(f2u(y) ^ ((q & 2) << 62));
+}
+
+/* Sine */
+static inline double
+math_sin(double x)
+{
+	return fabs(x) <= SINCOS_MAX ? sincos_kernel(x, 0) : sin(x);
+}
+
+/* Cosine */
+static inline double
+math_cos(double x)
+{
+	return fabs(x) <= SINCOS_MAX ? sincos_kernel(x, 1) : cos(x);
+}
+
+/* Replace each of the n values of x with its square root */
+SIMD_CLONES static inline void
+vec_sqrt(double *x, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		x[i] = math_sqrt(x[i]);
+}
+
+/* Replace each of the n values of x with its logarithm */
+SIMD_CLONES static inline void
+vec_log(double *x, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		x[i] = math_log(x[i]);
+}
+
+/* Replace each of the n values of x with its exponential */
+SIMD_CLONES static inline void
+vec_exp(double *x, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		x[i] = math_exp(x[i]);
+}
+
+/* Replace each of the n values of x with its sine, or cosine,
+ * see sincos_kernel(). Large values are rare, so if there are
+ * any, the whole array is left to libm. */
+SIMD_CLONES static inline void
+vec_sincos(double *x, size_t n, int quadrant)
+{
+	int large = 0;
+
+	for (size_t i = 0; i < n; i++)
+		large |= !(fabs(x[i]) <= SINCOS_MAX);
+
+	if (large) {
+		for (size_t i = 0; i < n; i++)
+			x[i] = quadrant ? math_cos(x[i]) : math_sin(x[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		x[i] = sincos_kernel(x[i], quadrant);
+}
+
+/* Replace each of the n values of x with its sine */
+static inline void
+vec_sin(double *x, size_t n)
+{
+	vec_sincos(x, n, 0);
+}
+
+/* Replace each of the n values of x with its cosine */
+static inline void
+vec_cos(double *x, size_t n)
+{
+	vec_sincos(x, n, 1);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -5,10 +5,27 @@
  * bit-shifting (>> and <<), multiplication, division,
  * addition and subtraction.
  *
+ * Numbers can be written in decimal, or in hexadecimal (0x),
+ * binary (0b) and octal (0o).
+ *
+ * Functions are called as name(arg, ...), and special values,
+ * such as Pi, can be used anywhere a number can; both are looked
+ * up in keywords.h. Special values, and functions such as sqrt,
+ * are doubles: expressions that use them set arena.floating, and
+ * are evaluated in floating point.
+ * If arena.exact is set, numbers of any size are accepted: those
+ * that don't fit in 64 bits become BIGVAL nodes, whose digits are
+ * kept in arena.text, for bignum.h to evaluate.
+ * If arena.vars is set, names in that list are accepted as
+ * variables: they become VAR nodes holding the index of the name.
+ *
  * Usage:
- * parse(str);
- * build_ast(&token_head);
- * uint64_t result = solve(token_head.next);
+ * struct arena arena = { 0 };
+ * parse(&arena, str, strlen(str));
+ * uint32_t root = build_ast(&arena);
+ * uint64_t result = solve(&arena, root);
+ *
+ * On error, parse() and build_ast() store a message in arena.err.
  *
  * Made by Salonia Matteo <saloniamatteo@pm.me>
  *
@@ -17,17 +34,18 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <ctype.h>
+#include <inttypes.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#ifdef HAVE_GMP_H
-#include <gmp.h>
-#else
-#include <stdint.h>
-#endif
+#include "arith.h"
+#include "keywords.h"
 
 typedef enum {
 	VAL,
@@ -42,339 +60,854 @@ typedef enum {
 	PAREN_OPEN,		// (
 	PAREN_CLOSE,		// )
 	FUNCTION,		// +-/* are also functions a.k.a unary operators
+	VAR,			// Named variable, such as a CSV column
+	COMMA,			// ,
+	BIGVAL,			// Number too large for 64 bits, see arena.text
+	FVAL,			// Special value, its value holds a double
 	END			// Used in template as terminating symbol
 } NODE_TYPE;
 
-/* Token structure */
-static struct token {
-	NODE_TYPE node_type;
-	uint64_t value;
-	struct token *next;
-	struct token *left;
-	struct token *right;
-	bool reduced;
-} token_head;
-
-/* Available templates */
-static NODE_TYPE add_template[] = { VAL, ADD, VAL, END };
-static NODE_TYPE sub_template[] = { VAL, SUB, VAL, END };
-static NODE_TYPE mul_template[] = { VAL, MUL, VAL, END };
-static NODE_TYPE div_template[] = { VAL, DIV, VAL, END };
-static NODE_TYPE lshift_template[] = { VAL, L_SHIFT, VAL, END };
-static NODE_TYPE rshift_template[] = { VAL, R_SHIFT, VAL, END };
-static NODE_TYPE power_template[] = { VAL, POWER, VAL, END };
-static NODE_TYPE mod_template[] = { VAL, MOD, VAL, END };
-static NODE_TYPE paren_template[] = { PAREN_OPEN, VAL, PAREN_CLOSE, END };
-static NODE_TYPE unary_template[] = { FUNCTION, VAL, END };
-
-/* Possible unary operators.
- * If operator is not in this list,
- * then it's not available as unary operator */
-static NODE_TYPE unary_whitelist[] = { ADD, SUB, END };
+/* Value of FUNCTION nodes: one of the FN_* of keywords.h,
+ * or, for unary minus, its operator, SUB */
+enum {
+	FN_NEG = SUB
+};
+
+/* Sentinel index meaning "no node" */
+#define NO_NODE UINT32_MAX
+
+/* Size of the error message buffer */
+#define ERR_SIZE 80
+
+/* Per-expression node pool.
+ * Tokens are appended in input order and become the nodes of
+ * the AST, so the token list is simply 0..len-1. Nodes are
+ * referenced by 32-bit indices and their fields are kept in
+ * parallel arrays: 17 bytes per node, instead of 48.
+ * The lexer only fills in type and value; the children of
+ * operator nodes are set by the parser.
+ * The pool is reset, not freed, between expressions. */
+struct arena {
+	uint8_t *type;		/* NODE_TYPE of each node */
+	uint64_t *value;	/* VAL: value, FUNCTION: operator, VAR: index,
+				 * BIGVAL: offset of its digits in text,
+				 * FVAL: bits of a double */
+	uint32_t *left;		/* Left child, or NO_NODE */
+	uint32_t *right;	/* Right child, or NO_NODE */
+	uint32_t len;		/* Nodes in use */
+	uint32_t cap;		/* Nodes allocated */
+	const char *const *vars;	/* Variable names, or NULL */
+	const uint64_t *vals;	/* Variable values, used by solve() */
+	uint32_t nvars;		/* Number of variable names */
+	char *text;		/* BIGVAL digits: base, digits, NUL, ... */
+	uint32_t textlen;	/* Bytes of text in use */
+	uint32_t textcap;	/* Bytes of text allocated */
+	bool exact;		/* Accept BIGVALs, and don't fold signs */
+	bool floating;		/* Are there doubles, such as FVALs? */
+	char err[ERR_SIZE];	/* Last error message */
+};
+
+/* Parser state */
+struct parser {
+	struct arena *a;
+	uint32_t pos;		/* Next token to be consumed */
+	int depth;		/* Current nesting depth */
+};
+
+/* Binding powers used by the precedence-climbing parser.
+ * Higher values bind tighter; 0 means "not a binary operator" */
+#define BP_SHIFT	1	/* < > */
+#define BP_ADD		2	/* + - */
+#define BP_MUL		3	/* * / % */
+#define BP_UNARY	4	/* unary + - */
+#define BP_POWER	5	/* ^ (right-associative) */
+
+/* Maximum nesting depth of parentheses, unary operators
+ * and powers, so malformed input can't exhaust the stack */
+#define MAX_DEPTH 4096
+
+/* Token type of each operator character, VAL if it isn't one */
+static const uint8_t op_table[256] = {
+	['+'] = ADD, ['-'] = SUB, ['*'] = MUL, ['/'] = DIV,
+	['<'] = L_SHIFT, ['>'] = R_SHIFT, ['^'] = POWER, ['%'] = MOD,
+	['('] = PAREN_OPEN, [')'] = PAREN_CLOSE, [','] = COMMA,
+};
+
+/* Value + 1 of each digit character in bases up to 16, 0 if invalid */
+static const uint8_t digit_table[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
 
 /* Function prototypes */
-static struct token *token_add(NODE_TYPE);
-static struct token *token_add_val(uint64_t);
-static bool matches_template(struct token *, NODE_TYPE *);
-static struct token *reduce(struct token *);
-static struct token *unwrap(struct token *);
-static struct token *unwrap_unary(struct token *);
-uint64_t solve(struct token *);
-void build_ast(struct token *);
-bool parse(char *);
-
-/* Add token */
-static struct token *
-token_add(NODE_TYPE token)
+static inline void arena_error(struct arena *, const char *, ...);
+static inline bool arena_grow(struct arena *);
+static inline bool arena_reserve(struct arena *, uint32_t);
+static inline uint32_t arena_push(struct arena *, NODE_TYPE, uint64_t);
+static inline bool swar_is_digits(uint64_t);
+static inline uint64_t swar_parse8(uint64_t);
+static inline size_t lex_number(struct arena *, const char *, size_t, size_t,
+				NODE_TYPE *, uint64_t *);
+static inline size_t lex_bignum(struct arena *, const char *, size_t, size_t,
+				unsigned int, NODE_TYPE *, uint64_t *);
+static inline const struct keyword *func_by_id(uint8_t);
+static inline size_t lex_name(struct arena *, const char *, size_t, size_t,
+			      NODE_TYPE *, uint64_t *);
+static inline uint32_t parse_call(struct parser *, uint32_t);
+static inline int binding_power(NODE_TYPE);
+static inline uint32_t parse_prefix(struct parser *);
+static inline uint32_t parse_expr(struct parser *, int);
+void arena_reset(struct arena *);
+void arena_free(struct arena *);
+uint64_t solve(struct arena *, uint32_t);
+uint32_t build_ast(struct arena *);
+bool parse(struct arena *, const char *, size_t);
+
+/* Record an error message; callers print it, see a->err */
+static inline void
+arena_error(struct arena *a, const char *fmt, ...)
 {
-	struct token *curr = &token_head;
+	va_list argl;
+
+	va_start(argl, fmt);
+	vsnprintf(a->err, sizeof(a->err), fmt, argl);
+	va_end(argl);
+}
+
+/* Double the capacity of the arena */
+static inline bool
+arena_grow(struct arena *a)
+{
+	uint32_t cap = a->cap ? a->cap * 2 : 64;
+	void *p;
+
+	if (cap <= a->cap || cap == NO_NODE)
+		return false;
 
-	while (curr->next != NULL)
-		curr = curr->next;
+	if ((p = realloc(a->type, cap * sizeof(*a->type))) == NULL)
+		return false;
+	a->type = p;
 
-	struct token *n = malloc(sizeof(struct token));
+	if ((p = realloc(a->value, cap * sizeof(*a->value))) == NULL)
+		return false;
+	a->value = p;
 
-	n->node_type = token;
-	n->left = NULL;
-	n->right = NULL;
-	n->next = NULL;
-	n->reduced = false;
-	curr->next = n;
+	if ((p = realloc(a->left, cap * sizeof(*a->left))) == NULL)
+		return false;
+	a->left = p;
 
-	return n;
+	if ((p = realloc(a->right, cap * sizeof(*a->right))) == NULL)
+		return false;
+	a->right = p;
+
+	a->cap = cap;
+	return true;
 }
 
-/* Add value to token */
-static struct token *
-token_add_val(uint64_t val)
+/* Make sure the arena can hold at least n nodes */
+static inline bool
+arena_reserve(struct arena *a, uint32_t n)
 {
-	struct token *constructed = token_add(VAL);
+	while (a->cap < n) {
+		if (!arena_grow(a)) {
+			arena_error(a,
+				    "Error: unable to allocate enough memory!");
+			return false;
+		}
+	}
 
-	constructed->value = val;
-	return constructed;
+	return true;
 }
 
-/* Check if token matches template */
-static bool
-matches_template(struct token *head, NODE_TYPE * tmpl)
+/* Append a node, without checking the capacity:
+ * use arena_reserve() beforehand */
+static inline uint32_t
+arena_push(struct arena *a, NODE_TYPE type, uint64_t value)
 {
-	int i = 0;
-	NODE_TYPE curr_token = tmpl[i];
+	a->type[a->len] = type;
+	a->value[a->len] = value;
 
-	while (curr_token != END) {
-		if (head == NULL)
-			return false;
+	return a->len++;
+}
 
-		NODE_TYPE head_type = head->node_type;
+/* Forget every node, keeping the allocated memory */
+void
+arena_reset(struct arena *a)
+{
+	a->len = 0;
+	a->textlen = 0;
+	a->floating = false;
+}
 
-		/* Reduced node is considered a value,
-		 * but we can't override it's operator */
-		if (head->reduced)
-			head_type = VAL;
+/* Release the memory held by the arena */
+void
+arena_free(struct arena *a)
+{
+	free(a->type);
+	free(a->value);
+	free(a->left);
+	free(a->right);
+	free(a->text);
+	memset(a, 0, sizeof(*a));
+}
 
-		bool in_unary_whitelist = false;
-		int white_list_iterator = 0;
+/* Check if all 8 bytes of a little-endian chunk are ASCII digits:
+ * the high nibble must be 3, and adding 6 must not carry out of
+ * the low nibble. A carry between bytes always fails the test. */
+static inline bool
+swar_is_digits(uint64_t chunk)
+{
+	return (chunk & (chunk + 0x0606060606060606)
+		& 0xF0F0F0F0F0F0F0F0) == 0x3030303030303030;
+}
 
-		while (unary_whitelist[white_list_iterator] != END) {
-			if (unary_whitelist[white_list_iterator] == head_type) {
-				in_unary_whitelist = true;
-				break;
-			}
-			white_list_iterator++;
-		}
+/* Convert 8 ASCII digits (little-endian chunk) into their value,
+ * combining pairs, then quads, then both halves */
+static inline uint64_t
+swar_parse8(uint64_t chunk)
+{
+	const uint64_t mask = 0x000000FF000000FF;
+	const uint64_t mul1 = 100 + (1000000ULL << 32);
+	const uint64_t mul2 = 1 + (10000ULL << 32);
 
-		if (curr_token == FUNCTION && head_type != VAL
-		    && in_unary_whitelist)
-			curr_token = head_type;
+	chunk -= 0x3030303030303030;
+	chunk = (chunk * 10) + (chunk >> 8);
 
-		if (head == NULL || head_type != curr_token)
-			return false;
+	return (((chunk & mask) * mul1)
+		+ (((chunk >> 16) & mask) * mul2)) >> 32;
+}
 
-		i++;
-		head = head->next;
-		curr_token = tmpl[i];
+/* Get the binding power of a binary operator */
+static inline int
+binding_power(NODE_TYPE type)
+{
+	switch (type) {
+	case L_SHIFT:
+	case R_SHIFT:
+		return BP_SHIFT;
+
+	case ADD:
+	case SUB:
+		return BP_ADD;
+
+	case MUL:
+	case DIV:
+	case MOD:
+		return BP_MUL;
+
+	case POWER:
+		return BP_POWER;
+
+	default:
+		return 0;
 	}
-	return true;
 }
 
-/* Reduce expressions */
-static struct token *
-reduce(struct token *head)
+/* Parse a value, a parenthesised expression or a unary operator */
+static inline uint32_t
+parse_prefix(struct parser *p)
 {
-	struct token *combined = head->next->next;
+	struct arena *a = p->a;
+	uint32_t tok = p->pos, operand;
 
-	combined->reduced = true;
-	combined->left = head->next;
-	combined->right = combined->next;
+	if (tok == a->len) {
+		arena_error(a, "Syntax error: unexpected end of input");
+		return NO_NODE;
+	}
 
-	if (head->next->next->next->next != NULL)
-		combined->next = head->next->next->next->next;
-	else
-		combined->next = NULL;
+	if (++p->depth > MAX_DEPTH) {
+		arena_error(a, "Syntax error: expression nested too deeply");
+		return NO_NODE;
+	}
+
+	switch (a->type[tok]) {
+	case VAL:
+	case VAR:
+	case BIGVAL:
+	case FVAL:
+		p->pos++;
+		p->depth--;
+		return tok;
+
+	case FUNCTION:
+		p->pos++;
+		operand = parse_call(p, tok);
+		p->depth--;
+		return operand;
+
+	case PAREN_OPEN:
+		p->pos++;
+		operand = parse_expr(p, BP_SHIFT);
+
+		if (operand == NO_NODE)
+			return NO_NODE;
+
+		if (p->pos == a->len || a->type[p->pos] != PAREN_CLOSE) {
+			arena_error(a, "Syntax error: missing \")\"");
+			return NO_NODE;
+		}
+
+		p->pos++;
+		p->depth--;
+		return operand;
+
+	case ADD:
+	case SUB:
+		p->pos++;
+		operand = parse_expr(p, BP_UNARY);
+
+		if (operand == NO_NODE)
+			return NO_NODE;
+
+		p->depth--;
+
+		/* Unary plus is a no-op */
+		if (a->type[tok] == ADD)
+			return operand;
+
+		/* Fold negative numbers directly into the value,
+		 * unless they must be negated exactly */
+		if (a->type[operand] == VAL && !a->exact) {
+			a->value[operand] = 0 - a->value[operand];
+			return operand;
+		}
 
-	head->next = combined;
+		/* Otherwise, reuse the operator token as a function node */
+		a->value[tok] = a->type[tok];
+		a->type[tok] = FUNCTION;
+		a->left[tok] = operand;
+		a->right[tok] = NO_NODE;
+		return tok;
 
-	return head;
+	default:
+		arena_error(a, "Syntax error: unexpected operator");
+		return NO_NODE;
+	}
 }
 
-/* Unfold (VAL) into VAL */
-static struct token *
-unwrap(struct token *head)
+/* Parse the arguments of a function call, after its name.
+ * The arguments are chained through the "(" and "," tokens:
+ * the function's left child is the "(", and each of these
+ * has its argument as its left child, and the next "," as
+ * its right child. */
+static inline uint32_t
+parse_call(struct parser *p, uint32_t fn)
 {
-	struct token *combined = head->next->next;
+	struct arena *a = p->a;
+	const struct keyword *f = func_by_id(a->value[fn]);
+	uint32_t link = p->pos, arg, n = 0;
+
+	if (link == a->len || a->type[link] != PAREN_OPEN) {
+		arena_error(a, "Syntax error: missing \"(\" after %s", f->name);
+		return NO_NODE;
+	}
+
+	a->left[fn] = link;
+	a->right[fn] = NO_NODE;
+
+	for (;;) {
+		p->pos++;
+
+		if ((arg = parse_expr(p, BP_SHIFT)) == NO_NODE)
+			return NO_NODE;
+
+		a->left[link] = arg;
+		a->right[link] = NO_NODE;
+		n++;
+
+		if (p->pos == a->len || a->type[p->pos] != COMMA)
+			break;
+
+		a->right[link] = p->pos;
+		link = p->pos;
+	}
 
-	combined->reduced = true;
+	if (p->pos == a->len || a->type[p->pos] != PAREN_CLOSE) {
+		arena_error(a, "Syntax error: missing \")\"");
+		return NO_NODE;
+	}
 
-	if (head->next->next->next->next != NULL)
-		combined->next = head->next->next->next->next;
-	else
-		combined->next = NULL;
+	p->pos++;
 
-	head->next = combined;
+	if (n != f->arity) {
+		arena_error(a, "Syntax error: %s takes %d argument%s", f->name,
+			    f->arity, f->arity == 1 ? "" : "s");
+		return NO_NODE;
+	}
 
-	return head;
+	return fn;
 }
 
-/* Unfold OP VAL into VAL based on OP. */
-static struct token *
-unwrap_unary(struct token *head)
+/* Parse binary operators whose binding power is at least min_bp.
+ * Left-associative chains are built iteratively, so recursion
+ * only grows with nesting, not with the length of the input. */
+static inline uint32_t
+parse_expr(struct parser *p, int min_bp)
 {
+	struct arena *a = p->a;
+	uint32_t lhs = parse_prefix(p), op, rhs;
+	int bp;
+
+	if (lhs == NO_NODE)
+		return NO_NODE;
+
+	while ((op = p->pos) != a->len) {
+		bp = binding_power(a->type[op]);
+
+		if (bp == 0 || bp < min_bp)
+			break;
 
-	struct token *combined = head->next->next;
-	NODE_TYPE op = head->next->node_type;
+		p->pos++;
 
-	if (op == SUB)
-		combined->value = 0 - combined->value;
+		/* Powers are right-associative, everything else is left */
+		if (a->type[op] == POWER) {
+			if (++p->depth > MAX_DEPTH) {
+				arena_error(a, "Syntax error: "
+					    "expression nested too deeply");
+				return NO_NODE;
+			}
 
-	combined->reduced = true;
+			rhs = parse_expr(p, bp);
+			p->depth--;
+		} else
+			rhs = parse_expr(p, bp + 1);
 
-	if (head->next->next->next != NULL)
-		combined->next = head->next->next->next;
-	else
-		combined->next = NULL;
+		if (rhs == NO_NODE)
+			return NO_NODE;
 
-	head->next = combined;
+		a->left[op] = lhs;
+		a->right[op] = rhs;
+		lhs = op;
+	}
 
-	return head;
+	return lhs;
 }
 
-/* Solve AST branch */
+/* Solve AST branch, recursively.
+ * This is the reference evaluator: calc.c compiles
+ * the tree with vm.h instead, see compile() and run().
+ * On error, a->err is set and 0 is returned. */
 uint64_t
-solve(struct token *head)
+solve(struct arena *a, uint32_t node)
 {
-	NODE_TYPE op = head->node_type;
+	NODE_TYPE op = a->type[node];
+	uint32_t l, r;
+
+	if (op == VAL)
+		return a->value[node];
+
+	if (op == BIGVAL) {
+		arena_error(a, "%s", arith_error(ARITH_OVERFLOW));
+		return 0;
+	}
+
+	if (op == FVAL) {
+		arena_error(a, "Error: special values aren't integers");
+		return 0;
+	}
+
+	if (op == VAR) {
+		if (a->vals == NULL) {
+			arena_error(a, "Error: variables have no value");
+			return 0;
+		}
+
+		return a->vals[a->value[node]];
+	}
+
+	l = a->left[node];
+	r = a->right[node];
+
+	if (op == FUNCTION && a->value[node] == FN_POWMOD) {
+		uint64_t base, exp, mod, res;
+		int status;
+
+		/* Arguments hang off the "(" and "," tokens */
+		base = solve(a, a->left[l]);
+		l = a->right[l];
+		exp = solve(a, a->left[l]);
+		mod = solve(a, a->left[a->right[l]]);
+
+		if ((status = powmod(base, exp, mod, &res)) != ARITH_OK) {
+			arena_error(a, "%s", arith_error(status));
+			return 0;
+		}
+
+		return res;
+	} else if (op == FUNCTION && a->value[node] == FN_FACT) {
+		uint64_t res;
+		int status;
 
-	if (head->left == NULL && head->right == NULL)
-		return head->value;
+		if ((status = ifact(solve(a, a->left[l]), &res)) != ARITH_OK) {
+			arena_error(a, "%s", arith_error(status));
+			return 0;
+		}
 
-	if (op == ADD)
-		return solve(head->left) + solve(head->right);
+		return res;
+	} else if (op == FUNCTION && a->value[node] >= FN_FIRST
+		   && func_by_id(a->value[node])->floating) {
+		arena_error(a, "Error: %s() doesn't return integers",
+			    func_by_id(a->value[node])->name);
+		return 0;
+	} else if (op == FUNCTION)
+		return a->value[node] == SUB ? 0 - solve(a, l) : solve(a, l);
+	else if (op == ADD)
+		return solve(a, l) + solve(a, r);
 	else if (op == SUB)
-		return solve(head->left) - solve(head->right);
+		return solve(a, l) - solve(a, r);
 	else if (op == MUL)
-		return solve(head->left) * solve(head->right);
-	else if (op == DIV)
-		return solve(head->left) / solve(head->right);
-	else if (op == L_SHIFT)
-		return solve(head->left) << solve(head->right);
-	else if (op == R_SHIFT)
-		return solve(head->left) >> solve(head->right);
-	else if (op == POWER)
-		return pow(solve(head->left), solve(head->right));
-	else if (op == MOD)
-		return solve(head->left) % solve(head->right);
-	else {
-		fprintf(stderr, "Unsupported operation: \"%d\"\n", op);
-		return -1;
+		return solve(a, l) * solve(a, r);
+	else if (op == DIV || op == MOD) {
+		uint64_t lhs = solve(a, l), rhs = solve(a, r);
+
+		if (rhs == 0) {
+			arena_error(a, "Error: division by zero!");
+			return 0;
+		}
+
+		return op == DIV ? lhs / rhs : lhs % rhs;
+	} else if (op == L_SHIFT || op == R_SHIFT) {
+		uint64_t lhs = solve(a, l), rhs = solve(a, r);
+
+		/* Shifting by 64 bits or more leaves nothing */
+		if (rhs >= 64)
+			return 0;
+
+		return op == L_SHIFT ? lhs << rhs : lhs >> rhs;
+	} else if (op == POWER) {
+		uint64_t lhs = solve(a, l), rhs = solve(a, r), res;
+		int status;
+
+		if ((status = ipow(lhs, rhs, &res)) != ARITH_OK) {
+			arena_error(a, "%s", arith_error(status));
+			return 0;
+		}
+
+		return res;
+	} else {
+		arena_error(a, "Unsupported operation: \"%d\"", op);
+		return 0;
 	}
 }
 
-/* Build AST */
-void
-build_ast(struct token *head)
+/* Build AST in a single pass over the tokens in the arena.
+ * Returns the index of the root node, or NO_NODE if the
+ * arena is empty or the expression is malformed. */
+uint32_t
+build_ast(struct arena *a)
+{
+	struct parser p = { a, 0, 0 };
+	uint32_t root;
+
+	if (a->len == 0)
+		return NO_NODE;
+
+	if ((root = parse_expr(&p, BP_SHIFT)) == NO_NODE)
+		return NO_NODE;
+
+	/* Every token must have been consumed */
+	if (p.pos != a->len) {
+		if (a->type[p.pos] == PAREN_CLOSE)
+			arena_error(a, "Syntax error: unmatched \")\"");
+		else if (a->type[p.pos] == COMMA)
+			arena_error(a, "Syntax error: unexpected \",\"");
+		else
+			arena_error(a, "Syntax error: missing operator");
+		return NO_NODE;
+	}
+
+	return root;
+}
+
+/* Parse the number starting at code[i] into *val, and its
+ * token type, VAL or BIGVAL (see lex_bignum()), into *type.
+ * Decimal digits are converted in place, eight at a time.
+ * Returns the index just past the number, or 0 on error. */
+static inline size_t
+lex_number(struct arena *a, const char *code, size_t len, size_t i,
+	   NODE_TYPE *type, uint64_t *val)
 {
-	struct token *curr = head;
-
-	while (head->next->next != NULL) {
-		/* Parentheses */
-		curr = head;
-		while (curr->next != NULL) {
-			if (matches_template(curr->next, paren_template))
-				curr = unwrap(curr);
-			else
-				curr = curr->next;
+	uint64_t acc = 0, chunk;
+	unsigned int base = 10, d;
+	size_t start;
+
+	/* Radix prefixes: 0x, 0b and 0o */
+	if (code[i] == '0' && i + 1 < len) {
+		switch (code[i + 1] | 0x20) {
+		case 'x':
+			base = 16;
+			break;
+
+		case 'b':
+			base = 2;
+			break;
+
+		case 'o':
+			base = 8;
+			break;
 		}
+	}
+
+	if (base != 10) {
+		start = i += 2;
 
-		/* Multiplication and division */
-		curr = head;
-		while (curr->next != NULL) {
-			if (matches_template(curr->next, mul_template)
-			    || matches_template(curr->next, div_template))
-				curr = reduce(curr);
-			else
-				curr = curr->next;
+		while (i < len && (d = digit_table[(unsigned char)code[i]])
+		       != 0 && d <= base) {
+			if (acc > (UINT64_MAX - (d - 1)) / base)
+				goto overflow;
+
+			acc = acc * base + (d - 1);
+			i++;
 		}
+	} else {
+		start = i;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		while (i + 8 <= len) {
+			memcpy(&chunk, code + i, 8);
 
-		/* Addition and subtraction */
-		curr = head;
-		while (curr->next != NULL) {
-			if (matches_template(curr->next, add_template)
-			    || matches_template(curr->next, sub_template))
-				curr = reduce(curr);
-			else
-				curr = curr->next;
+			if (!swar_is_digits(chunk))
+				break;
+
+			if (__builtin_mul_overflow(acc, 100000000, &acc)
+			    || __builtin_add_overflow(acc, swar_parse8(chunk),
+						      &acc))
+				goto overflow;
+
+			i += 8;
 		}
+#endif
+
+		while (i < len && code[i] >= '0' && code[i] <= '9') {
+			if (__builtin_mul_overflow(acc, 10, &acc)
+			    || __builtin_add_overflow(acc, code[i] - '0',
+						      &acc))
+				goto overflow;
 
-		/* Left and Right shift */
-		curr = head;
-		while (curr->next != NULL) {
-			if (matches_template(curr->next, lshift_template)
-			    || matches_template(curr->next, rshift_template))
-				curr = reduce(curr);
-			else
-				curr = curr->next;
+			i++;
 		}
+	}
+
+	if (i == start) {
+		arena_error(a, "Syntax error: missing digits after \"%.2s\"",
+			    code + start - 2);
+		return 0;
+	}
+
+	/* Numbers must not run into letters, or into
+	 * digits that are not valid in their base */
+	if (i < len && (isalnum((unsigned char)code[i]) || code[i] == '_')) {
+		arena_error(a, "Syntax error: invalid digit \"%c\" in number",
+			    code[i]);
+		return 0;
+	}
+
+	*type = VAL;
+	*val = acc;
+	return i;
+
+ overflow:
+	if (a->exact)
+		return lex_bignum(a, code, len, start, base, type, val);
+
+	arena_error(a, "Error: number too large (maximum is %" PRIu64 ")",
+		    UINT64_MAX);
+	return 0;
+}
+
+/* Copy the digits of a number too large for 64 bits, starting
+ * at code[i], to a->text, as its base, the digits and a NUL.
+ * The token becomes a BIGVAL, whose value is their offset.
+ * Returns the index just past the number, or 0 on error. */
+static inline size_t
+lex_bignum(struct arena *a, const char *code, size_t len, size_t i,
+	   unsigned int base, NODE_TYPE *type, uint64_t *val)
+{
+	size_t start = i, n;
+	unsigned int d;
+	char *p;
+
+	while (i < len && (d = digit_table[(unsigned char)code[i]]) != 0
+	       && d <= base)
+		i++;
+
+	if (i < len && (isalnum((unsigned char)code[i]) || code[i] == '_')) {
+		arena_error(a, "Syntax error: invalid digit \"%c\" in number",
+			    code[i]);
+		return 0;
+	}
 
-		/* Power and Modulus */
-		curr = head;
-		while (curr->next != NULL) {
-			if (matches_template(curr->next, power_template)
-			    || matches_template(curr->next, mod_template))
-				curr = reduce(curr);
-			else
-				curr = curr->next;
+	/* Room for the base, the digits and the NUL */
+	n = i - start;
+	if (n + 2 > UINT32_MAX / 2 - a->textlen) {
+		arena_error(a, "Error: number too large!");
+		return 0;
+	}
+
+	if (a->textlen + n + 2 > a->textcap) {
+		uint32_t cap = a->textcap ? a->textcap : 64;
+
+		while (cap < a->textlen + n + 2)
+			cap *= 2;
+
+		if ((p = realloc(a->text, cap)) == NULL) {
+			arena_error(a,
+				    "Error: unable to allocate enough memory!");
+			return 0;
 		}
 
-		/* Unary operators */
-		curr = head;
-		while (curr->next != NULL) {
-			if (matches_template(curr->next, unary_template))
-				curr = unwrap_unary(curr);
-			else
-				curr = curr->next;
+		a->text = p;
+		a->textcap = cap;
+	}
+
+	p = a->text + a->textlen;
+	p[0] = base;
+	memcpy(p + 1, code + start, n);
+	p[n + 1] = '\0';
+
+	*type = BIGVAL;
+	*val = a->textlen;
+	a->textlen += n + 2;
+	return i;
+}
+
+/* Get a built-in function by its FN_* id */
+static inline const struct keyword *
+func_by_id(uint8_t id)
+{
+	return kw_funcs[id - FN_FIRST];
+}
+
+/* Look up the name starting at code[i]: a function, if it's
+ * followed by "(", or else one of a->vars, or a special value.
+ * Its token type is stored in *type, and its FN_* id, index or
+ * value in *val. Returns the index just past the name, or 0 on
+ * error. */
+static inline size_t
+lex_name(struct arena *a, const char *code, size_t len, size_t i,
+	 NODE_TYPE *type, uint64_t *val)
+{
+	const struct keyword *kw;
+	size_t start = i, n, next;
+	double d;
+
+	while (i < len && (isalnum((unsigned char)code[i]) || code[i] == '_'))
+		i++;
+
+	n = i - start;
+
+	for (next = i; next < len && (code[next] == ' '
+				      || code[next] == '\t'); next++)
+		;
+
+	kw = keyword(code + start, n);
+
+	if (next < len && code[next] == '(') {
+		if (kw != NULL && kw->kind == KW_FUNCTION) {
+			*type = FUNCTION;
+			*val = kw->id;
+			a->floating |= kw->floating;
+			return i;
+		}
+	} else {
+		/* Variables hide special values of the same name */
+		for (uint32_t v = 0; a->vars != NULL && v < a->nvars; v++) {
+			if (strlen(a->vars[v]) == n
+			    && memcmp(a->vars[v], code + start, n) == 0) {
+				*type = VAR;
+				*val = v;
+				return i;
+			}
 		}
 
+		if (kw != NULL && kw->kind == KW_CONST) {
+			d = kw->value;
+			memcpy(val, &d, sizeof(d));
+			*type = FVAL;
+			a->floating = true;
+			return i;
+		}
 	}
+
+	arena_error(a, "Unknown %s: \"%.*s\"", next < len && code[next] == '('
+		    ? "function" : "variable", (int)n, code + start);
+	return 0;
 }
 
-/* Parse string */
+/* Tokenize a string of len bytes into the arena.
+ * The string doesn't need to be NUL-terminated, and is never copied. */
 bool
-parse(char *code)
+parse(struct arena *a, const char *code, size_t len)
 {
-	int last_numeric_idx = -1;
+	size_t i = 0, n;
+	uint64_t val;
+	NODE_TYPE op;
+	unsigned char c;
+
+	/* Start from an empty arena */
+	arena_reset(a);
+
+	/* Every token takes at least one character,
+	 * so we never have to grow the arena while lexing */
+	if (len >= NO_NODE) {
+		arena_error(a, "Error: expression too long!");
+		return false;
+	}
+
+	if (!arena_reserve(a, len))
+		return false;
 
-	for (int i = 0, len = strlen(code); i <= len; i++) {
-		char c = code[i];
+	while (i < len) {
+		c = code[i];
 
-		if (c == ' ')
+		/* Skip whitespace */
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			i++;
 			continue;
+		}
 
+		/* Numbers, and special values that start
+		 * with a digit, such as 1Pi */
 		if (c >= '0' && c <= '9') {
-			if (last_numeric_idx == -1)
-				last_numeric_idx = i;
-		} else {
-			if (last_numeric_idx != -1) {
-				int size = i - last_numeric_idx;
+			if (i + 1 < len && isalpha((unsigned char)code[i + 1])
+			    && (n = lex_name(a, code, len, i, &op, &val)) != 0
+			    && op == FVAL) {
+				arena_push(a, op, val);
+				i = n;
+				continue;
+			}
 
-				char *buffer = malloc(size);
+			if ((i = lex_number(a, code, len, i, &op, &val)) == 0)
+				return false;
 
-				strncpy(buffer, (code + last_numeric_idx),
-					size);
-				buffer[size] = '\0';
+			arena_push(a, op, val);
+			continue;
+		}
 
-				token_add_val(atol(buffer));
-				last_numeric_idx = -1;
+		/* Functions and variables */
+		if (isalpha(c) || c == '_') {
+			if ((i = lex_name(a, code, len, i, &op, &val)) == 0)
+				return false;
 
-				free(buffer);
-			}
+			arena_push(a, op, val);
+			continue;
+		}
 
-			/* Check operands */
-			if (c == '+')
-				token_add(ADD);
-			else if (c == '-')
-				token_add(SUB);
-			else if (c == '*')
-				token_add(MUL);
-			else if (c == '/')
-				token_add(DIV);
-			else if (c == '<')
-				token_add(L_SHIFT);
-			else if (c == '>')
-				token_add(R_SHIFT);
-			else if (c == '^')
-				token_add(POWER);
-			else if (c == '%')
-				token_add(MOD);
-			else if (c == '(')
-				token_add(PAREN_OPEN);
-			else if (c == ')')
-				token_add(PAREN_CLOSE);
-			else if (c != ' ' && c != 0 && i > 0) {
-				fprintf(stderr, "Unsupported token: \"%c\"\n",
-					c);
-				return false;
-			}
+		/* Check operands */
+		if ((op = op_table[c]) == VAL) {
+			arena_error(a, "Unsupported token: \"%c\"", c);
+			return false;
 		}
+
+		/* Accept both "<" and "<<", and both ">" and ">>" */
+		if ((op == L_SHIFT || op == R_SHIFT) && i + 1 < len
+		    && code[i + 1] == c)
+			i++;
+
+		arena_push(a, op, 0);
+		i++;
 	}
 
 	return true;
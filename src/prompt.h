@@ -0,0 +1,90 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, prompt.h, reads the lines typed at calc's prompt.
+ * They are read with readline, which is only loaded, with dlopen(),
+ * the first time a line is: loading it, along with the terminal
+ * library it needs, takes longer than any other mode of calc
+ * takes to start and answer, so they never do.
+ *
+ * If readline can't be loaded, lines are read from stdin as they
+ * are, without line editing.
+ *
+ * Usage:
+ * char *line;
+ * while ((line = prompt("calc> ")) != NULL) {
+ * 	...
+ * 	free(line);
+ * }
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* Names readline may be installed under, from the newest */
+static const char *const prompt_libs[] = {
+	"libreadline.so.8", "libreadline.so.7", "libreadline.so.6",
+	"libreadline.so", NULL
+};
+
+static char *(*prompt_readline)(const char *) = NULL;
+static bool prompt_loaded = false;
+
+/* Function prototypes */
+static inline void prompt_load(void);
+static inline char *prompt(const char *);
+
+/* Load readline, once */
+static inline void
+prompt_load(void)
+{
+	void *lib = NULL;
+
+	prompt_loaded = true;
+
+	for (size_t i = 0; lib == NULL && prompt_libs[i] != NULL; i++)
+		lib = dlopen(prompt_libs[i], RTLD_LAZY);
+
+	if (lib != NULL)
+		*(void **)&prompt_readline = dlsym(lib, "readline");
+}
+
+/* Print the prompt, and read a line, without its newline.
+ * Returns it, to be freed, or NULL at EOF. */
+static inline char *
+prompt(const char *str)
+{
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	if (!prompt_loaded)
+		prompt_load();
+
+	if (prompt_readline != NULL)
+		return prompt_readline(str);
+
+	fputs(str, stdout);
+	fflush(stdout);
+
+	if ((len = getline(&line, &cap, stdin)) < 0) {
+		free(line);
+		return NULL;
+	}
+
+	if (len > 0 && line[len - 1] == '\n')
+		line[len - 1] = '\0';
+
+	return line;
+}
+
+#endif
@@ -5,148 +5,1116 @@
  * result from the requested operation to stdout.
  *
  * This file, rpn.c, *does not* use libreadline to take input;
- * Instead, it uses fgetc.
- *
- * This file is used to parse an RPN string, aka Reverse Polish Notation.
+ * Instead, it reads stdin in large blocks, and evaluates every
+ * line of RPN, aka Reverse Polish Notation, straight from them.
  *
  * Example:
  * 	((1 + 2) + (3 + 4)) * 2
  * 	becomes 1 2 + 3 4 + + 2 *
  * 	both should output 20.
  *
+ * Numbers are doubles, and every operator of infix mode works:
+ * + - * / % (fmod), ^ (pow), < and > (multiply or divide by a
+ * power of 2; ">" truncates, like shifting integers does).
+ * Each line is evaluated on its own, and prints the value on top
+ * of the stack; a line that can't be evaluated prints an error,
+ * with its line number, instead. The stack grows as needed.
+ *
+ * A line of RPN can also be compiled once, by rpn_compile(), into
+ * a program whose "$1", "$2"... are placeholders for the values
+ * on each line read by rpn_run(): "$1 $2 * 100 /" run over
+ * "25, 8" prints 2. Constant operands are folded, the stack depth
+ * is checked once, and, with GCC and Clang, each instruction holds
+ * the address of the code that runs it (direct threading), so a
+ * line only costs parsing its values and a jump per instruction.
+ *
+ * In RPN mode, lines often share a shape, the same operators on
+ * different numbers. Once two lines in a row do, the lines after
+ * them that still do are run RPN_LANES at a time: their numbers
+ * are loaded into lanes, and every operator is applied to all of
+ * the lanes at once, by loops the compiler vectorises (see
+ * rpn_exec_lanes()). Lanes dividing by zero are masked out, and
+ * reported on their own.
+ *
  * Made by Salonia Matteo <saloniamatteo@pm.me>
  *
  */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "mathfn.h"
+
+#define RPN_STACK 64		/* Values the stack starts with */
+#define RPN_SLOTS 4096		/* Values a compiled program can use */
+#define RPN_LANES 8		/* Lines with the same shape run at once */
+
+/* rpn_line() is faster on its own than inlined into rpn_lines(),
+ * where the lanes compete with it for registers */
+#ifdef __GNUC__
+#define RPN_NOINLINE __attribute__((noinline))
+#else
+#define RPN_NOINLINE
+#endif
+
+#define rpnErr(line, err) \
+	fprintf(stderr, "RPN: line %" PRIu64 ": %s\n", (line), (err))
 
-#define BUFSIZE 100		/* size of buffer for getch/ungetch */
-#define MAXVAL 100		/* maximum depth of val stack */
-#define MAXOP 100		/* max size of operand or operator */
-#define NUMBER '0'		/* signal that a number was found */
+/* Instructions of compiled RPN */
+enum rpn_opcode {
+	RPN_CONST,		/* Push a constant */
+	RPN_SLOT,		/* Push a value of the line */
+	RPN_ADD,		/* a + b */
+	RPN_SUB,		/* a - b */
+	RPN_MUL,		/* a * b */
+	RPN_DIV,		/* a / b */
+	RPN_MOD,		/* fmod(a, b) */
+	RPN_POW,		/* pow(a, b) */
+	RPN_SHL,		/* a < b */
+	RPN_SHR,		/* a > b */
+	RPN_END			/* Stop, the result is on top of the stack */
+};
 
-#define rpnErr(err) fprintf(stderr, "RPN: %s", err)
+/* Instruction of compiled RPN */
+struct rpn_insn {
+	const void *target;	/* Code running op, once threaded */
+	double val;		/* Constant, for RPN_CONST */
+	uint32_t op;		/* RPN_* opcode */
+	uint32_t slot;		/* Index of the value, for RPN_SLOT */
+};
 
-/* Global variables */
-static char buf[BUFSIZE];	/* buffer for ungetch */
-static int bufp = 0;		/* next free position in buf */
-static int sp = 0;		/* next free stack position */
-static double val[MAXVAL];	/* value stack */
+/* Compiled RPN */
+struct rpn_prog {
+	struct rpn_insn *code;	/* Instructions, terminated by RPN_END */
+	size_t len;		/* Instructions, including RPN_END */
+	size_t cap;		/* Instructions allocated */
+	size_t depth;		/* Deepest stack the program reaches */
+	uint32_t slots;		/* Values each line must have */
+	double *stack;		/* Value stack, depth entries */
+	double *in;		/* Values of the current line */
+	bool threaded;		/* Do the targets point to rpn_exec()? */
+	const char *err;	/* Why compiling, or the last line, failed */
+};
+
+/* RPN evaluator state */
+struct rpn {
+	double *stack;		/* Value stack */
+	size_t cap;		/* Values allocated */
+	char *num;		/* Copy of a number, for strtod() */
+	size_t numcap;		/* Bytes allocated */
+	const char *err;	/* Why the last line failed */
+
+	/* Shapes of lines: 'n' for a number, or the operator, for
+	 * each token. rpn_line() only keeps a hash of them. */
+	uint64_t hash;		/* Of the last line rpn_line() evaluated */
+	uint64_t prevhash;	/* Of the line before it */
+	char *shape;		/* Shape of the lines run in lanes */
+	size_t shapelen;
+	size_t shapecap;
+
+	/* Lines run in lanes */
+	struct rpn_prog lanes;	/* Shape, with a slot per number */
+	uint64_t lines[RPN_LANES];	/* Line number of each lane */
+	double res[RPN_LANES];	/* Result of each lane */
+	uint8_t bad[RPN_LANES];	/* Did the lane divide by zero? */
+	unsigned int nlanes;	/* Lanes loaded */
+	bool inlanes;		/* Are lines being loaded into lanes? */
+};
+
+/* Operators, in the order of their RPN_* opcodes, from RPN_ADD */
+static const char rpn_ops[] = "+-*/%^<>";
+
+/* Powers of 10 that are exact doubles */
+static const double pow10_exact[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
 
 /* Function prototypes */
-static int getch(void);
-static void ungetch(int);
-static int getop(char *);
-static void push(double);
-static double pop(void);
+static bool rpn_copy(struct rpn *, const char *, size_t);
+static inline const char *rpn_number(struct rpn *, const char *,
+				     const char *, double *);
+static inline double rpn_shift(double, double, bool);
+static inline bool rpn_apply(char, double, double, double *);
+static inline bool rpn_op(struct rpn *, char, size_t *);
+RPN_NOINLINE static bool rpn_line(struct rpn *, const char *, size_t,
+				  double *);
+static bool rpn_print(struct outbuf *, double);
+static void rpn_free(struct rpn *);
+static bool rpn_emit(struct rpn_prog *, uint32_t, double, uint32_t);
+bool rpn_compile(struct rpn_prog *, const char *);
+static inline bool rpn_exec(struct rpn_prog *, double *);
+static const char *rpn_field(struct rpn *, const char *, const char *,
+			     double *);
+static bool rpn_tuple(struct rpn *, struct rpn_prog *, const char *,
+		      size_t, double *);
+static bool rpn_shape(struct rpn *, const char *, size_t);
+static bool rpn_repeat(struct rpn *, const char *, size_t);
+static bool rpn_lane(struct rpn *, const char *, size_t);
+SIMD_CLONES static void rpn_exec_lanes(const struct rpn_insn *,
+				       const double *, double *, double *,
+				       uint8_t *);
+static bool rpn_flush(struct rpn *, struct outbuf *, bool *);
+static int rpn_lines(struct rpn *, struct rpn_prog *, int, int);
+int rpn_run(struct rpn_prog *, int, int);
+void rpn_prog_free(struct rpn_prog *);
 int rpnInit(void);
 
 /* Function declarations */
-/* getch: get a (possibly pushed back) character */
-static int
-getch(void)
+/* Copy the len bytes at s to r->num, followed by a NUL.
+ * Returns false if there's no memory for them. */
+static bool
+rpn_copy(struct rpn *r, const char *s, size_t len)
 {
-	return (bufp > 0) ? buf[--bufp] : fgetc(stdin);
+	if (len >= r->numcap) {
+		size_t cap = len * 2 + 32;
+		char *p = realloc(r->num, cap);
+
+		if (p == NULL)
+			return false;
+
+		r->num = p;
+		r->numcap = cap;
+	}
+
+	memcpy(r->num, s, len);
+	r->num[len] = '\0';
+	return true;
 }
 
-/* ungetch: push character back on input */
-static void
-ungetch(int c)
+/* Parse the number made of the digits and dots starting at s,
+ * which ends before end, into *val. Numbers with up to 19
+ * digits, and a power of 10 that is an exact double, are exact
+ * in a single multiplication or division; others are left to
+ * strtod(). Returns the end of the number, or NULL if there's
+ * no memory for strtod()'s copy. */
+static inline const char *
+rpn_number(struct rpn *r, const char *s, const char *end, double *val)
 {
-	if (bufp >= BUFSIZE) {
-		rpnErr("Ungetch Error: Too Many Characters!\n");
-	} else {
-		buf[bufp++] = c;
+	const char *start = s, *frac = NULL;
+	uint64_t m = 0;
+	ptrdiff_t scale;
+
+	/* Past 19 digits, m is wrong, but isn't used */
+	for (; s < end && (unsigned char)(*s - '0') < 10; s++)
+		m = m * 10 + (*s - '0');
+
+	if (s < end && *s == '.') {
+		for (frac = ++s; s < end && (unsigned char)(*s - '0') < 10;
+		     s++)
+			m = m * 10 + (*s - '0');
+	}
+
+	scale = frac != NULL ? frac - s : 0;
+
+	if (s - start - (frac != NULL) <= 19 && m < (1ULL << 53)
+	    && scale >= -22) {
+		*val = scale < 0 ? (double)m / pow10_exact[-scale] : (double)m;
+		return s;
 	}
+
+	/* strtod() needs the number on its own */
+	if (!rpn_copy(r, start, s - start))
+		return NULL;
+
+	*val = strtod(r->num, NULL);
+	return s;
 }
 
-/* getop: get next operator or numeric operand */
-static int
-getop(char *s)
+/* Multiply a by 2 ^ b, if left is set, or divide it by 2 ^ b,
+ * dropping the fraction, like shifting integers does */
+static inline double
+rpn_shift(double a, double b, bool left)
 {
-	int i, c;
+	/* Shifting past these leaves 0, or infinity, anyway */
+	double shift = b < -4096 ? -4096 : b > 4096 ? 4096 : b;
 
-	while ((s[0] = c = getch()) == ' ' || c == '\t') ;
-	s[1] = '\0';
+	return left ? ldexp(a, (int)shift) : trunc(ldexp(a, -(int)shift));
+}
 
-	if (!isdigit(c) && c != '.')
-		return c;	/* not a number */
-	i = 0;
+/* Store a op b in *res. Returns false if it divides by zero. */
+static inline bool
+rpn_apply(char op, double a, double b, double *res)
+{
+	switch (op) {
+	case '+':
+		*res = a + b;
+		break;
+	case '-':
+		*res = a - b;
+		break;
+	case '*':
+		*res = a * b;
+		break;
+	case '/':
+	case '%':
+		if (b == 0)
+			return false;
+		*res = op == '/' ? a / b : fmod(a, b);
+		break;
+	case '^':
+		*res = pow(a, b);
+		break;
+	default:
+		*res = rpn_shift(a, b, op == '<');
+	}
 
-	if (isdigit(c))		/* collect integer part */
-		while (isdigit(s[++i] = c = getch())) ;
+	return true;
+}
 
-	if (c == '.')		/* collect fraction part */
-		while (isdigit(s[++i] = c = getch())) ;
-	s[i] = '\0';
+/* Apply the operator op to the two values on top of the stack of
+ * *sp values, replacing them with the result. Returns false, with
+ * r->err set, if op isn't an operator, or can't be applied. */
+static inline bool
+rpn_op(struct rpn *r, char op, size_t *sp)
+{
+	double *a, b;
 
-	if (c != EOF)
-		ungetch(c);
+	switch (op) {
+	case '+':
+	case '-':
+	case '*':
+	case '/':
+	case '%':
+	case '^':
+	case '<':
+	case '>':
+		break;
+	default:
+		r->err = "Error: Could not Parse String!";
+		return false;
+	}
+
+	if (*sp < 2) {
+		r->err = "Error: Stack is Empty!";
+		return false;
+	}
+
+	b = r->stack[--*sp];
+	a = &r->stack[*sp - 1];
+
+	if (!rpn_apply(op, *a, b, a)) {
+		r->err = "Error: Division by Zero!";
+		return false;
+	}
+
+	return true;
+}
+
+/* Evaluate a line of len bytes, leaving the value on top of the
+ * stack in *result, and the hash of its shape in r->hash. Returns
+ * false, with r->err set, if the line couldn't be evaluated, or
+ * with r->err set to NULL if it was blank. */
+RPN_NOINLINE static bool
+rpn_line(struct rpn *r, const char *s, size_t len, double *result)
+{
+	const char *end = s + len;
+	uint64_t hash = 1;
+	size_t sp = 0;
+	char c;
+
+	r->err = NULL;
+	r->hash = 0;
+
+	while (s < end) {
+		c = *s;
+
+		if (c == ' ' || c == '\t' || c == '\r') {
+			s++;
+			continue;
+		}
+
+		/* Numbers */
+		if ((c >= '0' && c <= '9') || c == '.') {
+			if (sp == r->cap) {
+				size_t cap = r->cap ? r->cap * 2 : RPN_STACK;
+				double *p = realloc(r->stack,
+						    cap * sizeof(*p));
+
+				if (p == NULL) {
+					r->err = "Error: unable to allocate "
+						 "enough memory!";
+					return false;
+				}
+
+				r->stack = p;
+				r->cap = cap;
+			}
+
+			if ((s = rpn_number(r, s, end, &r->stack[sp]))
+			    == NULL) {
+				r->err = "Error: unable to allocate "
+					 "enough memory!";
+				return false;
+			}
+
+			sp++;
+			hash = hash * 31 + 'n';
+			continue;
+		}
+
+		/* Operators */
+		if (!rpn_op(r, c, &sp))
+			return false;
+
+		hash = hash * 31 + c;
+		s++;
+
+		/* Accept "<<" and ">>" too, like infix mode does */
+		if (s < end && *s == c && (c == '<' || c == '>'))
+			s++;
+	}
+
+	if (sp == 0)
+		return false;
+
+	*result = r->stack[sp - 1];
+	r->hash = hash;
+	return true;
+}
+
+/* Append a value, after a tab, to the output buffer */
+static bool
+rpn_print(struct outbuf *out, double val)
+{
+	uint64_t bits;
+
+	/* Raw values are 8 bytes each, and nothing else */
+	if (out_fmt != FMT_RAW) {
+		if (!out_reserve(out, 1))
+			return false;
+		out->buf[out->len++] = '\t';
+	}
 
-	return NUMBER;
+	memcpy(&bits, &val, sizeof(bits));
+	return out_double(out, bits);
 }
 
-/* push: push f onto value stack */
+/* Release the memory held by an RPN evaluator */
 static void
-push(double f)
+rpn_free(struct rpn *r)
 {
-	if (sp < MAXVAL)
-		val[sp++] = f;
-	else
-		rpnErr("Error: Stack is Full!\n");
+	free(r->stack);
+	free(r->num);
+	free(r->shape);
+	rpn_prog_free(&r->lanes);
+	memset(r, 0, sizeof(*r));
 }
 
-/* pop: pop and return top value from stack */
-static double
-pop(void)
+/* Append an instruction to the program.
+ * Returns false if there's no memory for it. */
+static bool
+rpn_emit(struct rpn_prog *p, uint32_t op, double val, uint32_t slot)
 {
-	if (sp > 0)
-		return val[--sp];
-	else {
-		rpnErr("Error: Stack is Empty!\n");
-		return 0.0;
+	if (p->len == p->cap) {
+		size_t cap = p->cap ? p->cap * 2 : 16;
+		struct rpn_insn *code = realloc(p->code, cap * sizeof(*code));
+
+		if (code == NULL)
+			return false;
+
+		p->code = code;
+		p->cap = cap;
 	}
+
+	p->code[p->len++] = (struct rpn_insn){ NULL, val, op, slot };
+	return true;
 }
 
-/* rpmInit: enter RPM mode */
-int
-rpnInit(void)
+/* Compile a line of RPN into p, which must be zeroed, or freed by
+ * rpn_prog_free(). "$N" stands for the Nth value of each line
+ * run through the program. Returns false, with p->err set, if the
+ * line can't be compiled. */
+bool
+rpn_compile(struct rpn_prog *p, const char *src)
+{
+	struct rpn r = { 0 };
+	const char *s = src, *end = src + strlen(src), *op;
+	struct rpn_insn *top;
+	size_t depth = 0;
+	unsigned long n;
+	double val;
+	char *e;
+	bool ok = false;
+
+	while (s < end) {
+		if (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') {
+			s++;
+			continue;
+		}
+
+		/* Constants */
+		if ((*s >= '0' && *s <= '9') || *s == '.') {
+			if ((s = rpn_number(&r, s, end, &val)) == NULL
+			    || !rpn_emit(p, RPN_CONST, val, 0))
+				goto nomem;
+
+			depth++;
+
+		/* Placeholders */
+		} else if (*s == '$') {
+			if (s[1] < '0' || s[1] > '9'
+			    || (n = strtoul(s + 1, &e, 10)) == 0
+			    || n > RPN_SLOTS) {
+				p->err = "Error: Placeholders go from $1 to "
+					 "$4096!";
+				goto out;
+			}
+
+			if (!rpn_emit(p, RPN_SLOT, 0, n - 1))
+				goto nomem;
+
+			if (n > p->slots)
+				p->slots = n;
+
+			depth++;
+			s = e;
+
+		/* Operators */
+		} else if ((op = memchr(rpn_ops, *s, sizeof(rpn_ops) - 1))
+			   != NULL) {
+			if (depth < 2) {
+				p->err = "Error: Stack is Empty!";
+				goto out;
+			}
+
+			depth--;
+			top = p->code + p->len;
+
+			/* Fold operators on two constants, unless they
+			 * fail: then, every line fails with them */
+			if (p->len >= 2 && top[-1].op == RPN_CONST
+			    && top[-2].op == RPN_CONST
+			    && rpn_apply(*op, top[-2].val, top[-1].val, &val)) {
+				top[-2].val = val;
+				p->len--;
+			} else if (!rpn_emit(p, RPN_ADD + (op - rpn_ops), 0,
+					     0)) {
+				goto nomem;
+			}
+
+			/* Accept "<<" and ">>" too, like infix mode does */
+			if (++s < end && *s == *op
+			    && (*op == '<' || *op == '>'))
+				s++;
+		} else {
+			p->err = "Error: Could not Parse String!";
+			goto out;
+		}
+
+		if (depth > p->depth)
+			p->depth = depth;
+	}
+
+	if (depth == 0) {
+		p->err = "Error: Stack is Empty!";
+		goto out;
+	}
+
+	if (!rpn_emit(p, RPN_END, 0, 0)
+	    || (p->stack = malloc(p->depth * sizeof(*p->stack))) == NULL
+	    || (p->in = calloc(p->slots + 1, sizeof(*p->in))) == NULL)
+		goto nomem;
+
+	ok = true;
+	goto out;
+
+ nomem:
+	p->err = "Error: unable to allocate enough memory!";
+
+ out:
+	rpn_free(&r);
+	return ok;
+}
+
+/* Run a compiled program on the values in p->in, storing the
+ * result in *result. Returns false, with p->err set, if it
+ * divides by zero. With GCC and Clang, the program is threaded
+ * the first time it runs, and every instruction then jumps
+ * straight to the next one's code; elsewhere, instructions are
+ * dispatched with a plain switch. */
+static inline bool
+rpn_exec(struct rpn_prog *p, double *result)
+{
+	const struct rpn_insn *pc = p->code;
+	const double *in = p->in;
+	double *sp = p->stack, b;
+
+#ifdef __GNUC__
+	static const void *const targets[] = {
+		[RPN_CONST] = &&target_RPN_CONST,
+		[RPN_SLOT] = &&target_RPN_SLOT,
+		[RPN_ADD] = &&target_RPN_ADD,
+		[RPN_SUB] = &&target_RPN_SUB,
+		[RPN_MUL] = &&target_RPN_MUL,
+		[RPN_DIV] = &&target_RPN_DIV,
+		[RPN_MOD] = &&target_RPN_MOD,
+		[RPN_POW] = &&target_RPN_POW,
+		[RPN_SHL] = &&target_RPN_SHL,
+		[RPN_SHR] = &&target_RPN_SHR,
+		[RPN_END] = &&target_RPN_END,
+	};
+
+	if (!p->threaded) {
+		for (size_t i = 0; i < p->len; i++)
+			p->code[i].target = targets[p->code[i].op];
+
+		p->threaded = true;
+	}
+#define TARGET(op)	case op: target_##op
+#define NEXT()		goto *(pc++)->target
+#else
+#define TARGET(op)	case op
+#define NEXT()		continue
+#endif
+
+	/* pc points past the running instruction, pc[-1];
+	 * sp points to the next free slot, the top is sp[-1] */
+	for (;;) {
+		switch ((pc++)->op) {
+		TARGET(RPN_CONST):
+			*sp++ = pc[-1].val;
+			NEXT();
+
+		TARGET(RPN_SLOT):
+			*sp++ = in[pc[-1].slot];
+			NEXT();
+
+		TARGET(RPN_ADD):
+			b = *--sp;
+			sp[-1] += b;
+			NEXT();
+
+		TARGET(RPN_SUB):
+			b = *--sp;
+			sp[-1] -= b;
+			NEXT();
+
+		TARGET(RPN_MUL):
+			b = *--sp;
+			sp[-1] *= b;
+			NEXT();
+
+		TARGET(RPN_DIV):
+			if ((b = *--sp) == 0)
+				goto div_zero;
+			sp[-1] /= b;
+			NEXT();
+
+		TARGET(RPN_MOD):
+			if ((b = *--sp) == 0)
+				goto div_zero;
+			sp[-1] = fmod(sp[-1], b);
+			NEXT();
+
+		TARGET(RPN_POW):
+			b = *--sp;
+			sp[-1] = pow(sp[-1], b);
+			NEXT();
+
+		TARGET(RPN_SHL):
+			b = *--sp;
+			sp[-1] = rpn_shift(sp[-1], b, true);
+			NEXT();
+
+		TARGET(RPN_SHR):
+			b = *--sp;
+			sp[-1] = rpn_shift(sp[-1], b, false);
+			NEXT();
+
+		TARGET(RPN_END):
+			*result = sp[-1];
+			return true;
+		}
+	}
+
+ div_zero:
+	p->err = "Error: Division by Zero!";
+	return false;
+}
+
+#undef TARGET
+#undef NEXT
+
+/* Parse the value starting at s, which ends before end, or at a
+ * space, tab or comma, into *val. Plain numbers, with an optional
+ * sign, are parsed by rpn_number(); others, such as "1e9", by
+ * strtod(). Returns the end of the value, or NULL, with r->err
+ * set, if it isn't a number. */
+static const char *
+rpn_field(struct rpn *r, const char *s, const char *end, double *val)
+{
+	const char *start = s, *p;
+	bool neg = s < end && *s == '-';
+	char *e;
+
+	if (s < end && (*s == '-' || *s == '+'))
+		s++;
+
+	if ((p = rpn_number(r, s, end, val)) == NULL) {
+		r->err = "Error: unable to allocate enough memory!";
+		return NULL;
+	}
+
+	if (p > s && (p == end || *p == ' ' || *p == '\t' || *p == ','
+		      || *p == '\r')) {
+		*val = neg ? -*val : *val;
+		return p;
+	}
+
+	for (p = start; p < end && *p != ' ' && *p != '\t' && *p != ','
+	     && *p != '\r'; p++)
+		;
+
+	if (!rpn_copy(r, start, p - start)) {
+		r->err = "Error: unable to allocate enough memory!";
+		return NULL;
+	}
+
+	*val = strtod(r->num, &e);
+	if (e != r->num + (p - start)) {
+		r->err = "Error: Not a Number!";
+		return NULL;
+	}
+
+	return p;
+}
+
+/* Run the program on the values of a line of len bytes, separated
+ * by spaces, tabs or commas, leaving the result in *result. Values
+ * past the last one the program uses are ignored. Returns false,
+ * with r->err set, if the program couldn't be run, or with r->err
+ * set to NULL if the line was blank. */
+static bool
+rpn_tuple(struct rpn *r, struct rpn_prog *p, const char *s, size_t len,
+	  double *result)
 {
-	int type;
-	double op2;
-	char s[MAXOP];
+	const char *end = s + len;
+	uint32_t n = 0;
+
+	r->err = NULL;
 
-	while ((type = getop(s)) != EOF) {
-		switch (type) {
-		case NUMBER:
-			push(atof(s));
+	for (;;) {
+		while (s < end && (*s == ' ' || *s == '\t' || *s == ','
+				   || *s == '\r'))
+			s++;
+
+		if (n == p->slots || s == end)
 			break;
-		case '+':
-			push(pop() + pop());
+
+		if ((s = rpn_field(r, s, end, &p->in[n++])) == NULL)
+			return false;
+	}
+
+	/* Blank lines */
+	if (n == 0 && s == end)
+		return false;
+
+	if (n < p->slots) {
+		r->err = "Error: Too few Values!";
+		return false;
+	}
+
+	if (!rpn_exec(p, result)) {
+		r->err = p->err;
+		return false;
+	}
+
+	return true;
+}
+
+/* Compile the shape of a line of len bytes, which rpn_line() has
+ * evaluated, into r->lanes, with a slot for each number, and room
+ * for RPN_LANES values in every slot and stack entry; the shape
+ * itself is kept in r->shape. Returns false if there's no memory
+ * for them. */
+static bool
+rpn_shape(struct rpn *r, const char *s, size_t len)
+{
+	struct rpn_prog *p = &r->lanes;
+	const char *end = s + len;
+	size_t depth = 0;
+	double *stack, *in, val;
+	char *shape;
+
+	if (len >= r->shapecap) {
+		if ((shape = realloc(r->shape, len + 1)) == NULL)
+			return false;
+
+		r->shape = shape;
+		r->shapecap = len + 1;
+	}
+
+	r->shapelen = p->len = p->depth = p->slots = 0;
+
+	while (s < end) {
+		if (*s == ' ' || *s == '\t' || *s == '\r') {
+			s++;
+		} else if ((*s >= '0' && *s <= '9') || *s == '.') {
+			if ((s = rpn_number(r, s, end, &val)) == NULL
+			    || !rpn_emit(p, RPN_SLOT, 0, p->slots++))
+				return false;
+
+			r->shape[r->shapelen++] = 'n';
+			if (++depth > p->depth)
+				p->depth = depth;
+		} else {
+			if (!rpn_emit(p, RPN_ADD + (strchr(rpn_ops, *s)
+						    - rpn_ops), 0, 0))
+				return false;
+
+			r->shape[r->shapelen++] = *s;
+			depth--;
+
+			if (++s < end && *s == s[-1]
+			    && (*s == '<' || *s == '>'))
+				s++;
+		}
+	}
+
+	if (!rpn_emit(p, RPN_END, 0, 0))
+		return false;
+
+	if ((stack = realloc(p->stack, p->depth * RPN_LANES
+			     * sizeof(*stack))) == NULL)
+		return false;
+	p->stack = stack;
+
+	if ((in = realloc(p->in, p->slots * RPN_LANES * sizeof(*in)))
+	    == NULL)
+		return false;
+	p->in = in;
+
+	return true;
+}
+
+/* Check whether the line of len bytes rpn_line() just evaluated
+ * seems to have the same shape as the one before it; if so,
+ * compile its shape for the lanes. Returns true if the next lines
+ * can be loaded into lanes: if the hashes of the shapes only
+ * matched by chance, rpn_lane() finds out. */
+static bool
+rpn_repeat(struct rpn *r, const char *s, size_t len)
+{
+	bool same = r->hash != 0 && r->hash == r->prevhash;
+
+	r->prevhash = r->hash;
+	return same && rpn_shape(r, s, len);
+}
+
+/* Load the numbers of a line of len bytes into the next lane, if
+ * the line is shaped like r->shape. Returns false if it isn't, or
+ * if there's no memory to parse a number: the line is then left
+ * to rpn_line(). */
+static bool
+rpn_lane(struct rpn *r, const char *s, size_t len)
+{
+	const char *end = s + len, *shape = r->shape;
+	double *in = r->lanes.in + r->nlanes;
+	size_t i = 0;
+	char c;
+
+	while (s < end) {
+		c = *s;
+
+		if (c == ' ' || c == '\t' || c == '\r') {
+			s++;
+			continue;
+		}
+
+		if (i == r->shapelen)
+			return false;
+
+		if ((c >= '0' && c <= '9') || c == '.') {
+			if (shape[i++] != 'n'
+			    || (s = rpn_number(r, s, end, in)) == NULL)
+				return false;
+
+			in += RPN_LANES;
+			continue;
+		}
+
+		if (shape[i++] != c)
+			return false;
+
+		/* Accept "<<" and ">>" too, like infix mode does */
+		if (++s < end && *s == c && (c == '<' || c == '>'))
+			s++;
+	}
+
+	return i == r->shapelen;
+}
+
+/* Run a program over RPN_LANES lines at once: in holds RPN_LANES
+ * values per slot, and stack RPN_LANES values per entry, one
+ * lane after the other, so every operator is a loop over
+ * RPN_LANES values. Stores the result of each lane in res, and
+ * sets bad for the lanes that divided by zero. */
+SIMD_CLONES static void
+rpn_exec_lanes(const struct rpn_insn *pc, const double *in, double *stack,
+	       double *res, uint8_t *bad)
+{
+#define TOP(n)	(stack + (sp - (n)) * RPN_LANES)
+	double *x = stack, *y = stack;
+	size_t sp = 0;
+	int i;
+
+	for (;; pc++) {
+		/* Binary operators pop b into y, and leave a op b in x */
+		if (pc->op >= RPN_ADD && pc->op < RPN_END) {
+			y = TOP(1);
+			x = TOP(2);
+			sp--;
+		}
+
+		switch (pc->op) {
+		case RPN_CONST:
+			x = TOP(0);
+			for (i = 0; i < RPN_LANES; i++)
+				x[i] = pc->val;
+			sp++;
 			break;
-		case '*':
-			push(pop() * pop());
+
+		case RPN_SLOT:
+			memcpy(TOP(0), in + (size_t)pc->slot * RPN_LANES,
+			       RPN_LANES * sizeof(*in));
+			sp++;
 			break;
-		case '-':
-			op2 = pop();
-			push(pop() - op2);
+
+		case RPN_ADD:
+			for (i = 0; i < RPN_LANES; i++)
+				x[i] += y[i];
 			break;
-		case '/':
-			op2 = pop();
-			if (op2 != 0.0)
-				push(pop() / op2);
-			else
-				rpnErr("Error: Division by Zero!\n");
+
+		case RPN_SUB:
+			for (i = 0; i < RPN_LANES; i++)
+				x[i] -= y[i];
+			break;
+
+		case RPN_MUL:
+			for (i = 0; i < RPN_LANES; i++)
+				x[i] *= y[i];
 			break;
-		case '\n':
-			printf("\t%.8g\n", pop());
+
+		/* Lanes dividing by zero are masked out */
+		case RPN_DIV:
+			for (i = 0; i < RPN_LANES; i++) {
+				bad[i] |= y[i] == 0;
+				x[i] = y[i] == 0 ? 0 : x[i] / y[i];
+			}
 			break;
-		default:
-			rpnErr("Error: Could not Parse String!\n");
+
+		case RPN_MOD:
+			for (i = 0; i < RPN_LANES; i++) {
+				bad[i] |= y[i] == 0;
+				x[i] = y[i] == 0 ? 0 : fmod(x[i], y[i]);
+			}
+			break;
+
+		case RPN_POW:
+			for (i = 0; i < RPN_LANES; i++)
+				x[i] = pow(x[i], y[i]);
+			break;
+
+		case RPN_SHL:
+			for (i = 0; i < RPN_LANES; i++)
+				x[i] = rpn_shift(x[i], y[i], true);
+			break;
+
+		case RPN_SHR:
+			for (i = 0; i < RPN_LANES; i++)
+				x[i] = rpn_shift(x[i], y[i], false);
+			break;
+
+		case RPN_END:
+			memcpy(res, TOP(1), RPN_LANES * sizeof(*res));
+			return;
+		}
+	}
+
+#undef TOP
+}
+
+/* Run the lanes loaded so far, appending their results to out,
+ * and reporting the lanes that divided by zero. Returns false if
+ * there's no memory for the results. */
+static bool
+rpn_flush(struct rpn *r, struct outbuf *out, bool *failed)
+{
+	if (r->nlanes == 0)
+		return true;
+
+	memset(r->bad, 0, sizeof(r->bad));
+	rpn_exec_lanes(r->lanes.code, r->lanes.in, r->lanes.stack, r->res,
+		       r->bad);
+
+	for (unsigned int i = 0; i < r->nlanes; i++) {
+		if (r->bad[i]) {
+			rpnErr(r->lines[i], "Error: Division by Zero!");
+			*failed = true;
+		} else if (!rpn_print(out, r->res[i])) {
+			return false;
+		}
+	}
+
+	r->nlanes = 0;
+	return true;
+}
+
+/* Evaluate every line read from fd, writing the results to outfd:
+ * lines are RPN, or, if p is set, values p is run on. Input is
+ * read a block at a time: on a terminal, a block is a line.
+ * Returns 0, or 1 if some line failed. */
+static int
+rpn_lines(struct rpn *r, struct rpn_prog *p, int fd, int outfd)
+{
+	struct outbuf in = { 0 }, out = { 0 };
+	const char *line, *end, *nl;
+	uint64_t lineno = 0;
+	ssize_t n;
+	double result;
+	bool eof = false, failed = false, ok;
+
+	while (!eof) {
+		/* Start with a block, and make room for lines
+		 * longer than the buffer */
+		if (in.len == in.cap && !out_reserve(&in, in.cap + 1)) {
+			fprintf(stderr, "Error: unable to allocate "
+				"enough memory!\n");
+			failed = true;
+			break;
+		}
+
+		if ((n = read(fd, in.buf + in.len, in.cap - in.len)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("read");
+			failed = true;
+			break;
+		}
+
+		in.len += n;
+		eof = n == 0;
+
+		/* Evaluate every complete line, and the last one at EOF */
+		line = in.buf;
+		end = in.buf + in.len;
+
+		while (line < end) {
+			if ((nl = memchr(line, '\n', end - line)) == NULL) {
+				if (!eof)
+					break;
+				nl = end;
+			}
+
+			lineno++;
+
+			if (p != NULL) {
+				ok = rpn_tuple(r, p, line, nl - line, &result);
+			} else if (r->inlanes && rpn_lane(r, line, nl - line)) {
+				/* Shaped like the lines before it: run it
+				 * along with them, once the lanes are full */
+				r->lines[r->nlanes++] = lineno;
+
+				if (r->nlanes == RPN_LANES
+				    && !rpn_flush(r, &out, &failed))
+					goto nomem;
+
+				line = nl < end ? nl + 1 : end;
+				continue;
+			} else {
+				/* The lanes' results come first */
+				if (!rpn_flush(r, &out, &failed))
+					goto nomem;
+
+				ok = rpn_line(r, line, nl - line, &result);
+				r->inlanes = rpn_repeat(r, line, nl - line);
+			}
+
+			if (ok) {
+				if (!rpn_print(&out, result))
+					goto nomem;
+			} else if (r->err != NULL) {
+				rpnErr(lineno, r->err);
+				failed = true;
+			}
+
+			line = nl < end ? nl + 1 : end;
+		}
+
+		if (!rpn_flush(r, &out, &failed))
+			goto nomem;
+
+		if (!write_all(outfd, out.buf, out.len)) {
+			perror("write");
+			failed = true;
 			break;
 		}
+		out.len = 0;
+
+		/* Carry the incomplete last line over */
+		in.len = line < end ? (size_t)(end - line) : 0;
+		memmove(in.buf, line, in.len);
 	}
-	return 0;
+
+	goto out;
+
+ nomem:
+	fprintf(stderr, "Error: unable to allocate enough memory!\n");
+	failed = true;
+
+ out:
+	free(in.buf);
+	free(out.buf);
+
+	return failed ? 1 : 0;
+}
+
+/* Run a compiled program over every line read from fd, writing
+ * the results to outfd. Returns 0, or 1 if some line failed. */
+int
+rpn_run(struct rpn_prog *p, int fd, int outfd)
+{
+	struct rpn r = { 0 };
+	int status = rpn_lines(&r, p, fd, outfd);
+
+	rpn_free(&r);
+	return status;
+}
+
+/* Release the memory held by a compiled program */
+void
+rpn_prog_free(struct rpn_prog *p)
+{
+	free(p->code);
+	free(p->stack);
+	free(p->in);
+	memset(p, 0, sizeof(*p));
+}
+
+/* rpnInit: enter RPN mode, evaluating every line of stdin,
+ * until EOF. Returns 0, or 1 if some line failed. */
+int
+rpnInit(void)
+{
+	struct rpn r = { 0 };
+	int status;
+
+	/* Anything printed so far must come before our results */
+	fflush(stdout);
+
+	status = rpn_lines(&r, NULL, STDIN_FILENO, STDOUT_FILENO);
+	rpn_free(&r);
+
+	return status;
 }
@@ -0,0 +1,533 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, serve.h, turns calc into a daemon: it listens on a
+ * Unix domain socket, and answers every line a client sends with
+ * the result of evaluating it, so that programs needing many
+ * results don't have to start calc for each one.
+ *
+ * Every worker thread has its own epoll instance, its own
+ * evaluator, and the connections it accepted: a request is read,
+ * evaluated and answered by the same thread, without ever being
+ * handed over to another one. All workers wait on the listening
+ * socket, and the kernel wakes one of them for each new client.
+ *
+ * Requests are newline-terminated, and may be pipelined: clients
+ * can send many before reading any answer. Every request gets
+ * exactly one line back, in the order they were sent: its result,
+ * an error message, always starting with "Error:", even for
+ * messages such as "Syntax error: ...", or, for a blank line,
+ * an empty line. A client stops being read from while the answers
+ * it was sent pile up unread.
+ *
+ * Usage:
+ * int status = serve(&ev, "/tmp/calc.sock", jobs);
+ *
+ * serve() returns once SIGINT or SIGTERM is received.
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "batch.h"
+#include "eval.h"
+
+#define SERVE_BUFSIZE 4096		/* First buffer size of a client */
+#define SERVE_LINE_MAX (1 << 20)	/* Longest request */
+#define SERVE_EVENTS 64			/* Events handled per wakeup */
+#define SERVE_ERROR "Error: "		/* Start of every error answer */
+
+/* Older kernels wake every worker for each new client */
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0
+#endif
+
+/* Connection to a client */
+struct client {
+	int fd;
+	struct outbuf in;	/* Bytes of requests not evaluated yet */
+	struct outbuf out;	/* Answers not sent yet */
+	size_t sent;		/* Bytes of out already sent */
+	bool writing;		/* Waiting for the socket to be writable? */
+	bool closing;		/* Close once every answer is sent? */
+	struct client *prev, *next;
+};
+
+/* Worker thread of the server */
+struct serve_worker {
+	struct server *srv;
+	struct evaluator *ev;	/* Evaluator used by this thread only */
+	struct client *clients;	/* Connections accepted by this thread */
+	int epfd;
+	pthread_t thread;
+};
+
+/* Server state */
+struct server {
+	int lfd;		/* Listening socket */
+	int wake;		/* Becomes readable when workers must exit */
+	unsigned int jobs;
+	struct serve_worker *workers;
+	struct evaluator *evs;	/* Evaluators of workers 1 to jobs - 1 */
+};
+
+/* Function prototypes */
+static inline bool serve_stale(const struct sockaddr_un *);
+static inline int serve_listen(const char *);
+static inline void client_close(struct serve_worker *, struct client *);
+static inline void client_accept(struct serve_worker *);
+static inline bool client_answer(struct evaluator *, struct outbuf *,
+				 const char *, size_t);
+static inline bool client_eval(struct serve_worker *, struct client *, bool);
+static inline bool client_read(struct serve_worker *, struct client *);
+static inline bool client_write(struct serve_worker *, struct client *);
+static inline void *serve_main(void *);
+int serve(struct evaluator *, const char *, unsigned int);
+
+/* Is the socket at sa left behind by a server that is gone? */
+static inline bool
+serve_stale(const struct sockaddr_un *sa)
+{
+	bool stale = false;
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0) {
+		stale = connect(fd, (const struct sockaddr *)sa,
+				sizeof(*sa)) < 0 && errno == ECONNREFUSED;
+		close(fd);
+	}
+
+	errno = EADDRINUSE;
+	return stale;
+}
+
+/* Listen on a Unix socket at path. A socket left behind by a server
+ * that is gone is replaced; one still in use is not.
+ * Returns the socket, or -1. */
+static inline int
+serve_listen(const char *path)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+
+	strcpy(sa.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK
+			 | SOCK_CLOEXEC, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+	     && (errno != EADDRINUSE || !serve_stale(&sa) || unlink(path) < 0
+		 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0))
+	    || listen(fd, SOMAXCONN) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Close a connection, dropping any answer not sent yet */
+static inline void
+client_close(struct serve_worker *w, struct client *c)
+{
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		w->clients = c->next;
+
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+
+	close(c->fd);
+	free(c->in.buf);
+	free(c->out.buf);
+	free(c);
+}
+
+/* Accept a new client, if another worker didn't already */
+static inline void
+client_accept(struct serve_worker *w)
+{
+	struct epoll_event e = { .events = EPOLLIN };
+	struct client *c;
+	int fd;
+
+	if ((fd = accept4(w->srv->lfd, NULL, NULL, SOCK_NONBLOCK
+			  | SOCK_CLOEXEC)) < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK
+		    && errno != EINTR && errno != ECONNABORTED)
+			perror("accept");
+		return;
+	}
+
+	/* Buffers start small, as there may be many clients */
+	if ((c = calloc(1, sizeof(*c))) == NULL
+	    || (c->in.buf = malloc(SERVE_BUFSIZE)) == NULL
+	    || (c->out.buf = malloc(SERVE_BUFSIZE)) == NULL) {
+		fprintf(stderr, "Error: unable to allocate enough memory!\n");
+		if (c != NULL) {
+			free(c->in.buf);
+			free(c);
+		}
+		close(fd);
+		return;
+	}
+
+	c->fd = fd;
+	c->in.cap = c->out.cap = SERVE_BUFSIZE;
+	e.data.ptr = c;
+
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &e) < 0) {
+		perror("epoll_ctl");
+		free(c->in.buf);
+		free(c->out.buf);
+		free(c);
+		close(fd);
+		return;
+	}
+
+	if ((c->next = w->clients) != NULL)
+		c->next->prev = c;
+	w->clients = c;
+}
+
+/* Append the answer to one request to out.
+ * Returns false if there isn't enough memory for it. */
+static inline bool
+client_answer(struct evaluator *ev, struct outbuf *out, const char *line,
+	      size_t n)
+{
+	uint64_t result;
+	size_t len;
+
+	/* Accept DOS line endings */
+	if (n > 0 && line[n - 1] == '\r')
+		n--;
+
+	if (ev->exact) {
+		if (evaluate_big(ev, line, n))
+			return out_big(out, &ev->big);
+	} else if (evaluate(ev, line, n, &result)) {
+		return ev->floating ? out_double(out, result)
+			: out_result(out, result);
+	}
+
+	/* Blank lines get an empty line back, so that
+	 * every request still has its own answer */
+	len = ev->err != NULL ? strlen(ev->err) : 0;
+	if (!out_reserve(out, len + sizeof(SERVE_ERROR)))
+		return false;
+
+	/* Clients tell errors apart by their prefix, which
+	 * messages such as "Syntax error: ..." don't have */
+	if (len > 0 && strncmp(ev->err, SERVE_ERROR,
+			       sizeof(SERVE_ERROR) - 1) != 0) {
+		memcpy(out->buf + out->len, SERVE_ERROR,
+		       sizeof(SERVE_ERROR) - 1);
+		out->len += sizeof(SERVE_ERROR) - 1;
+	}
+
+	if (len > 0)
+		memcpy(out->buf + out->len, ev->err, len);
+
+	out->buf[out->len + len] = '\n';
+	out->len += len + 1;
+	return true;
+}
+
+/* Answer every complete request read so far, and, at the end of
+ * the input, the last one even without a newline.
+ * Returns false if the client must be closed. */
+static inline bool
+client_eval(struct serve_worker *w, struct client *c, bool eof)
+{
+	const char *line = c->in.buf, *end = c->in.buf + c->in.len, *nl;
+
+	while ((nl = memchr(line, '\n', end - line)) != NULL
+	       || (eof && line < end)) {
+		if (nl == NULL)
+			nl = end;
+
+		if (!client_answer(w->ev, &c->out, line, nl - line)) {
+			fprintf(stderr, "Error: unable to allocate "
+				"enough memory!\n");
+			return false;
+		}
+
+		line = nl + (nl < end);
+	}
+
+	/* Keep the incomplete last request for the next read */
+	c->in.len = end - line;
+	memmove(c->in.buf, line, c->in.len);
+	return true;
+}
+
+/* Read what the client sent, and answer it.
+ * Returns false if the client must be closed. */
+static inline bool
+client_read(struct serve_worker *w, struct client *c)
+{
+	static const char toolong[] = "Error: request too long!\n";
+	ssize_t n;
+
+	/* Grow the buffer only when a request doesn't fit */
+	if (c->in.len == c->in.cap && !out_reserve(&c->in, c->in.cap + 1))
+		return false;
+
+	do
+		n = read(c->fd, c->in.buf + c->in.len, c->in.cap - c->in.len);
+	while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+
+	c->in.len += n;
+	c->closing = n == 0;
+
+	if (!client_eval(w, c, c->closing))
+		return false;
+
+	/* Answer a request that would never end, then hang up */
+	if (c->in.len >= SERVE_LINE_MAX) {
+		if (!out_reserve(&c->out, sizeof(toolong)))
+			return false;
+
+		memcpy(c->out.buf + c->out.len, toolong, sizeof(toolong) - 1);
+		c->out.len += sizeof(toolong) - 1;
+		c->in.len = 0;
+		c->closing = true;
+	}
+
+	return client_write(w, c);
+}
+
+/* Send as many answers as the socket takes; if it doesn't take
+ * them all, wait until it's writable before reading any more.
+ * Returns false if the client must be closed. */
+static inline bool
+client_write(struct serve_worker *w, struct client *c)
+{
+	struct epoll_event e = { .data.ptr = c };
+	bool writing;
+	ssize_t n;
+
+	while (c->sent < c->out.len) {
+		n = send(c->fd, c->out.buf + c->sent, c->out.len - c->sent,
+			 MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		if (n < 0)
+			return false;
+
+		c->sent += n;
+	}
+
+	if ((writing = c->sent < c->out.len) == false) {
+		c->out.len = c->sent = 0;
+
+		if (c->closing)
+			return false;
+	}
+
+	if (writing != c->writing) {
+		e.events = writing ? EPOLLOUT : EPOLLIN;
+
+		if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &e) < 0)
+			return false;
+
+		c->writing = writing;
+	}
+
+	return true;
+}
+
+/* Worker thread: serve the clients it accepts, until woken up */
+static inline void *
+serve_main(void *arg)
+{
+	struct serve_worker *w = arg;
+	struct server *srv = w->srv;
+	struct epoll_event events[SERVE_EVENTS];
+	struct client *c;
+	int n;
+
+	for (;;) {
+		if ((n = epoll_wait(w->epfd, events, SERVE_EVENTS, -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("epoll_wait");
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == &srv->wake)
+				goto out;
+
+			if (events[i].data.ptr == &srv->lfd) {
+				client_accept(w);
+				continue;
+			}
+
+			c = events[i].data.ptr;
+
+			if (!(c->writing ? client_write(w, c)
+			      : client_read(w, c)))
+				client_close(w, c);
+		}
+	}
+
+ out:
+	while (w->clients != NULL)
+		client_close(w, w->clients);
+
+	return NULL;
+}
+
+/* Answer the clients of a Unix socket at path, using the given
+ * number of threads, until SIGINT or SIGTERM is received.
+ * Returns 0 if the server could be started, 1 otherwise. */
+int
+serve(struct evaluator *ev, const char *path, unsigned int jobs)
+{
+	struct server srv = { .jobs = jobs, .wake = -1 };
+	struct epoll_event e;
+	unsigned int started = 0;
+	sigset_t set, old;
+	int sig, status = 1;
+
+	if ((srv.lfd = serve_listen(path)) < 0)
+		return 1;
+
+	srv.workers = calloc(jobs, sizeof(struct serve_worker));
+
+	/* The first worker uses the caller's evaluator */
+	if (jobs > 1)
+		srv.evs = calloc(jobs - 1, sizeof(struct evaluator));
+
+	if (srv.workers == NULL || (jobs > 1 && srv.evs == NULL)) {
+		fprintf(stderr, "Error: unable to allocate enough memory!\n");
+		goto out;
+	}
+
+	if ((srv.wake = eventfd(0, EFD_CLOEXEC)) < 0) {
+		perror("eventfd");
+		goto out;
+	}
+
+	/* Only this thread handles the signals that stop the server */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+
+	for (unsigned int i = 0; i < jobs; i++) {
+		struct serve_worker *w = &srv.workers[i];
+
+		w->srv = &srv;
+		w->ev = i == 0 ? ev : &srv.evs[i - 1];
+		w->ev->usecache = ev->usecache;
+		w->ev->exact = ev->exact;
+		w->ev->usestats = ev->usestats;
+
+		if ((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			perror("epoll_create1");
+			break;
+		}
+
+		e.events = EPOLLIN | EPOLLEXCLUSIVE;
+		e.data.ptr = &srv.lfd;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, srv.lfd, &e) < 0) {
+			perror("epoll_ctl");
+			close(w->epfd);
+			break;
+		}
+
+		e.events = EPOLLIN;
+		e.data.ptr = &srv.wake;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, srv.wake, &e) < 0) {
+			perror("epoll_ctl");
+			close(w->epfd);
+			break;
+		}
+
+		if (pthread_create(&w->thread, NULL, serve_main, w)) {
+			fprintf(stderr, "Error: unable to start thread!\n");
+			close(w->epfd);
+			break;
+		}
+
+		started++;
+	}
+
+	if (started == jobs) {
+		fprintf(stderr, "[Serving on %s with %u thread%s "
+			"(stop with CTRL+C)]\n", path, jobs,
+			jobs == 1 ? "" : "s");
+		status = 0;
+
+		while (sigwait(&set, &sig) != 0)
+			;
+	}
+
+	/* The wake event is never read, so it wakes every worker */
+	if (write(srv.wake, &(uint64_t){ 1 }, sizeof(uint64_t)) < 0)
+		perror("write");
+
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(srv.workers[i].thread, NULL);
+		close(srv.workers[i].epfd);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+ out:
+	/* The caller's evaluator counts what every thread did */
+	for (unsigned int i = 0; srv.evs != NULL && i < jobs - 1; i++) {
+		stats_add(&ev->total, &srv.evs[i].total);
+		evaluator_free(&srv.evs[i]);
+	}
+
+	if (srv.wake >= 0)
+		close(srv.wake);
+
+	close(srv.lfd);
+	unlink(path);
+	free(srv.evs);
+	free(srv.workers);
+
+	return status;
+}
+
+#endif
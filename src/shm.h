@@ -0,0 +1,338 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, shm.h, answers the requests a client of calcshm.h
+ * writes to a POSIX shared-memory region, without a system call
+ * in between: it creates the region, then busy-polls its request
+ * ring, answering each request in the matching slot of the
+ * answer ring, until SIGINT or SIGTERM is received.
+ *
+ * Expressions are evaluated like in batch mode, with the cache.
+ * Compiled expressions are kept, up to SHM_PROGS of them, until
+ * calc exits, and only run when asked to, with the values the
+ * request gives to the variables a to h. Answers are 64-bit
+ * integers or doubles: -B doesn't apply here.
+ *
+ * A region left behind by a calc that is no longer running is
+ * replaced; one still in use is not.
+ *
+ * Usage:
+ * int status = shm_serve(&ev, "/calc");
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "calcshm.h"
+#include "eval.h"
+
+#define SHM_PROGS 4096		/* Most compiled expressions kept */
+
+/* Shared-memory server state */
+struct shm_state {
+	struct calcshm *shm;
+	struct evaluator *ev;
+	struct program *progs;	/* Compiled expressions, by ID */
+	bool *floating;		/* Are they run on doubles? */
+	uint32_t nprogs;
+};
+
+/* Names of the variables of compiled expressions */
+static const char *const shm_vars[CALCSHM_ARGS] = {
+	"a", "b", "c", "d", "e", "f", "g", "h",
+};
+
+static volatile sig_atomic_t shm_quit = 0;
+
+/* Function prototypes */
+static inline void shm_stop(int);
+static inline bool shm_stale(const char *);
+static inline struct calcshm *shm_create(const char *);
+static inline void shm_error(struct calcshm_resp *, const char *);
+static inline void shm_compile(struct shm_state *, const struct calcshm_req *,
+			       struct calcshm_resp *);
+static inline void shm_run(struct shm_state *, const struct calcshm_req *,
+			   struct calcshm_resp *);
+static inline void shm_answer(struct shm_state *, const struct calcshm_req *,
+			      struct calcshm_resp *);
+int shm_serve(struct evaluator *, const char *);
+
+/* Stop answering, once the current request is */
+static inline void
+shm_stop(int sig)
+{
+	(void)sig;
+	shm_quit = 1;
+}
+
+/* Was the region with the given name left behind by a calc
+ * that is gone? */
+static inline bool
+shm_stale(const char *name)
+{
+	struct calcshm *shm;
+	struct stat st;
+	bool stale = true;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+		return errno == ENOENT;
+
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(*shm)
+	    && (shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd,
+			   0)) != MAP_FAILED) {
+		stale = shm->magic != CALCSHM_MAGIC || !calcshm_alive(shm);
+		munmap(shm, sizeof(*shm));
+	}
+
+	close(fd);
+	return stale;
+}
+
+/* Create the shared region, with empty rings.
+ * Returns it, or NULL after printing why it couldn't be. */
+static inline struct calcshm *
+shm_create(const char *name)
+{
+	struct calcshm *shm;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0
+	    && errno == EEXIST) {
+		if (!shm_stale(name)) {
+			fprintf(stderr, "%s: in use by another calc\n", name);
+			return NULL;
+		}
+
+		shm_unlink(name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+
+	if (fd < 0 || ftruncate(fd, sizeof(*shm)) < 0) {
+		perror(name);
+		if (fd >= 0) {
+			close(fd);
+			shm_unlink(name);
+		}
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+
+	if (shm == MAP_FAILED) {
+		perror(name);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	/* The region starts zeroed: only say who we are, then that
+	 * we're ready, last */
+	shm->pid = getpid();
+	__atomic_store_n(&shm->magic, CALCSHM_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+}
+
+/* Answer with an error message */
+static inline void
+shm_error(struct calcshm_resp *resp, const char *msg)
+{
+	resp->status = CALCSHM_ERROR;
+	snprintf(resp->err, CALCSHM_ERR, "%s", msg);
+}
+
+/* Compile the expression of a request, and answer with its ID */
+static inline void
+shm_compile(struct shm_state *s, const struct calcshm_req *req,
+	    struct calcshm_resp *resp)
+{
+	struct arena *a = &s->ev->arena;
+	struct program *prog = &s->progs[s->nprogs];
+	uint32_t root;
+	bool ok;
+
+	/* Only compiled expressions may use variables */
+	a->vars = shm_vars;
+	a->nvars = CALCSHM_ARGS;
+	a->exact = false;
+	ok = parse(a, req->expr, req->len);
+	a->vars = NULL;
+	a->nvars = 0;
+
+	if (!ok) {
+		shm_error(resp, a->err);
+		return;
+	}
+
+	if (a->len == 0) {
+		resp->status = CALCSHM_BLANK;
+		return;
+	}
+
+	if (s->nprogs == SHM_PROGS) {
+		shm_error(resp, "Error: too many compiled expressions!");
+		return;
+	}
+
+	if ((root = build_ast(a)) == NO_NODE) {
+		shm_error(resp, a->err);
+		return;
+	}
+
+	if (!compile(prog, a, root)) {
+		shm_error(resp, prog->err);
+		program_free(prog);
+		return;
+	}
+
+	s->floating[s->nprogs] = a->floating;
+	resp->status = CALCSHM_ID;
+	resp->val = s->nprogs++;
+}
+
+/* Run the compiled expression a request names, on its values */
+static inline void
+shm_run(struct shm_state *s, const struct calcshm_req *req,
+	struct calcshm_resp *resp)
+{
+	struct program *prog;
+	double d;
+
+	if (req->len >= s->nprogs) {
+		shm_error(resp, "Error: no such compiled expression!");
+		return;
+	}
+
+	prog = &s->progs[req->len];
+	prog->vars = req->args;
+
+	if (s->floating[req->len]) {
+		if (!run_float(prog, &d)) {
+			shm_error(resp, prog->err);
+			return;
+		}
+
+		memcpy(&resp->val, &d, sizeof(d));
+		resp->status = CALCSHM_FLOAT;
+	} else if (run(prog, &resp->val))
+		resp->status = CALCSHM_INT;
+	else
+		shm_error(resp, prog->err);
+}
+
+/* Answer a request */
+static inline void
+shm_answer(struct shm_state *s, const struct calcshm_req *req,
+	   struct calcshm_resp *resp)
+{
+	struct calcshm_req r = *req;
+
+	/* Don't trust the client with lengths */
+	if (r.kind != CALCSHM_RUN && r.len > CALCSHM_EXPR) {
+		shm_error(resp, "Error: expression too long!");
+		return;
+	}
+
+	switch (r.kind) {
+	case CALCSHM_EVAL:
+		if (evaluate(s->ev, r.expr, r.len, &resp->val))
+			resp->status = s->ev->floating ? CALCSHM_FLOAT
+				: CALCSHM_INT;
+		else if (s->ev->err != NULL)
+			shm_error(resp, s->ev->err);
+		else
+			resp->status = CALCSHM_BLANK;
+		break;
+
+	case CALCSHM_COMPILE:
+		shm_compile(s, &r, resp);
+		break;
+
+	case CALCSHM_RUN:
+		shm_run(s, &r, resp);
+		break;
+
+	default:
+		shm_error(resp, "Error: unknown request!");
+		break;
+	}
+}
+
+/* Create a shared region with the given name, and answer the
+ * requests written to it, until SIGINT or SIGTERM is received.
+ * Returns 0 if the region could be created, 1 otherwise. */
+int
+shm_serve(struct evaluator *ev, const char *name)
+{
+	struct shm_state s = { .ev = ev };
+	struct calcshm *shm;
+	uint64_t head, tail = 0, idle = 0;
+	uint32_t spin = calcshm_spin();
+
+	s.progs = calloc(SHM_PROGS, sizeof(*s.progs));
+	s.floating = calloc(SHM_PROGS, sizeof(*s.floating));
+
+	if (s.progs == NULL || s.floating == NULL) {
+		fprintf(stderr, "Error: unable to allocate enough memory!\n");
+		free(s.progs);
+		free(s.floating);
+		return 1;
+	}
+
+	if ((s.shm = shm = shm_create(name)) == NULL) {
+		free(s.progs);
+		free(s.floating);
+		return 1;
+	}
+
+	signal(SIGINT, shm_stop);
+	signal(SIGTERM, shm_stop);
+	fprintf(stderr, "[Answering on shared memory %s "
+		"(stop with CTRL+C)]\n", name);
+
+	while (!shm_quit) {
+		head = __atomic_load_n(&shm->req_head, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			calcshm_idle(&idle, spin);
+			continue;
+		}
+
+		/* Publish every answer as soon as it's written,
+		 * so the client needn't wait for the whole batch */
+		for (idle = 0; tail != head; ) {
+			shm_answer(&s, &shm->req[tail & (CALCSHM_SLOTS - 1)],
+				   &shm->resp[tail & (CALCSHM_SLOTS - 1)]);
+			__atomic_store_n(&shm->resp_head, ++tail,
+					 __ATOMIC_RELEASE);
+		}
+	}
+
+	__atomic_store_n(&shm->closed, 1, __ATOMIC_RELEASE);
+	munmap(shm, sizeof(*shm));
+	shm_unlink(name);
+
+	for (uint32_t i = 0; i < s.nprogs; i++)
+		program_free(&s.progs[i]);
+
+	free(s.progs);
+	free(s.floating);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,154 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, stats.h, keeps count of what evaluating an
+ * expression took: how many tokens it had, how deep its AST
+ * was, how long each phase took, and how much memory had to be
+ * allocated for it. eval.h fills in these counters, but only
+ * if asked to (see usestats in struct evaluator): otherwise,
+ * the clock is never read.
+ *
+ * [Phase]	[What it times]
+ * parse	parse(), the lexer
+ * cache	Looking the tokens up in the cache
+ * build_ast	build_ast(), the parser
+ * compile	compile(), turning the AST into bytecode
+ * run		run(), run_float() or run_big()
+ *
+ * Usage:
+ * stats_start(&s);
+ * parse(...);
+ * stats_phase(&s, PHASE_PARSE);
+ * ...
+ * stats_add(&total, &s);
+ * stats_print(stderr, "Total", &total);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Phases of an evaluation */
+enum stats_phase {
+	PHASE_PARSE,
+	PHASE_CACHE,
+	PHASE_BUILD_AST,
+	PHASE_COMPILE,
+	PHASE_RUN,
+	PHASES,
+};
+
+static const char *const phase_names[PHASES] = {
+	"parse", "cache", "build_ast", "compile", "run",
+};
+
+/* Counters of one evaluation, or the sum of many */
+struct stats {
+	uint64_t evals;		/* Expressions evaluated */
+	uint64_t hits;		/* Results found in the cache */
+	uint64_t builds;	/* Times build_ast() ran */
+	uint64_t tokens;	/* Tokens lexed */
+	uint64_t depth;		/* Depth of the AST, or of the deepest one */
+	uint64_t bytes;		/* Bytes allocated */
+	uint64_t ns[PHASES];	/* Nanoseconds spent in each phase */
+	uint64_t mark;		/* When the current phase started */
+};
+
+/* Function prototypes */
+static inline uint64_t stats_now(void);
+static inline void stats_start(struct stats *);
+static inline void stats_phase(struct stats *, enum stats_phase);
+static inline void stats_add(struct stats *, const struct stats *);
+static inline void stats_print(FILE *, const char *, const struct stats *);
+
+/* Monotonic time, in nanoseconds */
+static inline uint64_t
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Start counting a new evaluation */
+static inline void
+stats_start(struct stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->evals = 1;
+	s->mark = stats_now();
+}
+
+/* Charge the time since the last phase ended to this one */
+static inline void
+stats_phase(struct stats *s, enum stats_phase phase)
+{
+	uint64_t now = stats_now();
+
+	s->ns[phase] += now - s->mark;
+	s->mark = now;
+
+	if (phase == PHASE_BUILD_AST)
+		s->builds++;
+}
+
+/* Add the counters of s to those of total */
+static inline void
+stats_add(struct stats *total, const struct stats *s)
+{
+	total->evals += s->evals;
+	total->hits += s->hits;
+	total->builds += s->builds;
+	total->tokens += s->tokens;
+	total->bytes += s->bytes;
+
+	if (s->depth > total->depth)
+		total->depth = s->depth;
+
+	for (int i = 0; i < PHASES; i++)
+		total->ns[i] += s->ns[i];
+}
+
+/* Print the counters, and, for more than one evaluation,
+ * the time each phase took on average */
+static inline void
+stats_print(FILE *f, const char *name, const struct stats *s)
+{
+	uint64_t sum = 0;
+
+	fprintf(f, "%s: %" PRIu64 " expression%s, %" PRIu64 " from the "
+		"cache, %" PRIu64 " AST%s built\n", name, s->evals,
+		s->evals == 1 ? "" : "s", s->hits, s->builds,
+		s->builds == 1 ? "" : "s");
+	fprintf(f, "\t%" PRIu64 " tokens, AST depth %s%" PRIu64 ", %" PRIu64
+		" bytes allocated\n", s->tokens, s->evals > 1 ? "up to " : "",
+		s->depth, s->bytes);
+
+	for (int i = 0; i < PHASES; i++) {
+		sum += s->ns[i];
+		fprintf(f, "\t%-10s %12" PRIu64 " ns", phase_names[i],
+			s->ns[i]);
+
+		if (s->evals > 1)
+			fprintf(f, " %12.1f ns per expression",
+				(double)s->ns[i] / s->evals);
+
+		fputc('\n', f);
+	}
+
+	fprintf(f, "\t%-10s %12" PRIu64 " ns", "total", sum);
+	if (s->evals > 1)
+		fprintf(f, " %12.1f ns per expression", (double)sum / s->evals);
+
+	fputc('\n', f);
+}
+
+#endif
@@ -0,0 +1,637 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This header, vm.h, compiles an AST built by parse.h into
+ * a flat bytecode program, and runs it on a stack machine.
+ * Compiling and running are not recursive, so arbitrarily
+ * long or deep expressions can't overflow the C stack, and
+ * a compiled program can be run any number of times.
+ *
+ * Programs that use special values, or functions such as sqrt
+ * (see arena.floating), are run in double precision instead, by
+ * run_float(), using the functions of mathfn.h.
+ *
+ * Usage:
+ * compile(&prog, &arena, root);
+ * run(&prog, &result);
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "mathfn.h"
+#include "parse.h"
+
+/* Bytecode instructions.
+ * Every instruction is one byte; OP_PUSH takes its operand
+ * from the constant pool, in order. */
+typedef enum {
+	OP_PUSH,		/* Push the next constant */
+	OP_ADD,			/* a + b */
+	OP_SUB,			/* a - b */
+	OP_MUL,			/* a * b */
+	OP_DIV,			/* a / b */
+	OP_MOD,			/* a % b */
+	OP_LSHIFT,		/* a << b */
+	OP_RSHIFT,		/* a >> b */
+	OP_POWER,		/* a ^ b */
+	OP_NEG,			/* -a */
+	OP_VAR,			/* Push the variable named by the next constant */
+	OP_POWMOD,		/* (a ^ b) % c */
+	OP_FACT,		/* a! */
+	OP_BIGPUSH,		/* Push the BIGVAL whose offset is the next constant */
+	OP_FPUSH,		/* Push the next constant, a double */
+	OP_SQRT,		/* sqrt(a), and the functions below, */
+	OP_LOG,			/* on doubles only */
+	OP_EXP,
+	OP_SIN,
+	OP_COS,
+	OP_END			/* Stop, the result is on top of the stack */
+} OPCODE;
+
+/* Compiled program */
+struct program {
+	uint8_t *code;		/* Instructions, terminated by OP_END */
+	uint64_t *consts;	/* Constant pool */
+	uint64_t *stack;	/* Value stack, max_stack entries */
+	uint32_t *work;		/* Scratch space used by compile() */
+	const uint64_t *vars;	/* Values of the variables, for OP_VAR */
+	uint32_t len;		/* Instructions, including OP_END */
+	uint32_t cap;		/* Instructions allocated */
+	uint32_t max_stack;	/* Deepest stack the program can reach */
+	uint32_t stack_cap;	/* Stack entries allocated */
+	const char *err;	/* Last error message */
+};
+
+/* Function prototypes */
+static inline bool program_reserve(struct program *, uint32_t);
+static inline bool float_uint(double, uint64_t *);
+bool compile(struct program *, struct arena *, uint32_t);
+bool run(struct program *, uint64_t *);
+bool run_float(struct program *, double *);
+uint32_t program_depth(struct program *);
+void program_free(struct program *);
+
+/* Make sure the program can hold n instructions and constants */
+static inline bool
+program_reserve(struct program *prog, uint32_t n)
+{
+	uint32_t cap = prog->cap ? prog->cap : 64;
+	void *p;
+
+	if (n <= prog->cap)
+		return true;
+
+	while (cap < n)
+		cap = cap * 2 > cap ? cap * 2 : n;
+
+	if ((p = realloc(prog->code, cap * sizeof(*prog->code))) == NULL)
+		return false;
+	prog->code = p;
+
+	if ((p = realloc(prog->consts, cap * sizeof(*prog->consts))) == NULL)
+		return false;
+	prog->consts = p;
+
+	if ((p = realloc(prog->work, cap * sizeof(*prog->work))) == NULL)
+		return false;
+	prog->work = p;
+
+	prog->cap = cap;
+	return true;
+}
+
+/* Convert a double to an unsigned integer, if it is one */
+static inline bool
+float_uint(double d, uint64_t *u)
+{
+	if (d < 0 || d >= 0x1p64 || d != trunc(d))
+		return false;
+
+	*u = d;
+	return true;
+}
+
+/* Flatten the tree rooted at root into bytecode.
+ * The tree is walked node, right, left with an explicit stack,
+ * which yields the postfix order backwards: instructions and
+ * constants are therefore written from the end of the buffers. */
+bool
+compile(struct program *prog, struct arena *a, uint32_t root)
+{
+	uint32_t sp = 0, pc, k, node, depth = 0, max = 0;
+
+	/* One instruction per node, plus OP_END */
+	if (!program_reserve(prog, a->len + 1)) {
+		prog->err = "Error: unable to allocate enough memory!";
+		return false;
+	}
+
+	pc = k = prog->cap;
+	prog->work[sp++] = root;
+
+	while (sp > 0) {
+		node = prog->work[--sp];
+
+		switch (a->type[node]) {
+		case VAL:
+			prog->code[--pc] = OP_PUSH;
+			prog->consts[--k] = a->value[node];
+			continue;
+
+		case VAR:
+			prog->code[--pc] = OP_VAR;
+			prog->consts[--k] = a->value[node];
+			continue;
+
+		case BIGVAL:
+			prog->code[--pc] = OP_BIGPUSH;
+			prog->consts[--k] = a->value[node];
+			continue;
+
+		case FVAL:
+			prog->code[--pc] = OP_FPUSH;
+			prog->consts[--k] = a->value[node];
+			continue;
+
+		case FUNCTION:
+			if (a->value[node] == FN_NEG) {
+				prog->code[--pc] = OP_NEG;
+				prog->work[sp++] = a->left[node];
+				continue;
+			}
+
+			switch (a->value[node]) {
+			case FN_POWMOD:
+				prog->code[--pc] = OP_POWMOD;
+				break;
+			case FN_FACT:
+				prog->code[--pc] = OP_FACT;
+				break;
+			case FN_SQRT:
+				prog->code[--pc] = OP_SQRT;
+				break;
+			case FN_LOG:
+				prog->code[--pc] = OP_LOG;
+				break;
+			case FN_EXP:
+				prog->code[--pc] = OP_EXP;
+				break;
+			case FN_SIN:
+				prog->code[--pc] = OP_SIN;
+				break;
+			case FN_COS:
+				prog->code[--pc] = OP_COS;
+				break;
+			default:
+				prog->err = "Unsupported function";
+				return false;
+			}
+
+			/* Arguments hang off the "(" and "," tokens */
+			for (uint32_t l = a->left[node]; l != NO_NODE;
+			     l = a->right[l])
+				prog->work[sp++] = a->left[l];
+			continue;
+
+		case ADD:
+			prog->code[--pc] = OP_ADD;
+			break;
+
+		case SUB:
+			prog->code[--pc] = OP_SUB;
+			break;
+
+		case MUL:
+			prog->code[--pc] = OP_MUL;
+			break;
+
+		case DIV:
+			prog->code[--pc] = OP_DIV;
+			break;
+
+		case MOD:
+			prog->code[--pc] = OP_MOD;
+			break;
+
+		case L_SHIFT:
+			prog->code[--pc] = OP_LSHIFT;
+			break;
+
+		case R_SHIFT:
+			prog->code[--pc] = OP_RSHIFT;
+			break;
+
+		case POWER:
+			prog->code[--pc] = OP_POWER;
+			break;
+
+		default:
+			prog->err = "Unsupported operation";
+			return false;
+		}
+
+		prog->work[sp++] = a->left[node];
+		prog->work[sp++] = a->right[node];
+	}
+
+	/* Move everything to the start of the buffers */
+	prog->len = prog->cap - pc;
+	memmove(prog->code, prog->code + pc, prog->len);
+	memmove(prog->consts, prog->consts + k,
+		(prog->cap - k) * sizeof(*prog->consts));
+	prog->code[prog->len++] = OP_END;
+
+	/* Work out how deep the stack can get */
+	for (uint32_t i = 0; i < prog->len; i++) {
+		switch (prog->code[i]) {
+		case OP_PUSH:
+		case OP_VAR:
+		case OP_BIGPUSH:
+		case OP_FPUSH:
+			if (++depth > max)
+				max = depth;
+			break;
+
+		case OP_NEG:
+		case OP_FACT:
+		case OP_SQRT:
+		case OP_LOG:
+		case OP_EXP:
+		case OP_SIN:
+		case OP_COS:
+		case OP_END:
+			break;
+
+		case OP_POWMOD:
+			depth -= 2;
+			break;
+
+		default:
+			depth--;
+		}
+	}
+
+	if (max > prog->stack_cap) {
+		uint64_t *p = realloc(prog->stack, max * sizeof(*p));
+
+		if (p == NULL) {
+			prog->err = "Error: unable to allocate enough memory!";
+			return false;
+		}
+
+		prog->stack = p;
+		prog->stack_cap = max;
+	}
+
+	prog->max_stack = max;
+	return true;
+}
+
+/* Run a compiled program, storing the result in *result.
+ * On error, prog->err is set and false is returned.
+ * With GCC and Clang, instructions are dispatched with computed
+ * gotos; elsewhere, with a plain switch. */
+bool
+run(struct program *prog, uint64_t *result)
+{
+	const uint8_t *pc = prog->code;
+	const uint64_t *k = prog->consts;
+	uint64_t *sp = prog->stack, b;
+	int status;
+
+#ifdef __GNUC__
+	static const void *targets[] = {
+		[OP_PUSH] = &&target_OP_PUSH,
+		[OP_ADD] = &&target_OP_ADD,
+		[OP_SUB] = &&target_OP_SUB,
+		[OP_MUL] = &&target_OP_MUL,
+		[OP_DIV] = &&target_OP_DIV,
+		[OP_MOD] = &&target_OP_MOD,
+		[OP_LSHIFT] = &&target_OP_LSHIFT,
+		[OP_RSHIFT] = &&target_OP_RSHIFT,
+		[OP_POWER] = &&target_OP_POWER,
+		[OP_NEG] = &&target_OP_NEG,
+		[OP_VAR] = &&target_OP_VAR,
+		[OP_POWMOD] = &&target_OP_POWMOD,
+		[OP_FACT] = &&target_OP_FACT,
+		[OP_BIGPUSH] = &&target_OP_BIGPUSH,
+		[OP_FPUSH] = &&target_OP_FPUSH,
+		[OP_SQRT] = &&target_OP_SQRT,
+		[OP_LOG] = &&target_OP_LOG,
+		[OP_EXP] = &&target_OP_EXP,
+		[OP_SIN] = &&target_OP_SIN,
+		[OP_COS] = &&target_OP_COS,
+		[OP_END] = &&target_OP_END,
+	};
+#define TARGET(op)	case op: target_##op
+#define NEXT()		goto *targets[*pc++]
+#else
+#define TARGET(op)	case op
+#define NEXT()		continue
+#endif
+
+	/* sp points to the next free slot; the top is sp[-1] */
+	for (;;) {
+		switch (*pc++) {
+		TARGET(OP_PUSH):
+			*sp++ = *k++;
+			NEXT();
+
+		TARGET(OP_ADD):
+			b = *--sp;
+			sp[-1] += b;
+			NEXT();
+
+		TARGET(OP_SUB):
+			b = *--sp;
+			sp[-1] -= b;
+			NEXT();
+
+		TARGET(OP_MUL):
+			b = *--sp;
+			sp[-1] *= b;
+			NEXT();
+
+		TARGET(OP_DIV):
+			if ((b = *--sp) == 0)
+				goto div_zero;
+			sp[-1] /= b;
+			NEXT();
+
+		TARGET(OP_MOD):
+			if ((b = *--sp) == 0)
+				goto div_zero;
+			sp[-1] %= b;
+			NEXT();
+
+		TARGET(OP_LSHIFT):
+			b = *--sp;
+			sp[-1] = b < 64 ? sp[-1] << b : 0;
+			NEXT();
+
+		TARGET(OP_RSHIFT):
+			b = *--sp;
+			sp[-1] = b < 64 ? sp[-1] >> b : 0;
+			NEXT();
+
+		TARGET(OP_POWER):
+			b = *--sp;
+			if ((status = ipow(sp[-1], b, &sp[-1])) != ARITH_OK)
+				goto fail;
+			NEXT();
+
+		TARGET(OP_NEG):
+			sp[-1] = 0 - sp[-1];
+			NEXT();
+
+		TARGET(OP_VAR):
+			*sp++ = prog->vars[*k++];
+			NEXT();
+
+		TARGET(OP_POWMOD):
+			sp -= 2;
+			if ((status = powmod(sp[-1], sp[0], sp[1], &sp[-1]))
+			    != ARITH_OK)
+				goto fail;
+			NEXT();
+
+		TARGET(OP_FACT):
+			if ((status = ifact(sp[-1], &sp[-1])) != ARITH_OK)
+				goto fail;
+			NEXT();
+
+		/* Only bignum.h can run programs with big numbers */
+		TARGET(OP_BIGPUSH):
+			status = ARITH_OVERFLOW;
+			goto fail;
+
+		/* Only run_float() can run programs with special values */
+		TARGET(OP_FPUSH):
+			prog->err = "Error: special values aren't integers";
+			return false;
+
+		TARGET(OP_SQRT):
+		TARGET(OP_LOG):
+		TARGET(OP_EXP):
+		TARGET(OP_SIN):
+		TARGET(OP_COS):
+			prog->err = "Error: this function doesn't return "
+				    "integers";
+			return false;
+
+		TARGET(OP_END):
+			*result = sp[-1];
+			return true;
+		}
+	}
+
+#undef TARGET
+#undef NEXT
+
+ div_zero:
+	status = ARITH_DIV_ZERO;
+
+ fail:
+	prog->err = arith_error(status);
+	return false;
+}
+
+/* Run a compiled program in double precision, storing the result
+ * in *result. Integer constants and variables are taken as unsigned,
+ * as calc prints them. On error, prog->err is set and false is
+ * returned. */
+bool
+run_float(struct program *prog, double *result)
+{
+	const uint8_t *pc = prog->code;
+	const uint64_t *k = prog->consts;
+	double *sp = (double *)prog->stack, b;
+	uint64_t x, y, z;
+	int status;
+
+	/* sp points to the next free slot; the top is sp[-1] */
+	for (;;) {
+		switch (*pc++) {
+		case OP_PUSH:
+			*sp++ = (double)*k++;
+			continue;
+
+		case OP_FPUSH:
+			memcpy(sp++, k++, sizeof(*sp));
+			continue;
+
+		case OP_VAR:
+			*sp++ = (double)prog->vars[*k++];
+			continue;
+
+		case OP_ADD:
+			b = *--sp;
+			sp[-1] += b;
+			continue;
+
+		case OP_SUB:
+			b = *--sp;
+			sp[-1] -= b;
+			continue;
+
+		case OP_MUL:
+			b = *--sp;
+			sp[-1] *= b;
+			continue;
+
+		case OP_DIV:
+			if ((b = *--sp) == 0)
+				goto div_zero;
+			sp[-1] /= b;
+			continue;
+
+		case OP_MOD:
+			if ((b = *--sp) == 0)
+				goto div_zero;
+			sp[-1] = fmod(sp[-1], b);
+			continue;
+
+		/* Shifting multiplies or divides by a power of 2;
+		 * clamping the count keeps the conversion defined */
+		case OP_LSHIFT:
+		case OP_RSHIFT:
+			b = *--sp;
+			b = b > 4096 ? 4096 : b < -4096 ? -4096 : b;
+			sp[-1] = ldexp(sp[-1], pc[-1] == OP_LSHIFT ? b : -b);
+			continue;
+
+		case OP_POWER:
+			b = *--sp;
+			sp[-1] = pow(sp[-1], b);
+			continue;
+
+		case OP_NEG:
+			sp[-1] = -sp[-1];
+			continue;
+
+		case OP_FACT:
+			if (sp[-1] < 0) {
+				status = ARITH_NEGATIVE;
+				goto fail;
+			}
+			sp[-1] = tgamma(sp[-1] + 1);
+			continue;
+
+		case OP_SQRT:
+			sp[-1] = math_sqrt(sp[-1]);
+			continue;
+
+		case OP_LOG:
+			sp[-1] = math_log(sp[-1]);
+			continue;
+
+		case OP_EXP:
+			sp[-1] = math_exp(sp[-1]);
+			continue;
+
+		case OP_SIN:
+			sp[-1] = math_sin(sp[-1]);
+			continue;
+
+		case OP_COS:
+			sp[-1] = math_cos(sp[-1]);
+			continue;
+
+		/* Modular arithmetic only makes sense on integers */
+		case OP_POWMOD:
+			sp -= 2;
+			if (!float_uint(sp[-1], &x) || !float_uint(sp[0], &y)
+			    || !float_uint(sp[1], &z)) {
+				prog->err = "Error: powmod needs integers";
+				return false;
+			}
+			if ((status = powmod(x, y, z, &x)) != ARITH_OK)
+				goto fail;
+			sp[-1] = x;
+			continue;
+
+		case OP_END:
+			*result = sp[-1];
+			return true;
+
+		default:
+			prog->err = "Unsupported operation";
+			return false;
+		}
+	}
+
+ div_zero:
+	status = ARITH_DIV_ZERO;
+
+ fail:
+	prog->err = arith_error(status);
+	return false;
+}
+
+/* Depth of the tree the program was compiled from: a number
+ * is 1 deep, and an operator one more than its deepest operand.
+ * The value stack holds the depth of each operand instead. */
+uint32_t
+program_depth(struct program *prog)
+{
+	uint64_t *sp = prog->stack, d;
+
+	for (const uint8_t *pc = prog->code; *pc != OP_END; pc++) {
+		switch (*pc) {
+		case OP_PUSH:
+		case OP_VAR:
+		case OP_BIGPUSH:
+		case OP_FPUSH:
+			*sp++ = 1;
+			break;
+
+		case OP_NEG:
+		case OP_FACT:
+		case OP_SQRT:
+		case OP_LOG:
+		case OP_EXP:
+		case OP_SIN:
+		case OP_COS:
+			sp[-1]++;
+			break;
+
+		case OP_POWMOD:
+			d = sp[-1] > sp[-2] ? sp[-1] : sp[-2];
+			d = d > sp[-3] ? d : sp[-3];
+			sp -= 2;
+			sp[-1] = d + 1;
+			break;
+
+		default:
+			d = sp[-1] > sp[-2] ? sp[-1] : sp[-2];
+			sp--;
+			sp[-1] = d + 1;
+		}
+	}
+
+	return sp > prog->stack ? sp[-1] : 0;
+}
+
+/* Release the memory held by a program */
+void
+program_free(struct program *prog)
+{
+	free(prog->code);
+	free(prog->consts);
+	free(prog->stack);
+	free(prog->work);
+	memset(prog, 0, sizeof(*prog));
+}
+
+#endif
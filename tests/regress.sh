@@ -0,0 +1,100 @@
+#!/bin/sh
+# See LICENSE file for copyright and license details.
+#
+# This script, tests/regress.sh, runs calc on expressions whose
+# results once came out wrong, and checks the last line it prints
+# for each one: the result, or the error it stopped at.
+#
+# Usage:
+# make check
+# CALC=/path/to/calc sh tests/regress.sh
+#
+# Made by Salonia Matteo <saloniamatteo@pm.me>
+
+calc=${CALC:-./calc}
+failed=0
+
+# Does the last line calc printed say want? Errors follow the expression
+matches() {
+	[ "$1" = "$2" ] || [ "${1%: $2}" != "$1" ]
+}
+
+# check WANT EXPR FLAGS...: "calc FLAGS... -e EXPR" prints WANT
+check() {
+	want=$1
+	expr=$2
+	shift 2
+	got=$("$calc" "$@" -e "$expr" 2>&1 | tail -n 1)
+
+	if ! matches "$got" "$want"; then
+		echo "FAIL: calc $* -e '$expr' printed \"$got\"," \
+		     "not \"$want\""
+		failed=1
+	fi
+}
+
+# csv WANT EXPR CSV...: "calc -x EXPR" prints WANT over CSV
+csv() {
+	want=$1
+	expr=$2
+	shift 2
+
+	for flags in "" -J; do
+		# Failed rows leave a blank line in the results
+		got=$(printf '%s\n' "$@" | "$calc" $flags -x "$expr" 2>&1 \
+		      | grep -v '^$' | tail -n 1)
+
+		if ! matches "$got" "$want"; then
+			echo "FAIL: calc $flags -x '$expr' printed \"$got\"," \
+			     "not \"$want\""
+			failed=1
+		fi
+	done
+}
+
+# CSV rows report the first error they stop at, like -e does
+csv "Error: result doesn't fit in 64 bits!" '(64 ^ fact(52)) % c' a,c 5,0
+check "Error: result doesn't fit in 64 bits!" '(64 ^ fact(52)) % 0'
+csv "Error: division by zero!" '(a / c) + fact(30)' a,c 5,0
+
+# -B can only be checked if calc was built with GMP
+if "$calc" -B -e 1 2>&1 | grep -q 'arbitrary precision'; then
+	big=true
+else
+	big=false
+fi
+
+# Precedence: ^, then unary + -, then * / %, then + -, then << >>
+check 16 '2 ^ 3 * 2'
+check 4 '1 + 7 % 4'
+check 512 '2 ^ 3 ^ 2'
+check 8 '1 << 2 + 1'
+check 1 '(1 + 7) % 4 + 1'
+check 18446744073709551612 '-2 ^ 2'
+
+# Integers are unsigned, as calc prints them, in every evaluator
+check 18446744073709551615 '0 - 1'
+check 18446744073709551615 18446744073709551615
+check 9223372036854775808 '2 ^ 63'
+check 9223372036854775804 '-7 / 2'
+check -1 '0 - 1' -o signed
+check 57952155664616980000 '18446744073709551615 * pi'
+check 18446744073709552000 '18446744073709551615 + 0 * pi'
+check "Error: result doesn't fit in 64 bits!" '18446744073709551615 ^ 2'
+check "Error: result doesn't fit in 64 bits!" '3 ^ 18446744073709551615'
+check "Error: result doesn't fit in 64 bits!" '2 ^ 64'
+check 1 '1 ^ 18446744073709551615'
+check 0 '0 ^ 18446744073709551615'
+check 12157665459056928801 '3 ^ 40'
+csv 57952155664616980000 'a * pi' a 18446744073709551615
+csv "Error: result doesn't fit in 64 bits!" 'a ^ 2' a 18446744073709551615
+
+if $big; then
+	check 340282366920938463426481119284349108225 \
+	      '18446744073709551615 ^ 2' -B
+	check 9223372036854775808 '2 ^ 63' -B
+	check -8 '(0 - 2) ^ 3' -B
+	check -1 '0 - 1' -B
+fi
+
+exit $failed
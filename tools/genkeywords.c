@@ -0,0 +1,313 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * This program, tools/genkeywords.c, generates src/keywords.h:
+ * a perfect hash table of every command, special value and
+ * function name calc knows, so that looking any of them up
+ * takes a single probe.
+ *
+ * The hash is FNV-1a over the lowercased name, starting from a
+ * seed; the table has at least twice as many slots as there are
+ * keywords, and seeds are tried in turn until every keyword
+ * lands in a slot of its own.
+ *
+ * To add a keyword, add it to entries[], then regenerate
+ * the header:
+ * make keywords
+ *
+ * Made by Salonia Matteo <saloniamatteo@pm.me>
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* One step of the hash; keywords.h uses the same one */
+#define KW_STEP(h, c)	(((h) ^ ((unsigned char)(c) | 0x20)) * 0x01000193u)
+
+/* Keyword kinds */
+#define COMMAND		"KW_COMMAND"
+#define CONST		"KW_CONST"
+#define FUNCTION	"KW_FUNCTION"
+
+/* Keyword: commands and functions get an id, named after them,
+ * special values have a value, functions have an arity */
+struct entry {
+	const char *name;
+	const char *kind;
+	const char *value;	/* C expression, for special values */
+	int arity;		/* Number of arguments, for functions */
+	int floating;		/* Does the function return a double? */
+};
+
+/* Every keyword, in the order their ids are given */
+static const struct entry entries[] = {
+	/* Commands, see parseInput() in calc.c */
+	{ "cache", COMMAND, NULL, 0, 0 },
+	{ "cachestats", COMMAND, NULL, 0, 0 },
+	{ "calc", COMMAND, NULL, 0, 0 },
+	{ "clear", COMMAND, NULL, 0, 0 },
+	{ "color", COMMAND, NULL, 0, 0 },
+	{ "examples", COMMAND, NULL, 0, 0 },
+	{ "exit", COMMAND, NULL, 0, 0 },
+	{ "flags", COMMAND, NULL, 0, 0 },
+	{ "help", COMMAND, NULL, 0, 0 },
+	{ "nocache", COMMAND, NULL, 0, 0 },
+	{ "nocalc", COMMAND, NULL, 0, 0 },
+	{ "nocolor", COMMAND, NULL, 0, 0 },
+	{ "noexamples", COMMAND, NULL, 0, 0 },
+	{ "noflags", COMMAND, NULL, 0, 0 },
+	{ "nostats", COMMAND, NULL, 0, 0 },
+	{ "operands", COMMAND, NULL, 0, 0 },
+	{ "ops", COMMAND, NULL, 0, 0 },
+	{ "quit", COMMAND, NULL, 0, 0 },
+	{ "rpn", COMMAND, NULL, 0, 0 },
+	{ "specvals", COMMAND, NULL, 0, 0 },
+	{ "stats", COMMAND, NULL, 0, 0 },
+
+	/* Special values */
+	{ "e", CONST, "M_E", 0, 0 },
+	{ "pi", CONST, "M_PI", 0, 0 },
+	{ "pi2", CONST, "M_PI_2", 0, 0 },
+	{ "pi4", CONST, "M_PI_4", 0, 0 },
+	{ "1pi", CONST, "M_1_PI", 0, 0 },
+	{ "2pi", CONST, "M_2_PI", 0, 0 },
+	{ "pisq", CONST, "M_PI * M_PI", 0, 0 },
+
+	/* Functions, see lex_name() in parse.h */
+	{ "powmod", FUNCTION, NULL, 3, 0 },
+	{ "fact", FUNCTION, NULL, 1, 0 },
+	{ "sqrt", FUNCTION, NULL, 1, 1 },
+	{ "log", FUNCTION, NULL, 1, 1 },
+	{ "exp", FUNCTION, NULL, 1, 1 },
+	{ "sin", FUNCTION, NULL, 1, 1 },
+	{ "cos", FUNCTION, NULL, 1, 1 },
+};
+
+#define NENTRIES (sizeof(entries) / sizeof(*entries))
+
+/* Function prototypes */
+static uint32_t hash(uint32_t, const char *);
+static void print_id(const char *, const char *);
+static int find_seed(unsigned int, uint32_t *, int *);
+static void print_header(unsigned int, uint32_t, const int *);
+
+/* Hash a name */
+static uint32_t
+hash(uint32_t seed, const char *name)
+{
+	while (*name != '\0')
+		seed = KW_STEP(seed, *name++);
+
+	return seed;
+}
+
+/* Print the id of a command or function: its name, uppercased */
+static void
+print_id(const char *prefix, const char *name)
+{
+	printf("%s", prefix);
+
+	while (*name != '\0')
+		putchar(toupper((unsigned char)*name++));
+}
+
+/* Find a seed for which no two keywords share a slot of a table
+ * of 1 << bits slots, storing the entry of each slot in slots[] */
+static int
+find_seed(unsigned int bits, uint32_t *seed, int *slots)
+{
+	for (uint32_t s = 1; s != 0; s++) {
+		size_t i;
+
+		memset(slots, -1, sizeof(*slots) << bits);
+
+		for (i = 0; i < NENTRIES; i++) {
+			uint32_t slot = hash(s, entries[i].name) >> (32 - bits);
+
+			if (slots[slot] >= 0)
+				break;
+			slots[slot] = i;
+		}
+
+		if (i == NENTRIES) {
+			*seed = s;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Print keywords.h */
+static void
+print_header(unsigned int bits, uint32_t seed, const int *slots)
+{
+	size_t maxlen = 0, i;
+	int first;
+
+	for (i = 0; i < NENTRIES; i++)
+		if (strlen(entries[i].name) > maxlen)
+			maxlen = strlen(entries[i].name);
+
+	printf("/* See LICENSE file for copyright and license details.\n"
+	       " *\n"
+	       " * This header, keywords.h, was generated by "
+	       "tools/genkeywords.c:\n"
+	       " * don't edit it; edit that instead, and run "
+	       "\"make keywords\".\n"
+	       " *\n"
+	       " * It holds a perfect hash table of the commands, special "
+	       "values\n"
+	       " * and functions calc knows. Names are case-insensitive, "
+	       "and each\n"
+	       " * one hashes to a slot of its own, so looking a name up "
+	       "takes a\n"
+	       " * single probe and a single comparison.\n"
+	       " *\n"
+	       " * Usage:\n"
+	       " * const struct keyword *kw = keyword(\"pi\", 2);\n"
+	       " *\n"
+	       " * Made by Salonia Matteo <saloniamatteo@pm.me>\n"
+	       " *\n"
+	       " */\n\n");
+
+	printf("#ifndef KEYWORDS_H\n#define KEYWORDS_H\n\n"
+	       "#include <math.h>\n#include <stddef.h>\n"
+	       "#include <stdint.h>\n#include <strings.h>\n\n");
+
+	printf("#define KW_SEED 0x%08" PRIX32 "u\t/* Seed of the hash */\n"
+	       "#define KW_BITS %u\t\t/* log2 of the size of the table */\n"
+	       "#define KW_MAX_LEN %zu\t\t/* Length of the longest name */\n\n",
+	       seed, bits, maxlen);
+
+	printf("/* What a keyword names */\nenum {\n\tKW_COMMAND,\n"
+	       "\tKW_CONST,\t\t/* Special value */\n\tKW_FUNCTION\n};\n\n");
+
+	/* Ids of commands and functions, in the order of entries[] */
+	printf("/* Commands, see parseInput() in calc.c */\nenum {\n");
+	for (first = 1, i = 0; i < NENTRIES; i++) {
+		if (strcmp(entries[i].kind, COMMAND) != 0)
+			continue;
+
+		putchar('\t');
+		print_id("CMD_", entries[i].name);
+		printf(first ? " = 0,\n" : ",\n");
+		first = 0;
+	}
+	printf("};\n\n");
+
+	printf("/* Functions: these are the values of FUNCTION nodes, "
+	       "so they\n * start past the NODE_TYPEs, see parse.h */\n"
+	       "#define FN_FIRST 32\n\nenum {\n");
+	for (first = 1, i = 0; i < NENTRIES; i++) {
+		if (strcmp(entries[i].kind, FUNCTION) != 0)
+			continue;
+
+		putchar('\t');
+		print_id("FN_", entries[i].name);
+		printf(first ? " = FN_FIRST,\n" : ",\n");
+		first = 0;
+	}
+	printf("\tFN_LAST\n};\n\n");
+
+	printf("/* Keyword */\nstruct keyword {\n"
+	       "\tconst char *name;\t/* NULL if the slot is empty */\n"
+	       "\tuint8_t len;\t\t/* Length of name */\n"
+	       "\tuint8_t kind;\t\t/* KW_* */\n"
+	       "\tuint8_t id;\t\t/* CMD_* or FN_* */\n"
+	       "\tuint8_t arity;\t\t/* Number of arguments of functions */\n"
+	       "\tuint8_t floating;\t/* Does the function return "
+	       "a double? */\n"
+	       "\tdouble value;\t\t/* Value of special values */\n};\n\n");
+
+	printf("/* Keywords, by the slot their name hashes to */\n"
+	       "static const struct keyword keywords[1 << KW_BITS] = {\n");
+	for (uint32_t s = 0; s < (1u << bits); s++) {
+		const struct entry *e;
+
+		if (slots[s] < 0)
+			continue;
+
+		e = &entries[slots[s]];
+		printf("\t[%2" PRIu32 "] = { \"%s\", %zu, %s, ", s, e->name,
+		       strlen(e->name), e->kind);
+
+		if (strcmp(e->kind, CONST) == 0)
+			printf("0, 0, 0, %s },\n", e->value);
+		else {
+			print_id(strcmp(e->kind, COMMAND) == 0 ? "CMD_"
+				 : "FN_", e->name);
+			printf(", %d, %d, 0 },\n", e->arity, e->floating);
+		}
+	}
+	printf("};\n\n");
+
+	/* Functions by id, for func_by_id() */
+	printf("/* Functions, by FN_* - FN_FIRST */\n"
+	       "static const struct keyword *const kw_funcs[] = {\n");
+	for (i = 0; i < NENTRIES; i++) {
+		if (strcmp(entries[i].kind, FUNCTION) != 0)
+			continue;
+
+		for (uint32_t s = 0; s < (1u << bits); s++)
+			if (slots[s] == (int)i)
+				printf("\t&keywords[%" PRIu32 "],\n", s);
+	}
+	printf("};\n\n");
+
+	printf("/* Function prototypes */\n"
+	       "static const struct keyword *keyword(const char *, "
+	       "size_t);\n\n");
+
+	printf("/* Look up a name of len bytes, whatever its case.\n"
+	       " * Returns NULL if it isn't a keyword. */\n"
+	       "static const struct keyword *\n"
+	       "keyword(const char *name, size_t len)\n{\n"
+	       "\tconst struct keyword *kw;\n"
+	       "\tuint32_t h = KW_SEED;\n\n"
+	       "\tif (len == 0 || len > KW_MAX_LEN)\n"
+	       "\t\treturn NULL;\n\n"
+	       "\t/* FNV-1a, on lowercase letters */\n"
+	       "\tfor (size_t i = 0; i < len; i++)\n"
+	       "\t\th = (h ^ ((unsigned char)name[i] | 0x20)) "
+	       "* 0x01000193u;\n\n"
+	       "\tkw = &keywords[h >> (32 - KW_BITS)];\n\n"
+	       "\tif (kw->len != len || strncasecmp(kw->name, name, len) "
+	       "!= 0)\n"
+	       "\t\treturn NULL;\n\n"
+	       "\treturn kw;\n}\n\n#endif\n");
+}
+
+int
+main(void)
+{
+	unsigned int bits = 1;
+	uint32_t seed;
+	int *slots;
+
+	/* At least twice as many slots as keywords */
+	while ((1u << bits) < 2 * NENTRIES)
+		bits++;
+
+	for (;; bits++) {
+		if ((slots = malloc(sizeof(*slots) << bits)) == NULL) {
+			perror("malloc");
+			return 1;
+		}
+
+		if (find_seed(bits, &seed, slots) == 0)
+			break;
+
+		free(slots);
+	}
+
+	print_header(bits, seed, slots);
+	free(slots);
+	return 0;
+}